@@ -56,14 +56,20 @@ typedef enum {
 const gchar *falcon_event_to_string(falcon_event_code_t event);
 
 /*
- * Only one thread will modify a single object at a time, so there's no need to
- * lock it.
+ * Objects are reference counted. An object in the cache is never modified,
+ * updates replace it with a new one. So a reference to a cached object always
+ * sees a consistent state, even after the cache has moved on.
  */
 typedef struct falcon_object_st falcon_object_t;
 
+falcon_object_t *falcon_object_ref(falcon_object_t *object);
+void falcon_object_unref(falcon_object_t *object);
+
 /*
  * This doesn't compare the watchability field, because it's not considered as
- * an attribute of the actual object on the file system.
+ * an attribute of the actual object on the file system. The inode and the
+ * nanosecond times are only compared if both objects have them. A different
+ * device doesn't count if the inode and both nanosecond times match.
  */
 gboolean falcon_object_equal(const falcon_object_t *a, const falcon_object_t *b);
 const gchar *falcon_object_get_name(const falcon_object_t *object);
@@ -71,9 +77,147 @@ gboolean falcon_object_isdir(const falcon_object_t *object);
 guint64 falcon_object_get_size(const falcon_object_t *object);
 guint64 falcon_object_get_time(const falcon_object_t *object);
 gboolean falcon_object_get_watch(const falcon_object_t *object);
+/* 0 if not known, e.g. for objects read from an older cache file. */
+guint64 falcon_object_get_dev(const falcon_object_t *object);
+guint64 falcon_object_get_ino(const falcon_object_t *object);
+/* Nanoseconds since the epoch, 0 if not known. */
+guint64 falcon_object_get_mtime(const falcon_object_t *object);
+guint64 falcon_object_get_ctime(const falcon_object_t *object);
+
+/*
+ * Totals of all the descendants of a directory.
+ */
+typedef struct {
+	guint64 files;				/* Number of files */
+	guint64 dirs;				/* Number of directories */
+	guint64 size;				/* Total size of the files in bytes */
+	guint64 time;				/* Newest time of all the descendants */
+	guint64 digest;				/* Hash of the subtree */
+} falcon_summary_t;
+
+/*
+ * Called for each object that differs between the cache and a reference. object
+ * is NULL if it only exists in the reference, reference is NULL if it only
+ * exists in the cache.
+ */
+typedef void (*falcon_diff_func)(falcon_object_t *object,
+                                 falcon_object_t *reference, gpointer userdata);
+
+/*
+ * Optional secondary indexes of the cache, ordered by an object attribute.
+ */
+typedef enum {
+	INDEX_NONE = 0,
+	INDEX_TIME = (1 << 0),
+	INDEX_SIZE = (1 << 1),
+	INDEX_NAME = (1 << 2),		/* Trigrams of the base names */
+	INDEX_FILTER = (1 << 3),	/* Bloom filter of the paths, for misses */
+	INDEX_ALL = (INDEX_TIME | INDEX_SIZE | INDEX_NAME | INDEX_FILTER)
+} falcon_index_type_t;
+
+/*
+ * Counters of the path filter. The false positive rate is false_positives
+ * over rejected plus false_positives.
+ */
+typedef struct {
+	guint64 queries;			/* Lookups checked against the filter */
+	guint64 rejected;			/* Misses answered by the filter alone */
+	guint64 false_positives;	/* Passed the filter, but not in the cache */
+	guint64 length;				/* Paths in the filter, deleted ones included */
+	guint64 memory;				/* Bytes used by the filter */
+} falcon_filter_stats_t;
+
+/*
+ * Iterates over the objects whose indexed value is within a range, in
+ * ascending order. The cache is only locked inside falcon_range_next(), so the
+ * cache may change between two calls, the iterator continues after the last
+ * returned object. Ranges must be freed before the system is shut down.
+ */
+typedef struct falcon_range_st falcon_range_t;
+
+/* Returns a reference to the next object, or NULL at the end of the range. */
+falcon_object_t *falcon_range_next(falcon_range_t *range);
+void falcon_range_free(falcon_range_t *range);
+
+/*
+ * A cursor over the objects whose name matches a pattern. Like ranges, the
+ * cache is only locked inside falcon_query_next(), and queries must be freed
+ * before the system is shut down.
+ */
+typedef struct falcon_query_st falcon_query_t;
+
+/* Returns a reference to the next object, or NULL at the end of the query. */
+falcon_object_t *falcon_query_next(falcon_query_t *query);
+void falcon_query_free(falcon_query_t *query);
+
+/*
+ * A point-in-time view of the objects in a subtree. The cache is only locked
+ * while the snapshot is taken, it keeps references to the objects so it stays
+ * consistent while the cache changes. Snapshots must be freed before the
+ * system is shut down.
+ */
+typedef struct falcon_snapshot_st falcon_snapshot_t;
+
+guint64 falcon_snapshot_length(const falcon_snapshot_t *snapshot);
+/* Calls func for each object in the snapshot, in no particular order. */
+void falcon_snapshot_foreach(const falcon_snapshot_t *snapshot, GFunc func,
+                             gpointer userdata);
+void falcon_snapshot_free(falcon_snapshot_t *snapshot);
+
+/* The object is only valid during the call, take a reference to keep it. */
+typedef void (*falcon_search_func)(falcon_object_t *object, gpointer userdata);
+
+/* Formats of the cache file written at shutdown, both can be read. */
+typedef enum {
+	FORMAT_IMAGE = 0,			/* Mapped at startup, paged in as it is used */
+	FORMAT_STREAM,				/* Read completely at startup, more compact */
+	FORMAT_COMPRESSED			/* Same as FORMAT_STREAM, compressed */
+} falcon_format_t;
+
+/* Counters of the cache files written in the background, times are in us. */
+typedef struct {
+	guint64 checkpoints;		/* Cache files written */
+	guint64 failed;				/* Cache files that failed to be written */
+	guint64 skipped;			/* Checkpoints due while nothing changed */
+	guint64 duration;			/* Spent writing, in total */
+	guint64 bytes;				/* Written, in total */
+	guint64 stall;				/* Changes were held up, in total */
+	guint64 last_duration;		/* Same, for the last checkpoint */
+	guint64 last_bytes;
+	guint64 last_stall;
+} falcon_checkpoint_stats_t;
 
+/* How falcon_init() checks the loaded cache against the file system. */
+typedef enum {
+	START_COLD = 0,				/* Lists every directory again */
+	START_WARM,					/* Only lists the directories that changed */
+	START_VERIFY				/* Same, and checks the files of the others */
+} falcon_start_t;
+
+/*
+ * Sets how falcon_init() checks the cache, START_COLD by default. With
+ * START_WARM, a directory whose time, size and mode still match the cache is
+ * not listed again, only its subdirectories are checked. The startup crawl
+ * then costs a stat per directory, plus the work for what changed while the
+ * system was down. START_VERIFY also checks the files of those directories,
+ * for files changed in place. Must be called before falcon_init(), it applies
+ * until the startup crawl is over.
+ */
+void falcon_set_start(falcon_start_t start);
+/*
+ * Loads the cache file name, and the changes made after it was written from
+ * name.journal. Changes keep being journaled until falcon_shutdown(). If the
+ * last crawl was interrupted, it goes on from the objects left in name.queue:
+ * the directories among them are listed again, the rest of the cache is
+ * checked as with START_WARM, unless another start mode was set.
+ */
 void falcon_init(const gchar *name);
-/* Waits for all the tasks to be finished if wait is TRUE. */
+/*
+ * Waits for all the tasks to be finished if wait is TRUE. Otherwise the
+ * walkers stop after the object at hand. The journal is deleted once the cache
+ * is written to name, the objects left to walk, and the failed ones, are
+ * written to name.queue. It is also written at each checkpoint.
+ */
 void falcon_shutdown(const gchar *name, gboolean wait);
 
 /*
@@ -103,6 +247,89 @@ gboolean falcon_set_watch(const gchar *name, gboolean watch);
  * Checks if the given path is already in the cache.
  */
 gboolean falcon_has(const gchar *name);
+/*
+ * Checks many paths at once, faster than calling falcon_has() on each. If
+ * found is not NULL, bit i of found[i / 8] is set if names[i] is in the
+ * cache, found must hold (count + 7) / 8 bytes. If objects is not NULL,
+ * objects[i] is set to a reference to the object or NULL. Returns the number
+ * of paths found.
+ */
+guint falcon_lookup(const gchar * const *names, guint count, guint8 *found,
+                    falcon_object_t **objects);
+/*
+ * Gets the totals of all the descendants of the given directory. This is a
+ * constant time operation, the totals are kept up to date as the cache
+ * changes.
+ */
+gboolean falcon_get_summary(const gchar *name, falcon_summary_t *summary);
+/* Gets the counters of the path filter, see INDEX_FILTER. */
+gboolean falcon_get_filter_stats(falcon_filter_stats_t *stats);
+/*
+ * Compares the descendants of the given directory, or the whole cache if name
+ * is NULL, with the ones in the reference cache file. Only the subtrees whose
+ * digests differ are visited.
+ */
+gboolean falcon_diff(const gchar *reference, const gchar *name,
+                     falcon_diff_func func, gpointer userdata);
+/* Sets the format of the cache file written by falcon_shutdown(). */
+gboolean falcon_set_format(falcon_format_t format);
+/*
+ * Splits the cache file written by falcon_shutdown() into shards, one file per
+ * directory depth levels below each topmost object, 1 for one file per root,
+ * listed in a manifest at the name of the cache file. The shards are read and
+ * written in parallel, and the file of a shard that hasn't changed since it
+ * was written is kept. 0, the default, writes a single file.
+ */
+gboolean falcon_set_shards(guint depth);
+/*
+ * Writes the cache file in the background every interval seconds, or once
+ * changes changes were made since the last time, if anything changed at all.
+ * 0 disables either trigger, both are disabled by default. Changes are only
+ * held up while the state to write is taken. Returns FALSE if no cache file
+ * name was given to falcon_init().
+ */
+gboolean falcon_set_checkpoint(guint interval, guint64 changes);
+/* Gets the counters of the checkpoints, see falcon_set_checkpoint(). */
+gboolean falcon_get_checkpoint_stats(falcon_checkpoint_stats_t *stats);
+/*
+ * Sets the secondary indexes to maintain. Indexes not in the given set are
+ * dropped, new ones are built from the current cache content.
+ */
+gboolean falcon_set_indexes(falcon_index_type_t indexes);
+/*
+ * Compiles the cache into a flat read-only index that makes lookups and
+ * subtree scans faster, meant for when the cache changes little after the
+ * initial crawl. Changes are still accepted, the index is rebuilt once enough
+ * of them piled up. Calling it again rebuilds the index right away, FALSE
+ * drops it.
+ */
+gboolean falcon_freeze(gboolean freeze);
+/*
+ * Gets an iterator over the objects whose indexed value is between min and max,
+ * both inclusive. Returns NULL if the index is not enabled.
+ */
+falcon_range_t *falcon_range_new(falcon_index_type_t index, guint64 min,
+                                 guint64 max);
+/*
+ * Gets a cursor over the objects whose path matches pattern. Each component of
+ * the pattern is either a literal, a glob with "*" and "?", or "**" which
+ * matches any number of components. Only the branches of the tree that can
+ * match are visited. The objects are returned in pre-order, the children of a
+ * directory sorted by name.
+ */
+falcon_query_t *falcon_query_new(const gchar *pattern);
+/*
+ * Calls func for each object whose base name contains pattern. If max_errors
+ * is not 0, names within max_errors insertions, deletions or substitutions of
+ * the pattern also match. Needs the INDEX_NAME index.
+ */
+gboolean falcon_search(const gchar *pattern, guint max_errors,
+                       falcon_search_func func, gpointer userdata);
+/*
+ * Takes a snapshot of the object with the given name and its descendants, or
+ * of the whole cache if name is NULL.
+ */
+falcon_snapshot_t *falcon_snapshot_new(const gchar *name);
 
 typedef gboolean (*falcon_handler_func)(falcon_object_t *object,
                                         falcon_event_code_t event,
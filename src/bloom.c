@@ -0,0 +1,186 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bloom.h"
+
+#define BLOOM_MIN_CAPACITY 4096
+/* Rebuild once a quarter of the paths are gone, but not for a handful. */
+#define BLOOM_MIN_REMOVED 256
+/* About 1% false positives with 7 probes in 512-bit blocks. */
+#define BLOOM_BITS_PER_PATH 12
+#define BLOOM_PROBES 7
+#define BLOOM_BLOCK_WORDS 8
+
+/*
+ * All the bits of a path are in the same block of one cache line, so a check
+ * costs a single miss.
+ */
+struct falcon_bloom_st {
+	guint64 *words;
+	guint64 blocks;
+	guint64 capacity;
+	guint64 length;				/* Paths added */
+	guint64 removed;			/* Paths deleted since */
+};
+
+falcon_bloom_t *falcon_bloom_new(guint64 capacity)
+{
+	falcon_bloom_t *bloom = g_new0(falcon_bloom_t, 1);
+
+	bloom->capacity = MAX(capacity, BLOOM_MIN_CAPACITY);
+	bloom->blocks = (bloom->capacity * BLOOM_BITS_PER_PATH + 511) / 512;
+	bloom->words = g_new0(guint64, bloom->blocks * BLOOM_BLOCK_WORDS);
+
+	return bloom;
+}
+
+void falcon_bloom_free(falcon_bloom_t *bloom)
+{
+	g_return_if_fail(bloom);
+
+	g_free(bloom->words);
+	g_free(bloom);
+}
+
+/*
+ * FNV-1a over the components joined by single separators, so repeated and
+ * trailing separators don't matter. A leading separator is a component of
+ * its own, like in the trie.
+ */
+static guint64 falcon_bloom_hash(const gchar *name)
+{
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	const guint64 prime = G_GUINT64_CONSTANT(1099511628211);
+	const gchar *p = name;
+	gboolean separator = FALSE;
+
+	if (*p == G_DIR_SEPARATOR) {
+		hash = (hash ^ G_DIR_SEPARATOR) * prime;
+		while (*p == G_DIR_SEPARATOR)
+			p++;
+	}
+	for (; *p; p++) {
+		if (*p == G_DIR_SEPARATOR) {
+			separator = TRUE;
+			continue;
+		}
+		if (separator) {
+			hash = (hash ^ G_DIR_SEPARATOR) * prime;
+			separator = FALSE;
+		}
+		hash = (hash ^ (guint8)*p) * prime;
+	}
+
+	/* Mix the high bits down, FNV is weak in the low ones. */
+	hash ^= hash >> 33;
+	hash *= G_GUINT64_CONSTANT(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+/*
+ * The block comes from the hash, the probes from a second mix of it, 9 bits
+ * each.
+ */
+#define BLOOM_BLOCK(bloom, hash) \
+	((bloom)->words + ((hash) % (bloom)->blocks) * BLOOM_BLOCK_WORDS)
+#define BLOOM_PROBE_HASH(hash) \
+	(((hash) ^ ((hash) >> 29)) * G_GUINT64_CONSTANT(0xc4ceb9fe1a85ec53))
+
+void falcon_bloom_add(falcon_bloom_t *bloom, const gchar *name)
+{
+	guint64 hash = 0;
+	guint64 probes = 0;
+	guint64 *block = NULL;
+	guint bit;
+	guint i;
+
+	g_return_if_fail(bloom);
+	g_return_if_fail(name);
+
+	hash = falcon_bloom_hash(name);
+	block = BLOOM_BLOCK(bloom, hash);
+	probes = BLOOM_PROBE_HASH(hash);
+	for (i = 0; i < BLOOM_PROBES; i++) {
+		bit = probes & 511;
+		block[bit / 64] |= G_GUINT64_CONSTANT(1) << (bit % 64);
+		probes >>= 9;
+	}
+	bloom->length++;
+}
+
+gboolean falcon_bloom_check(const falcon_bloom_t *bloom, const gchar *name)
+{
+	guint64 hash = 0;
+	guint64 probes = 0;
+	const guint64 *block = NULL;
+	guint bit;
+	guint i;
+
+	g_return_val_if_fail(bloom, TRUE);
+	g_return_val_if_fail(name, TRUE);
+
+	hash = falcon_bloom_hash(name);
+	block = BLOOM_BLOCK(bloom, hash);
+	probes = BLOOM_PROBE_HASH(hash);
+	for (i = 0; i < BLOOM_PROBES; i++) {
+		bit = probes & 511;
+		if (!(block[bit / 64] & (G_GUINT64_CONSTANT(1) << (bit % 64))))
+			return FALSE;
+		probes >>= 9;
+	}
+
+	return TRUE;
+}
+
+void falcon_bloom_remove(falcon_bloom_t *bloom, guint64 count)
+{
+	g_return_if_fail(bloom);
+
+	bloom->removed += count;
+}
+
+gboolean falcon_bloom_stale(const falcon_bloom_t *bloom)
+{
+	g_return_val_if_fail(bloom, FALSE);
+
+	return bloom->length > bloom->capacity
+	       || (bloom->removed > BLOOM_MIN_REMOVED
+	           && bloom->removed > bloom->length / 4);
+}
+
+guint64 falcon_bloom_length(const falcon_bloom_t *bloom)
+{
+	g_return_val_if_fail(bloom, 0);
+
+	return bloom->length;
+}
+
+gsize falcon_bloom_size(const falcon_bloom_t *bloom)
+{
+	g_return_val_if_fail(bloom, 0);
+
+	return sizeof(*bloom) + bloom->blocks * BLOOM_BLOCK_WORDS * sizeof(guint64);
+}
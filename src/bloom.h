@@ -0,0 +1,58 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _BLOOM_H_
+#define _BLOOM_H_
+
+#include <glib.h>
+
+#include "common.h"
+
+/*
+ * A Bloom filter over the paths in the cache. A path that fails
+ * falcon_bloom_check() is certainly not in the cache. Paths are hashed by
+ * component, so the spellings the trie treats as equal hash the same. Paths
+ * can't be taken out of the filter, deletions are only counted until it is
+ * rebuilt. It is not thread-safe, the cache lock protects it.
+ */
+typedef struct falcon_bloom_st falcon_bloom_t;
+
+/* Sized for capacity paths, a minimum applies. */
+falcon_bloom_t *falcon_bloom_new(guint64 capacity);
+void falcon_bloom_free(falcon_bloom_t *bloom);
+
+void falcon_bloom_add(falcon_bloom_t *bloom, const gchar *name);
+gboolean falcon_bloom_check(const falcon_bloom_t *bloom, const gchar *name);
+/* Records that count paths have been deleted from the cache. */
+void falcon_bloom_remove(falcon_bloom_t *bloom, guint64 count);
+/*
+ * Whether the filter should be rebuilt, because it is over capacity or too
+ * many of its paths have been deleted.
+ */
+gboolean falcon_bloom_stale(const falcon_bloom_t *bloom);
+guint64 falcon_bloom_length(const falcon_bloom_t *bloom);
+/* Memory used by the filter in bytes. */
+gsize falcon_bloom_size(const falcon_bloom_t *bloom);
+
+#endif
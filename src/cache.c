@@ -22,169 +22,1305 @@
  * THE SOFTWARE.
  */
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <errno.h>
-#include <glib/gstdio.h>
+#include <string.h>
 
 #include "cache.h"
+#include "summary.h"
+#include "index.h"
+#include "trigram.h"
+#include "frozen.h"
+#include "bloom.h"
+#include "traverse.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "image.h"
+#include "shard.h"
+
+/* Children of a directory are hashed once a batch looks up this many. */
+#define LOOKUP_HASH_MIN 16
+/* Bulk operations use as many threads as there are walkers. */
+#define TRAVERSE_THREADS MAX_WALKERS
 
 struct falcon_cache_st {
 	GMutex *lock;
 	guint64 count;
+	guint generation;
 	trie_node_t *objects;
+	falcon_index_t *time_index;
+	falcon_index_t *size_index;
+	falcon_trigram_t *name_index;
+	falcon_frozen_t *frozen;
+	falcon_bloom_t *filter;
+	falcon_filter_stats_t filter_stats;
+	falcon_image_t *image;		/* Objects of the cache file not paged in yet */
+	falcon_format_t format;
+	guint shards;				/* Depth of the shards, 0 for a single file */
+	GHashTable *local_changes;	/* Names changed outside the digests */
 };
 
-static void falcon_cache_recursive_foreach_top(const trie_node_t *node,
-                                               GFunc func, gpointer udata)
+typedef struct {
+	GFunc func;
+	gpointer userdata;
+} falcon_cache_each_t;
+
+typedef struct {
+	falcon_cache_t *cache;
+	gboolean watch;
+} falcon_cache_set_watch_t;
+
+/* A directory on the path of the current name in a batch lookup. */
+typedef struct {
+	gsize end;					/* Offset past its component in the name */
+	trie_node_t *node;
+	GHashTable *children;		/* Key to child, built on demand */
+	guint lookups;
+} falcon_cache_level_t;
+
+struct falcon_cursor_st {
+	falcon_cache_t *cache;
+	gchar *name;				/* The directory, NULL for the root */
+	trie_node_t *node;			/* Only valid under generation */
+	guint generation;
+};
+
+struct falcon_range_st {
+	falcon_cache_t *cache;
+	falcon_index_type_t type;
+	guint64 min;
+	guint64 max;
+	falcon_object_t *last;
+	gboolean done;
+};
+
+static void falcon_cache_index_add(falcon_cache_t *cache,
+                                   falcon_object_t *object)
+{
+	if (cache->time_index)
+		falcon_index_add(cache->time_index, object);
+	if (cache->size_index)
+		falcon_index_add(cache->size_index, object);
+	if (cache->name_index)
+		falcon_trigram_add(cache->name_index, object);
+}
+
+static void falcon_cache_index_remove(falcon_cache_t *cache,
+                                      const falcon_object_t *object)
+{
+	if (cache->time_index)
+		falcon_index_remove(cache->time_index, object);
+	if (cache->size_index)
+		falcon_index_remove(cache->size_index, object);
+	if (cache->name_index)
+		falcon_trigram_remove(cache->name_index, object);
+}
+
+static void falcon_cache_index_replace(falcon_cache_t *cache,
+                                       const falcon_object_t *old,
+                                       falcon_object_t *object)
+{
+	if (cache->time_index) {
+		falcon_index_remove(cache->time_index, old);
+		falcon_index_add(cache->time_index, object);
+	}
+	if (cache->size_index) {
+		falcon_index_remove(cache->size_index, old);
+		falcon_index_add(cache->size_index, object);
+	}
+	if (cache->name_index)
+		falcon_trigram_replace(cache->name_index, old, object);
+}
+
+static void falcon_cache_index_remove_descendants(falcon_cache_t *cache,
+                                                  trie_node_t *node)
+{
+	trie_iter_t iter;
+	falcon_object_t *data = NULL;
+
+	trie_iter_init(&iter, node, TRIE_POST_ORDER);
+	while ((node = trie_iter_next(&iter)))
+		if ((data = trie_data(node)))
+			falcon_cache_index_remove(cache, data);
+}
+
+static void falcon_cache_index_build(trie_node_t *node, void *userdata)
+{
+	falcon_index_add((falcon_index_t *)userdata, trie_data(node));
+}
+
+static void falcon_cache_trigram_build(trie_node_t *node, void *userdata)
+{
+	falcon_trigram_add((falcon_trigram_t *)userdata, trie_data(node));
+}
+
+static void falcon_cache_filter_build(trie_node_t *node, void *userdata)
+{
+	falcon_bloom_add((falcon_bloom_t *)userdata,
+	                 falcon_object_get_name(trie_data(node)));
+}
+
+/* Builds the filter from scratch, sized for twice the current content. */
+static void falcon_cache_filter_rebuild(falcon_cache_t *cache)
+{
+	if (cache->filter)
+		falcon_bloom_free(cache->filter);
+	cache->filter = falcon_bloom_new(cache->count * 2);
+	trie_foreach(cache->objects, falcon_cache_filter_build, cache->filter);
+}
+
+/*
+ * Returns FALSE if the filter proves that name is not in the cache. The
+ * caller must lock the cache.
+ */
+static gboolean falcon_cache_filter_check(falcon_cache_t *cache,
+                                          const gchar *name)
+{
+	if (!cache->filter)
+		return TRUE;
+
+	cache->filter_stats.queries++;
+	if (falcon_bloom_check(cache->filter, name))
+		return TRUE;
+	cache->filter_stats.rejected++;
+
+	return FALSE;
+}
+
+/* Rebuilds the frozen index once too much has changed since it was built. */
+static void falcon_cache_frozen_check(falcon_cache_t *cache)
+{
+	if (!falcon_frozen_stale(cache->frozen))
+		return;
+
+	falcon_frozen_free(cache->frozen);
+	cache->frozen = falcon_frozen_new(cache->objects);
+}
+
+/*
+ * Remembers that name or its descendants changed in a way the digests don't
+ * cover, for the next save of the shards. The caller must lock the cache.
+ */
+static void falcon_cache_local_changed(falcon_cache_t *cache,
+                                       const gchar *name)
+{
+	if (!cache->shards)
+		return;
+
+	if (!cache->local_changes)
+		cache->local_changes = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                                             g_free, NULL);
+	if (!g_hash_table_lookup_extended(cache->local_changes, name, NULL, NULL))
+		g_hash_table_insert(cache->local_changes, g_strdup(name), NULL);
+}
+
+/*
+ * Stores object in node, replacing the old one if any, and updates the
+ * summaries and the indexes. Takes the ownership of object. The caller must
+ * lock the cache.
+ */
+static void falcon_cache_store(falcon_cache_t *cache, trie_node_t *node,
+                               falcon_object_t *object)
+{
+	falcon_object_t *old = trie_data(node);
+
+	trie_set_data(node, object);
+	if (old) {
+		falcon_summary_replace(node, old, object);
+		falcon_cache_index_replace(cache, old, object);
+		falcon_object_unref(old);
+	} else {
+		falcon_summary_add(node, object);
+		falcon_cache_index_add(cache, object);
+		cache->count++;
+		if (cache->filter) {
+			falcon_bloom_add(cache->filter, falcon_object_get_name(object));
+			if (falcon_bloom_stale(cache->filter))
+				falcon_cache_filter_rebuild(cache);
+		}
+	}
+	if (cache->frozen) {
+		falcon_frozen_set(cache->frozen, object);
+		falcon_cache_frozen_check(cache);
+	}
+}
+
+/* Same as falcon_cache_store(), for an object added by name. */
+static void falcon_cache_replace(falcon_cache_t *cache, trie_node_t *node,
+                                 falcon_object_t *object)
+{
+	falcon_object_t *old = trie_data(node);
+
+	if (old && (falcon_object_get_watch(old) != falcon_object_get_watch(object)
+	            || falcon_object_get_dev(old) != falcon_object_get_dev(object)
+	            || falcon_object_get_ino(old) != falcon_object_get_ino(object)
+	            || falcon_object_get_ctime(old)
+	               != falcon_object_get_ctime(object)))
+		falcon_cache_local_changed(cache, falcon_object_get_name(object));
+	falcon_cache_store(cache, node, object);
+}
+
+/* Adds an object paged in from the image. */
+static void falcon_cache_page(gpointer data, gpointer userdata)
+{
+	falcon_cache_t *cache = (falcon_cache_t *)userdata;
+	falcon_object_t *object = (falcon_object_t *)data;
+	trie_node_t *node = NULL;
+
+	node = trie_insert(cache->objects, falcon_object_get_name(object));
+	if (!node) {
+		falcon_object_unref(object);
+		return;
+	}
+
+	falcon_cache_store(cache, node, object);
+}
+
+/* Drops the image once every object in it has been paged in or deleted. */
+static void falcon_cache_image_check(falcon_cache_t *cache)
+{
+	if (falcon_image_pending(cache->image))
+		return;
+
+	falcon_image_free(cache->image);
+	cache->image = NULL;
+}
+
+/*
+ * Pages in the objects of scope around name from the image, or all of them if
+ * name is NULL, so the trie can answer for them. The caller must lock the
+ * cache.
+ */
+static void falcon_cache_fault(falcon_cache_t *cache, const gchar *name,
+                               falcon_image_scope_t scope)
+{
+	if (!cache->image)
+		return;
+
+	falcon_image_fault(cache->image, name, scope, falcon_cache_page, cache);
+	falcon_cache_image_check(cache);
+}
+
+/*
+ * Makes sure the subtree of name isn't paged in after it is deleted. The caller
+ * must lock the cache.
+ */
+static void falcon_cache_forget(falcon_cache_t *cache, const gchar *name)
+{
+	if (!cache->image)
+		return;
+
+	/* The node itself has to exist in the trie to be deleted. */
+	falcon_image_fault(cache->image, name, IMAGE_PATH, falcon_cache_page,
+	                   cache);
+	falcon_image_discard(cache->image, name);
+	falcon_cache_image_check(cache);
+}
+
+/* Calls func on the topmost objects under node, without descending into them. */
+static void falcon_cache_each_top(trie_node_t *node, GFunc func, gpointer udata)
+{
+	trie_iter_t iter;
+	falcon_object_t *data = NULL;
+
+	trie_iter_init(&iter, node, TRIE_PRE_ORDER);
+	while ((node = trie_iter_next(&iter))) {
+		if ((data = trie_data(node))) {
+			func(data, udata);
+			trie_iter_skip(&iter);
+		}
+	}
+}
+
+/* Calls func on the objects under node, children before their parents. */
+static void falcon_cache_each_descendant(trie_node_t *node, GFunc func,
+                                         gpointer udata)
+{
+	trie_iter_t iter;
+	falcon_object_t *data = NULL;
+
+	trie_iter_init(&iter, node, TRIE_POST_ORDER);
+	while ((node = trie_iter_next(&iter)))
+		if ((data = trie_data(node)))
+			func(data, udata);
+}
+
+/* Takes a reference to an object, so it can be used after unlocking. */
+static void falcon_cache_collect(gpointer data, gpointer userdata)
+{
+	g_ptr_array_add((GPtrArray *)userdata, falcon_object_ref(data));
+}
+
+/* Calls func on the collected objects and releases them. */
+static void falcon_cache_call(GPtrArray *objects, GFunc func, gpointer udata)
+{
+	guint i;
+
+	for (i = 0; i < objects->len; i++) {
+		func(g_ptr_array_index(objects, i), udata);
+		falcon_object_unref(g_ptr_array_index(objects, i));
+	}
+	g_ptr_array_free(objects, TRUE);
+}
+
+static void falcon_cache_set_watch_node(falcon_cache_t *cache,
+                                        trie_node_t *node, gboolean watch)
+{
+	falcon_object_t *old = trie_data(node);
+	falcon_object_t *object = NULL;
+
+	if (!old || falcon_object_get_watch(old) == watch)
+		return;
+
+	/* Cached objects are immutable, replace it with an updated copy. */
+	object = falcon_object_copy(old);
+	falcon_object_set_watch(object, watch);
+	falcon_cache_store(cache, node, object);
+}
+
+static void falcon_cache_set_watch_descendants(falcon_cache_t *cache,
+                                               trie_node_t *node,
+                                               gboolean watch)
+{
+	trie_iter_t iter;
+
+	trie_iter_init(&iter, node, TRIE_POST_ORDER);
+	while ((node = trie_iter_next(&iter)))
+		falcon_cache_set_watch_node(cache, node, watch);
+}
+
+/*
+ * The watch flag is not part of the totals and digests, so without indexes
+ * the object is swapped on its own node and nothing shared with other nodes is
+ * written. This lets subtrees be replaced from several threads at once.
+ */
+static void falcon_cache_set_watch_one(trie_node_t *node,
+                                       guint worker ATTRIBUTE_UNUSED,
+                                       gpointer userdata)
+{
+	falcon_cache_set_watch_t *set = (falcon_cache_set_watch_t *)userdata;
+	falcon_cache_t *cache = set->cache;
+	falcon_object_t *old = trie_data(node);
+	falcon_object_t *object = NULL;
+
+	g_return_if_fail(!cache->time_index && !cache->size_index
+	                 && !cache->name_index && !cache->frozen);
+
+	if (!old || falcon_object_get_watch(old) == set->watch)
+		return;
+
+	object = falcon_object_copy(old);
+	falcon_object_set_watch(object, set->watch);
+	trie_set_data(node, object);
+	falcon_object_unref(old);
+}
+
+static void falcon_cache_free_one(trie_node_t *node,
+                                  guint worker ATTRIBUTE_UNUSED,
+                                  gpointer userdata ATTRIBUTE_UNUSED)
+{
+	trie_free_node(node, (trie_free_func)falcon_object_unref,
+	               falcon_summary_free);
+}
+
+static void falcon_cache_each_one(trie_node_t *node,
+                                  guint worker ATTRIBUTE_UNUSED,
+                                  gpointer userdata)
+{
+	falcon_cache_each_t *each = (falcon_cache_each_t *)userdata;
+	falcon_object_t *data = trie_data(node);
+
+	if (data)
+		each->func(data, each->userdata);
+}
+
+/* Gets the full name of the entry key of the cursor's directory. */
+static gchar *falcon_cursor_path(const falcon_cursor_t *cursor,
+                                 const gchar *key)
+{
+	if (!cursor->name)
+		return g_strdup(key);
+	return g_build_path(G_DIR_SEPARATOR_S, cursor->name, key,
+	                    (const gchar *)NULL);
+}
+
+static void recursive_print(const trie_node_t *node, guint l)
+{
+	guint i = 0;
+	guint len = 0;
+
+	while (node) {
+		printf("%s", trie_key(node) ? trie_key(node) : "ROOT");
+		if (trie_child(node)) {
+			if (trie_key(node))
+				len = strlen(trie_key(node)) + 2;
+			printf("->");
+			recursive_print(trie_child(node), l + len);
+		}
+		if (trie_next(node))
+			printf("\n");
+		for (i = 0; i < l; i++)
+			printf(" ");
+		node = trie_next(node);
+	}
+}
+
+falcon_cache_t *falcon_cache_new(void)
+{
+	falcon_cache_t *cache = g_new0(falcon_cache_t, 1);
+	cache->lock = g_mutex_new();
+	cache->objects = trie_new(G_DIR_SEPARATOR_S, 1);
+	return cache;
+}
+
+void falcon_cache_free(falcon_cache_t *cache)
+{
+	g_return_if_fail(cache);
+
+	if (cache->time_index)
+		falcon_index_free(cache->time_index);
+	if (cache->size_index)
+		falcon_index_free(cache->size_index);
+	if (cache->name_index)
+		falcon_trigram_free(cache->name_index);
+	if (cache->frozen)
+		falcon_frozen_free(cache->frozen);
+	if (cache->filter)
+		falcon_bloom_free(cache->filter);
+	if (cache->image)
+		falcon_image_free(cache->image);
+	if (cache->local_changes)
+		g_hash_table_destroy(cache->local_changes);
+	trie_free_full(cache->objects, (trie_free_func)falcon_object_unref,
+	               falcon_summary_free);
+	g_mutex_free(cache->lock);
+	g_free(cache);
+}
+
+falcon_object_t *falcon_cache_get(falcon_cache_t *cache, const gchar *name)
+{
+	trie_node_t *node = NULL;
+	falcon_object_t *object = NULL;
+
+	g_return_val_if_fail(cache, NULL);
+	g_return_val_if_fail(name, NULL);
+
+	g_mutex_lock(cache->lock);
+	falcon_cache_fault(cache, name, IMAGE_PATH);
+	if (!falcon_cache_filter_check(cache, name)) {
+		g_mutex_unlock(cache->lock);
+		return NULL;
+	}
+
+	if (cache->frozen) {
+		object = falcon_frozen_get(cache->frozen, name);
+	} else {
+		node = trie_find(cache->objects, name);
+		object = trie_data(node);
+	}
+	if (object)
+		falcon_object_ref(object);
+	else if (cache->filter)
+		cache->filter_stats.false_positives++;
+	g_mutex_unlock(cache->lock);
+	return object;
+}
+
+static gint falcon_cache_compare_names(gconstpointer a, gconstpointer b,
+                                       gpointer userdata)
+{
+	const gchar * const *names = (const gchar * const *)userdata;
+
+	return g_strcmp0(names[*(const guint *)a], names[*(const guint *)b]);
+}
+
+static trie_node_t *falcon_cache_lookup_child(falcon_cache_level_t *level,
+                                              const gchar *key, gsize len,
+                                              GString *scratch)
+{
+	trie_node_t *child = NULL;
+
+	/* Sibling lists are linear, hash the busy ones. */
+	if (!level->children && ++level->lookups > LOOKUP_HASH_MIN) {
+		level->children = g_hash_table_new(g_str_hash, g_str_equal);
+		for (child = trie_child(level->node); child; child = trie_next(child))
+			g_hash_table_insert(level->children, (gpointer)trie_key(child),
+			                    child);
+	}
+	if (!level->children)
+		return trie_find_child_len(level->node, key, len);
+
+	g_string_truncate(scratch, 0);
+	g_string_append_len(scratch, key, len);
+	return g_hash_table_lookup(level->children, scratch->str);
+}
+
+static void falcon_cache_pop_level(GArray *levels)
+{
+	falcon_cache_level_t *level = NULL;
+
+	level = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+	if (level->children)
+		g_hash_table_destroy(level->children);
+	g_array_set_size(levels, levels->len - 1);
+}
+
+/*
+ * Looks the names up in sorted order. The directories on the path of the
+ * previous name are kept on a stack, so a name only walks down from where it
+ * differs from the previous one.
+ */
+static void falcon_cache_lookup_trie(falcon_cache_t *cache,
+                                     const gchar * const *names,
+                                     const guint *order, guint count,
+                                     falcon_object_t **result)
+{
+	falcon_cache_level_t level;
+	falcon_cache_level_t *top = NULL;
+	GString *scratch = g_string_new(NULL);
+	GArray *levels = NULL;
+	trie_node_t *node = NULL;
+	const gchar *prev = NULL;
+	const gchar *name = NULL;
+	const gchar *start = NULL;
+	const gchar *end = NULL;
+	gsize common = 0;
+	guint i;
+
+	levels = g_array_new(FALSE, TRUE, sizeof(falcon_cache_level_t));
+	memset(&level, 0, sizeof(level));
+	level.node = cache->objects;
+	g_array_append_val(levels, level);
+
+	for (i = 0; i < count; i++) {
+		name = names[order[i]];
+		if (!name || *name == '\0' || !falcon_cache_filter_check(cache, name))
+			continue;
+
+		/* Keep the levels whose whole component is shared with prev. */
+		for (common = 0; prev && prev[common] && prev[common] == name[common];
+		     common++)
+			;
+		while (levels->len > 1) {
+			top = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+			if (top->end <= common
+			    && (name[top->end - 1] == G_DIR_SEPARATOR
+			        || name[top->end] == G_DIR_SEPARATOR
+			        || name[top->end] == '\0'))
+				break;
+			falcon_cache_pop_level(levels);
+		}
+		prev = name;
+
+		top = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+		node = top->node;
+		start = name + top->end;
+		if (start != name)
+			while (*start == G_DIR_SEPARATOR)
+				start++;
+		while (*start) {
+			if (start == name && *start == G_DIR_SEPARATOR) {
+				end = start + 1;
+			} else {
+				end = strchr(start, G_DIR_SEPARATOR);
+				if (!end)
+					end = start + strlen(start);
+			}
+
+			top = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+			node = falcon_cache_lookup_child(top, start, end - start, scratch);
+			if (!node)
+				break;
+
+			memset(&level, 0, sizeof(level));
+			level.end = end - name;
+			level.node = node;
+			g_array_append_val(levels, level);
+
+			for (start = end; *start == G_DIR_SEPARATOR; start++)
+				;
+		}
+		result[order[i]] = node ? trie_data(node) : NULL;
+		if (!result[order[i]] && cache->filter)
+			cache->filter_stats.false_positives++;
+	}
+
+	while (levels->len)
+		falcon_cache_pop_level(levels);
+	g_array_free(levels, TRUE);
+	g_string_free(scratch, TRUE);
+}
+
+guint falcon_cache_lookup(falcon_cache_t *cache, const gchar * const *names,
+                          guint count, guint8 *found, falcon_object_t **objects)
+{
+	falcon_object_t **result = NULL;
+	guint *order = NULL;
+	guint ret = 0;
+	guint i;
+
+	g_return_val_if_fail(cache, 0);
+	g_return_val_if_fail(names || !count, 0);
+
+	/*
+	 * Sorted outside the lock even if the cache is frozen, which can only be
+	 * told once the lock is held.
+	 */
+	result = g_new0(falcon_object_t *, count);
+	order = g_new(guint, count);
+	for (i = 0; i < count; i++)
+		order[i] = i;
+	g_qsort_with_data(order, count, sizeof(guint), falcon_cache_compare_names,
+	                  (gpointer)names);
+
+	g_mutex_lock(cache->lock);
+	for (i = 0; cache->image && i < count; i++)
+		if (names[i])
+			falcon_cache_fault(cache, names[i], IMAGE_PATH);
+	if (cache->frozen) {
+		for (i = 0; i < count; i++) {
+			if (!names[i] || !falcon_cache_filter_check(cache, names[i]))
+				continue;
+			result[i] = falcon_frozen_get(cache->frozen, names[i]);
+			if (!result[i] && cache->filter)
+				cache->filter_stats.false_positives++;
+		}
+	} else {
+		falcon_cache_lookup_trie(cache, names, order, count, result);
+	}
+	for (i = 0; objects && i < count; i++)
+		if ((objects[i] = result[i]))
+			falcon_object_ref(objects[i]);
+	g_mutex_unlock(cache->lock);
+
+	if (found)
+		memset(found, 0, (count + 7) / 8);
+	for (i = 0; i < count; i++) {
+		if (!result[i])
+			continue;
+		if (found)
+			found[i / 8] |= 1 << (i % 8);
+		ret++;
+	}
+
+	g_free(order);
+	g_free(result);
+
+	return ret;
+}
+
+gboolean falcon_cache_add(falcon_cache_t *cache, falcon_object_t *object)
+{
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(object, FALSE);
+
+	return falcon_cache_add_steal(cache, falcon_object_copy(object));
+}
+
+gboolean falcon_cache_add_steal(falcon_cache_t *cache, falcon_object_t *object)
+{
+	trie_node_t *node = NULL;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(object, FALSE);
+
+	g_mutex_lock(cache->lock);
+	falcon_cache_fault(cache, falcon_object_get_name(object), IMAGE_PATH);
+	node = trie_insert(cache->objects, falcon_object_get_name(object));
+	if (!node) {
+		g_mutex_unlock(cache->lock);
+		falcon_object_unref(object);
+		return FALSE;
+	}
+
+	falcon_cache_replace(cache, node, object);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
+}
+
+/*
+ * Deletes node, named name, with its descendants. The caller must lock the
+ * cache.
+ */
+static void falcon_cache_delete_node(falcon_cache_t *cache, trie_node_t *node,
+                                     const gchar *name)
+{
+	falcon_summary_t summary;
+	guint64 removed = 0;
+
+	/* The descendants go away with the node. */
+	falcon_summary_get(node, &summary);
+	removed = summary.files + summary.dirs + (trie_data(node) ? 1 : 0);
+	cache->count -= removed;
+	falcon_summary_remove(node);
+	if (cache->time_index || cache->size_index || cache->name_index) {
+		falcon_cache_index_remove_descendants(cache, node);
+		if (trie_data(node))
+			falcon_cache_index_remove(cache, trie_data(node));
+	}
+	trie_unlink(node);
+	falcon_traverse(node, TRAVERSE_THREADS, falcon_cache_free_one, NULL);
+	trie_free_node(node, (trie_free_func)falcon_object_unref,
+	               falcon_summary_free);
+	cache->generation++;
+	if (cache->frozen) {
+		falcon_frozen_delete(cache->frozen, name);
+		falcon_cache_frozen_check(cache);
+	}
+	if (cache->filter) {
+		falcon_bloom_remove(cache->filter, removed);
+		if (falcon_bloom_stale(cache->filter))
+			falcon_cache_filter_rebuild(cache);
+	}
+}
+
+gboolean falcon_cache_delete(falcon_cache_t *cache, const gchar *name)
+{
+	trie_node_t *node = NULL;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(name, FALSE);
+
+	g_mutex_lock(cache->lock);
+	falcon_cache_forget(cache, name);
+	node = trie_find(cache->objects, name);
+	if (!node) {
+		g_mutex_unlock(cache->lock);
+		g_warning(_("Failed to delete \"%s\", it does not exist in the cache."),
+		          name);
+		return FALSE;
+	}
+
+	falcon_cache_delete_node(cache, node, name);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
+}
+
+gboolean falcon_cache_set_watch(falcon_cache_t *cache, const gchar *name,
+                                gboolean watch)
+{
+	trie_node_t *node = NULL;
+	falcon_cache_set_watch_t set;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(name, FALSE);
+
+	g_mutex_lock(cache->lock);
+	falcon_cache_fault(cache, name, IMAGE_SUBTREE);
+	node = trie_find(cache->objects, name);
+	if (!node) {
+		g_mutex_unlock(cache->lock);
+		return FALSE;
+	}
+
+	/* The indexes can only be updated from one thread. */
+	if (cache->time_index || cache->size_index || cache->name_index
+	    || cache->frozen) {
+		falcon_cache_set_watch_descendants(cache, node, watch);
+	} else {
+		set.cache = cache;
+		set.watch = watch;
+		falcon_traverse(node, TRAVERSE_THREADS, falcon_cache_set_watch_one,
+		                &set);
+	}
+	falcon_cache_set_watch_node(cache, node, watch);
+	falcon_cache_local_changed(cache, name);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
+}
+
+gboolean falcon_cache_get_summary(falcon_cache_t *cache, const gchar *name,
+                                  falcon_summary_t *summary)
+{
+	trie_node_t *node = NULL;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(name, FALSE);
+	g_return_val_if_fail(summary, FALSE);
+
+	g_mutex_lock(cache->lock);
+	falcon_cache_fault(cache, name, IMAGE_SUBTREE);
+	node = trie_find(cache->objects, name);
+	if (!node) {
+		g_mutex_unlock(cache->lock);
+		return FALSE;
+	}
+
+	falcon_summary_get(node, summary);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
+}
+
+void falcon_cache_diff(falcon_cache_t *cache, falcon_cache_t *reference,
+                       const gchar *name, falcon_diff_func func,
+                       gpointer userdata)
+{
+	falcon_cache_t *first = NULL;
+	falcon_cache_t *second = NULL;
+	trie_node_t *node = NULL;
+	trie_node_t *other = NULL;
+
+	g_return_if_fail(cache);
+	g_return_if_fail(reference);
+	g_return_if_fail(func);
+
+	if (cache == reference)
+		return;
+
+	/* Always lock in the same order to avoid deadlocks. */
+	first = cache < reference ? cache : reference;
+	second = cache < reference ? reference : cache;
+	g_mutex_lock(first->lock);
+	g_mutex_lock(second->lock);
+
+	falcon_cache_fault(cache, name, IMAGE_SUBTREE);
+	falcon_cache_fault(reference, name, IMAGE_SUBTREE);
+	if (name) {
+		node = trie_find(cache->objects, name);
+		other = trie_find(reference->objects, name);
+	} else {
+		node = cache->objects;
+		other = reference->objects;
+	}
+	falcon_summary_diff(node, other, func, userdata);
+
+	g_mutex_unlock(second->lock);
+	g_mutex_unlock(first->lock);
+}
+
+void falcon_cache_clear(falcon_cache_t *cache)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+	if (cache->image) {
+		falcon_image_free(cache->image);
+		cache->image = NULL;
+	}
+	trie_free_full(cache->objects, (trie_free_func)falcon_object_unref,
+	               falcon_summary_free);
+	cache->objects = trie_new(G_DIR_SEPARATOR_S, 1);
+	cache->count = 0;
+	cache->generation++;
+	if (cache->local_changes)
+		g_hash_table_remove_all(cache->local_changes);
+	if (cache->time_index) {
+		falcon_index_free(cache->time_index);
+		cache->time_index = falcon_index_new(INDEX_TIME);
+	}
+	if (cache->size_index) {
+		falcon_index_free(cache->size_index);
+		cache->size_index = falcon_index_new(INDEX_SIZE);
+	}
+	if (cache->name_index) {
+		falcon_trigram_free(cache->name_index);
+		cache->name_index = falcon_trigram_new();
+	}
+	if (cache->frozen) {
+		falcon_frozen_free(cache->frozen);
+		cache->frozen = falcon_frozen_new(cache->objects);
+	}
+	if (cache->filter)
+		falcon_cache_filter_rebuild(cache);
+	g_mutex_unlock(cache->lock);
+}
+
+void falcon_cache_set_indexes(falcon_cache_t *cache,
+                              falcon_index_type_t indexes)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+	/* The path filter is checked after paging in, it can stay partial. */
+	if (indexes & (INDEX_TIME | INDEX_SIZE | INDEX_NAME))
+		falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+	if ((indexes & INDEX_TIME) && !cache->time_index) {
+		cache->time_index = falcon_index_new(INDEX_TIME);
+		trie_foreach(cache->objects, falcon_cache_index_build,
+		             cache->time_index);
+	} else if (!(indexes & INDEX_TIME) && cache->time_index) {
+		falcon_index_free(cache->time_index);
+		cache->time_index = NULL;
+	}
+	if ((indexes & INDEX_SIZE) && !cache->size_index) {
+		cache->size_index = falcon_index_new(INDEX_SIZE);
+		trie_foreach(cache->objects, falcon_cache_index_build,
+		             cache->size_index);
+	} else if (!(indexes & INDEX_SIZE) && cache->size_index) {
+		falcon_index_free(cache->size_index);
+		cache->size_index = NULL;
+	}
+	if ((indexes & INDEX_NAME) && !cache->name_index) {
+		cache->name_index = falcon_trigram_new();
+		trie_foreach(cache->objects, falcon_cache_trigram_build,
+		             cache->name_index);
+	} else if (!(indexes & INDEX_NAME) && cache->name_index) {
+		falcon_trigram_free(cache->name_index);
+		cache->name_index = NULL;
+	}
+	if ((indexes & INDEX_FILTER) && !cache->filter) {
+		falcon_cache_filter_rebuild(cache);
+	} else if (!(indexes & INDEX_FILTER) && cache->filter) {
+		falcon_bloom_free(cache->filter);
+		cache->filter = NULL;
+	}
+	g_mutex_unlock(cache->lock);
+}
+
+void falcon_cache_freeze(falcon_cache_t *cache, gboolean freeze)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+	if (cache->frozen) {
+		falcon_frozen_free(cache->frozen);
+		cache->frozen = NULL;
+	}
+	if (freeze) {
+		falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+		cache->frozen = falcon_frozen_new(cache->objects);
+	}
+	g_mutex_unlock(cache->lock);
+}
+
+falcon_cursor_t *falcon_cache_cursor_new(falcon_cache_t *cache,
+                                        const gchar *name)
+{
+	falcon_cursor_t *cursor = NULL;
+
+	g_return_val_if_fail(cache, NULL);
+
+	cursor = g_new0(falcon_cursor_t, 1);
+	cursor->cache = cache;
+	cursor->name = g_strdup(name);
+
+	return cursor;
+}
+
+void falcon_cursor_free(falcon_cursor_t *cursor)
+{
+	g_return_if_fail(cursor);
+
+	g_free(cursor->name);
+	g_free(cursor);
+}
+
+const gchar *falcon_cursor_seek(falcon_cursor_t *cursor, const gchar *name)
+{
+	const gchar *key = NULL;
+	gsize len = 0;
+
+	g_return_val_if_fail(cursor, NULL);
+	g_return_val_if_fail(name, NULL);
+
+	key = strrchr(name, G_DIR_SEPARATOR);
+	if (!key || key[1] == '\0')
+		return NULL;
+
+	/* The parent of a top level entry is the root directory. */
+	len = key == name ? 1 : (gsize)(key - name);
+	if (!cursor->name || strlen(cursor->name) != len
+	    || strncmp(cursor->name, name, len) != 0) {
+		g_free(cursor->name);
+		cursor->name = g_strndup(name, len);
+		cursor->node = NULL;
+	}
+
+	return key + 1;
+}
+
+/*
+ * Gets the node of the directory, looking it up again if nodes have been
+ * freed since. If create is TRUE, the nodes on the way are created. The caller
+ * must lock the cache.
+ */
+static trie_node_t *falcon_cursor_node(falcon_cursor_t *cursor,
+                                       gboolean create)
+{
+	falcon_cache_t *cache = cursor->cache;
+
+	if (cursor->generation != cache->generation) {
+		cursor->generation = cache->generation;
+		cursor->node = NULL;
+	}
+	if (!cursor->node) {
+		if (!cursor->name)
+			cursor->node = cache->objects;
+		else if (create)
+			cursor->node = trie_insert(cache->objects, cursor->name);
+		else
+			cursor->node = trie_find(cache->objects, cursor->name);
+	}
+
+	return cursor->node;
+}
+
+falcon_object_t *falcon_cursor_get(falcon_cursor_t *cursor, const gchar *key)
 {
-	falcon_object_t *data = NULL;
+	falcon_object_t *object = NULL;
+	trie_node_t *node = NULL;
+	gchar *name = NULL;
 
-	while (node) {
-		if ((data = trie_data(node))) {
-			func(data, udata);
-		} else if (trie_child(node)) {
-			falcon_cache_recursive_foreach_top(trie_child(node), func, udata);
-		}
-		node = trie_next(node);
+	g_return_val_if_fail(cursor, NULL);
+	g_return_val_if_fail(key, NULL);
+
+	g_mutex_lock(cursor->cache->lock);
+	if (cursor->cache->image) {
+		name = falcon_cursor_path(cursor, key);
+		falcon_cache_fault(cursor->cache, name, IMAGE_PATH);
+		g_free(name);
 	}
+	if ((node = falcon_cursor_node(cursor, FALSE)))
+		node = trie_find_child(node, key);
+	if ((object = trie_data(node)))
+		falcon_object_ref(object);
+	g_mutex_unlock(cursor->cache->lock);
+
+	return object;
 }
 
-static void falcon_cache_recursive_foreach_descendant(const trie_node_t *node,
-                                                      GFunc func, gpointer udata)
+gboolean falcon_cursor_add_steal(falcon_cursor_t *cursor,
+                                 falcon_object_t *object)
 {
-	falcon_object_t *data = NULL;
+	const gchar *name = NULL;
+	const gchar *key = NULL;
+	trie_node_t *node = NULL;
 
-	while (node) {
-		if (trie_child(node))
-			falcon_cache_recursive_foreach_descendant(trie_child(node), func,
-			                                          udata);
-		if ((data = trie_data(node)))
-			func(data, udata);
-		node = trie_next(node);
+	g_return_val_if_fail(cursor, FALSE);
+	g_return_val_if_fail(object, FALSE);
+
+	/* Anything not directly under the cursor goes the long way. */
+	name = falcon_object_get_name(object);
+	key = name ? strrchr(name, G_DIR_SEPARATOR) : NULL;
+	if (!key || !cursor->name || key[1] == '\0'
+	    || strlen(cursor->name) != (key == name ? 1 : (gsize)(key - name))
+	    || strncmp(cursor->name, name, strlen(cursor->name)) != 0)
+		return falcon_cache_add_steal(cursor->cache, object);
+
+	g_mutex_lock(cursor->cache->lock);
+	falcon_cache_fault(cursor->cache, name, IMAGE_PATH);
+	if ((node = falcon_cursor_node(cursor, TRUE)))
+		node = trie_insert_child(node, key + 1);
+	if (!node) {
+		g_mutex_unlock(cursor->cache->lock);
+		falcon_object_unref(object);
+		return FALSE;
 	}
+
+	falcon_cache_replace(cursor->cache, node, object);
+	g_mutex_unlock(cursor->cache->lock);
+
+	return TRUE;
 }
 
-static void recursive_print(const trie_node_t *node, guint l)
+gboolean falcon_cursor_delete(falcon_cursor_t *cursor, const gchar *key)
 {
-	guint i = 0;
-	guint len = 0;
+	falcon_cache_t *cache = NULL;
+	trie_node_t *node = NULL;
+	gchar *name = NULL;
 
-	while (node) {
-		printf("%s", trie_key(node) ? trie_key(node) : "ROOT");
-		if (trie_child(node)) {
-			if (trie_key(node))
-				len = strlen(trie_key(node)) + 2;
-			printf("->");
-			recursive_print(trie_child(node), l + len);
-		}
-		if (trie_next(node))
-			printf("\n");
-		for (i = 0; i < l; i++)
-			printf(" ");
-		node = trie_next(node);
+	g_return_val_if_fail(cursor, FALSE);
+	g_return_val_if_fail(key, FALSE);
+
+	cache = cursor->cache;
+	name = falcon_cursor_path(cursor, key);
+	g_mutex_lock(cache->lock);
+	falcon_cache_forget(cache, name);
+	if ((node = falcon_cursor_node(cursor, FALSE)))
+		node = trie_find_child(node, key);
+	if (!node) {
+		g_mutex_unlock(cache->lock);
+		g_warning(_("Failed to delete \"%s\", it does not exist in the cache."),
+		          key);
+		g_free(name);
+		return FALSE;
 	}
+
+	falcon_cache_delete_node(cache, node, name);
+	/* Only a child went away, the cursor's own node is still valid. */
+	cursor->generation = cache->generation;
+	g_mutex_unlock(cache->lock);
+	g_free(name);
+
+	return TRUE;
 }
 
-falcon_cache_t *falcon_cache_new(void)
+void falcon_cursor_foreach_child(falcon_cursor_t *cursor, const gchar *key,
+                                 GFunc func, gpointer userdata)
 {
-	falcon_cache_t *cache = g_new0(falcon_cache_t, 1);
-	cache->lock = g_mutex_new();
-	cache->objects = trie_new(G_DIR_SEPARATOR_S, 1);
-	return cache;
+	trie_node_t *node = NULL;
+	trie_node_t *next = NULL;
+	falcon_object_t *data = NULL;
+	GPtrArray *objects = NULL;
+	gchar *name = NULL;
+
+	g_return_if_fail(cursor);
+	g_return_if_fail(key);
+	g_return_if_fail(func);
+
+	objects = g_ptr_array_new();
+	g_mutex_lock(cursor->cache->lock);
+	if (cursor->cache->image) {
+		name = falcon_cursor_path(cursor, key);
+		falcon_cache_fault(cursor->cache, name, IMAGE_CHILDREN);
+		g_free(name);
+	}
+	if ((node = falcon_cursor_node(cursor, FALSE)))
+		node = trie_find_child(node, key);
+	for (next = trie_child(node); next; next = trie_next(next))
+		if ((data = trie_data(next)))
+			falcon_cache_collect(data, objects);
+	if ((data = trie_data(node)))
+		falcon_cache_collect(data, objects);
+	g_mutex_unlock(cursor->cache->lock);
+
+	falcon_cache_call(objects, func, userdata);
 }
 
-void falcon_cache_free(falcon_cache_t *cache)
+gboolean falcon_cache_get_filter_stats(falcon_cache_t *cache,
+                                       falcon_filter_stats_t *stats)
 {
-	g_return_if_fail(cache);
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(stats, FALSE);
 
-	trie_free(cache->objects, (trie_free_func)falcon_object_free);
-	g_mutex_free(cache->lock);
-	g_free(cache);
+	g_mutex_lock(cache->lock);
+	if (!cache->filter) {
+		g_mutex_unlock(cache->lock);
+		return FALSE;
+	}
+
+	*stats = cache->filter_stats;
+	stats->length = falcon_bloom_length(cache->filter);
+	stats->memory = falcon_bloom_size(cache->filter);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
 }
 
-falcon_object_t *falcon_cache_get(falcon_cache_t *cache, const gchar *name)
+falcon_range_t *falcon_cache_range_new(falcon_cache_t *cache,
+                                       falcon_index_type_t index, guint64 min,
+                                       guint64 max)
 {
-	trie_node_t *node = NULL;
+	falcon_range_t *range = NULL;
+	gboolean enabled = FALSE;
 
 	g_return_val_if_fail(cache, NULL);
-	g_return_val_if_fail(name, NULL);
+	g_return_val_if_fail(index == INDEX_TIME || index == INDEX_SIZE, NULL);
 
 	g_mutex_lock(cache->lock);
-	node = trie_find(cache->objects, name);
+	if (index == INDEX_TIME)
+		enabled = cache->time_index != NULL;
+	else
+		enabled = cache->size_index != NULL;
 	g_mutex_unlock(cache->lock);
-	return trie_data(node);
+
+	if (!enabled) {
+		g_warning(_("Failed to create range, the index is not enabled."));
+		return NULL;
+	}
+
+	range = g_new0(falcon_range_t, 1);
+	range->cache = cache;
+	range->type = index;
+	range->min = min;
+	range->max = max;
+
+	return range;
 }
 
-gboolean falcon_cache_add(falcon_cache_t *cache, falcon_object_t *object)
+falcon_object_t *falcon_range_next(falcon_range_t *range)
 {
-	trie_node_t *old_node = NULL;
-	falcon_object_t *old = NULL;
-	falcon_object_t *dup = falcon_object_copy(object);
+	falcon_index_t *index = NULL;
+	falcon_object_t *object = NULL;
 
-	g_return_val_if_fail(cache, FALSE);
-	g_return_val_if_fail(object, FALSE);
+	g_return_val_if_fail(range, NULL);
 
-	g_mutex_lock(cache->lock);
-	old_node = trie_find(cache->objects, falcon_object_get_name(dup));
+	if (range->done)
+		return NULL;
 
-	if (old_node && (old = trie_data(old_node))) {
-		falcon_object_free(old);
-		trie_set_data(old_node, dup);
-	} else {
-		trie_add(cache->objects, falcon_object_get_name(dup), dup);
-		cache->count++;
+	g_mutex_lock(range->cache->lock);
+	if (range->type == INDEX_TIME)
+		index = range->cache->time_index;
+	else
+		index = range->cache->size_index;
+
+	if (index && range->min <= range->max) {
+		/*
+		 * Search again from the last returned object instead of keeping a
+		 * position in the index, it may have been removed in the meantime.
+		 */
+		if (range->last)
+			object = falcon_index_next(index,
+			                           falcon_index_value(index, range->last),
+			                           falcon_object_get_name(range->last));
+		else
+			object = falcon_index_next(index, range->min, NULL);
+		if (object && falcon_index_value(index, object) > range->max)
+			object = NULL;
 	}
 
-	g_mutex_unlock(cache->lock);
+	if (range->last)
+		falcon_object_unref(range->last);
+	range->last = object ? falcon_object_ref(object) : NULL;
+	if (object)
+		falcon_object_ref(object);
+	else
+		range->done = TRUE;
+	g_mutex_unlock(range->cache->lock);
 
-	return TRUE;
+	return object;
 }
 
-gboolean falcon_cache_delete(falcon_cache_t *cache, const gchar *name)
+GPtrArray *falcon_cache_search(falcon_cache_t *cache, const gchar *pattern,
+                               guint max_errors)
 {
-	trie_node_t *node = NULL;
+	GPtrArray *result = NULL;
 
-	g_return_val_if_fail(cache, FALSE);
-	g_return_val_if_fail(name, FALSE);
+	g_return_val_if_fail(cache, NULL);
+	g_return_val_if_fail(pattern, NULL);
 
 	g_mutex_lock(cache->lock);
-	node = trie_find(cache->objects, name);
-	if (!node) {
-		g_mutex_unlock(cache->lock);
-		g_warning(_("Failed to delete \"%s\", it does not exist in the cache."),
-		          name);
-		return FALSE;
+	if (cache->name_index) {
+		result = g_ptr_array_new();
+		falcon_trigram_search(cache->name_index, pattern, max_errors, result);
 	}
-
-	trie_delete(cache->objects, name, (trie_free_func)falcon_object_free);
-	cache->count--;
 	g_mutex_unlock(cache->lock);
 
-	return TRUE;
+	if (!result)
+		g_warning(_("Failed to search, the name index is not enabled."));
+
+	return result;
 }
 
-void falcon_cache_clear(falcon_cache_t *cache)
+void falcon_range_free(falcon_range_t *range)
 {
-	g_return_if_fail(cache);
+	g_return_if_fail(range);
 
-	g_mutex_lock(cache->lock);
-	trie_free(cache->objects, (trie_free_func)falcon_object_free);
-	cache->objects = trie_new(G_DIR_SEPARATOR_S, 1);
-	cache->count = 0;
-	g_mutex_unlock(cache->lock);
+	if (range->last)
+		falcon_object_unref(range->last);
+	g_free(range);
 }
 
 void falcon_cache_foreach_top(falcon_cache_t *cache, GFunc func,
                               gpointer userdata)
 {
+	GPtrArray *objects = NULL;
+
 	g_return_if_fail(cache);
 	g_return_if_fail(func);
 
+	objects = g_ptr_array_new();
 	g_mutex_lock(cache->lock);
-	falcon_cache_recursive_foreach_top(trie_child(cache->objects), func,
-	                                   userdata);
+	if (cache->image) {
+		falcon_image_fault_top(cache->image, falcon_cache_page, cache);
+		falcon_cache_image_check(cache);
+	}
+	falcon_cache_each_top(cache->objects, falcon_cache_collect, objects);
 	g_mutex_unlock(cache->lock);
+
+	falcon_cache_call(objects, func, userdata);
 }
 
 void falcon_cache_foreach_child(falcon_cache_t *cache, const gchar *name,
@@ -193,21 +1329,27 @@ void falcon_cache_foreach_child(falcon_cache_t *cache, const gchar *name,
 	trie_node_t *node = NULL;
 	trie_node_t *next = NULL;
 	falcon_object_t *data = NULL;
+	GPtrArray *objects = NULL;
 
 	g_return_if_fail(cache);
 	g_return_if_fail(func);
 
+	objects = g_ptr_array_new();
 	g_mutex_lock(cache->lock);
+	if (name)
+		falcon_cache_fault(cache, name, IMAGE_CHILDREN);
 	node = trie_find(cache->objects, name);
 	next = trie_child(node);
 	while (next) {
 		if ((data = trie_data(next)))
-			func(data, userdata);
+			falcon_cache_collect(data, objects);
 		next = trie_next(next);
 	}
 	if ((data = trie_data(node)))
-		func(data, userdata);
+		falcon_cache_collect(data, objects);
 	g_mutex_unlock(cache->lock);
+
+	falcon_cache_call(objects, func, userdata);
 }
 
 void falcon_cache_foreach_descendant(falcon_cache_t *cache, const gchar *name,
@@ -215,24 +1357,176 @@ void falcon_cache_foreach_descendant(falcon_cache_t *cache, const gchar *name,
 {
 	trie_node_t *node = NULL;
 	falcon_object_t *data = NULL;
+	GPtrArray *objects = NULL;
+
+	g_return_if_fail(cache);
+	g_return_if_fail(func);
+
+	objects = g_ptr_array_new();
+	g_mutex_lock(cache->lock);
+	if (name)
+		falcon_cache_fault(cache, name, IMAGE_SUBTREE);
+	if (!name || !cache->frozen
+	    || !falcon_frozen_foreach(cache->frozen, name, falcon_cache_collect,
+	                              objects)) {
+		node = trie_find(cache->objects, name);
+		falcon_cache_each_descendant(node, falcon_cache_collect, objects);
+		if ((data = trie_data(node)))
+			falcon_cache_collect(data, objects);
+	}
+	g_mutex_unlock(cache->lock);
+
+	falcon_cache_call(objects, func, userdata);
+}
+
+void falcon_cache_foreach_descendant_parallel(falcon_cache_t *cache,
+                                              const gchar *name, GFunc func,
+                                              gpointer userdata)
+{
+	trie_node_t *node = NULL;
+	falcon_object_t *data = NULL;
+	falcon_cache_each_t each;
 
 	g_return_if_fail(cache);
 	g_return_if_fail(func);
 
+	each.func = func;
+	each.userdata = userdata;
+
 	g_mutex_lock(cache->lock);
+	if (name)
+		falcon_cache_fault(cache, name, IMAGE_SUBTREE);
 	node = trie_find(cache->objects, name);
-	falcon_cache_recursive_foreach_descendant(trie_child(node), func, userdata);
+	falcon_traverse(node, TRAVERSE_THREADS, falcon_cache_each_one, &each);
 	if ((data = trie_data(node)))
 		func(data, userdata);
 	g_mutex_unlock(cache->lock);
 }
 
+void falcon_cache_lock(falcon_cache_t *cache)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+}
+
+void falcon_cache_unlock(falcon_cache_t *cache)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_unlock(cache->lock);
+}
+
+trie_node_t *falcon_cache_root(falcon_cache_t *cache)
+{
+	g_return_val_if_fail(cache, NULL);
+
+	/* The caller walks the trie itself, it has to hold everything. */
+	falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+	return cache->objects;
+}
+
+guint falcon_cache_generation(const falcon_cache_t *cache)
+{
+	g_return_val_if_fail(cache, 0);
+
+	return cache->generation;
+}
+
 /*
- * Cache file format
+ * Builds the nodes of name, whose first shared bytes are the same as in the
+ * name before. levels holds the nodes of the components of the name before,
+ * the ones within the shared part are not looked up again. If sorted is TRUE,
+ * the names have come in trie order into an empty trie, and a new component
+ * only has to be compared with the last child of its parent. The caller must
+ * lock the cache.
+ */
+static trie_node_t *falcon_cache_insert_next(falcon_cache_t *cache,
+                                             GArray *levels, const gchar *name,
+                                             gsize shared, gboolean sorted)
+{
+	falcon_cache_level_t level;
+	falcon_cache_level_t *top = NULL;
+	trie_node_t *node = NULL;
+	const gchar *start = NULL;
+	const gchar *end = NULL;
+
+	if (!levels->len) {
+		memset(&level, 0, sizeof(level));
+		level.node = cache->objects;
+		g_array_append_val(levels, level);
+	}
+	while (levels->len > 1) {
+		top = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+		if (top->end <= shared
+		    && (name[top->end - 1] == G_DIR_SEPARATOR
+		        || name[top->end] == G_DIR_SEPARATOR
+		        || name[top->end] == '\0'))
+			break;
+		g_array_set_size(levels, levels->len - 1);
+	}
+
+	top = &g_array_index(levels, falcon_cache_level_t, levels->len - 1);
+	node = top->node;
+	start = name + top->end;
+	while ((start = falcon_path_component(name, start, &end))) {
+		if (sorted)
+			node = trie_append_child_len(node, start, end - start);
+		else
+			node = trie_insert_child_len(node, start, end - start);
+		if (!node)
+			return NULL;
+
+		memset(&level, 0, sizeof(level));
+		level.end = end - name;
+		level.node = node;
+		g_array_append_val(levels, level);
+		start = end;
+	}
+
+	return node;
+}
+
+/* Whether name comes after prev in trie order, given their shared start. */
+static gboolean falcon_cache_follows(const gchar *prev, const gchar *name,
+                                     gsize shared)
+{
+	/* Only the components from the first different one on matter. */
+	while (shared > 0 && name[shared - 1] != G_DIR_SEPARATOR)
+		shared--;
+
+	return falcon_path_compare(prev + shared, name + shared) < 0;
+}
+
+/*
+ * Cache file format, see image.c for the default one. This one is read from
+ * start to end.
  *
  * All values are stored in Big Endian order.
+ * 4 bytes: magic "FLCN".
+ * 2 bytes unsigned integer: format version.
+ * 2 bytes unsigned integer: flags, 1 if the blocks may be compressed.
  * 8 bytes unsigned integer: number of objects following.
- * For each object,
+ * 4 bytes unsigned integer: CRC-32C of the above.
+ * The objects are split into blocks, an empty one ends the file. Each block is
+ * 4 bytes unsigned integer: payload length, at most 256KB. The highest bit is
+ * set if the payload is compressed, then it starts with 4 bytes unsigned
+ * integer: uncompressed length.
+ * 4 bytes unsigned integer: CRC-32C of the payload.
+ * The payload, in which the objects are sorted in trie order. Integers are
+ * variable length, 7 bits per byte with the lowest first. For each object,
+ * Integer: length of the start of the name shared with the previous object.
+ * Integer: length of the rest of the name, follow by that string.
+ * Integer: file size
+ * Integer: time
+ * Integer: mode
+ * 1 byte unsigned integer: watchability flag.
+ * Integer: device
+ * Integer: inode
+ * Integer: modification time in nanoseconds
+ * Integer: status change time in nanoseconds
+ * Version 2 files end each object at the watchability flag. Version 1 files
+ * are still read too, they hold for each object,
  * 2 bytes unsigned integer: name length, follow by name string.
  * 8 bytes signed integer: file size
  * 8 bytes signed integer: time
@@ -241,93 +1535,292 @@ void falcon_cache_foreach_descendant(falcon_cache_t *cache, const gchar *name,
  */
 gboolean falcon_cache_load(falcon_cache_t *cache, const gchar *name)
 {
-	int fd = 0;
+	falcon_stream_t *stream = NULL;
+	falcon_image_t *image = NULL;
 	guint64 count = 0;
 	falcon_object_t *object = NULL;
+	trie_node_t *node = NULL;
+	GString *path = NULL;
+	GArray *levels = NULL;
+	const gchar *prev = NULL;
+	const gchar *key = NULL;
+	gsize shared = 0;
 	guint64 i;
+	gboolean sorted = FALSE;
 	gboolean ret = TRUE;
 
 	g_return_val_if_fail(cache, FALSE);
 	if (!name)
 		return FALSE;
 
-	fd = g_open(name, O_RDONLY, 0);
-	if (fd == -1) {
-		g_critical(_("Failed to read cache file %s: %s"), name,
-		           g_strerror(errno));
-		return FALSE;
+	if (falcon_shard_probe(name))
+		return falcon_shard_load(cache, name);
+
+	if (falcon_image_probe(name)) {
+		if (!(image = falcon_image_open(name)))
+			return FALSE;
+
+		g_mutex_lock(cache->lock);
+		falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+		cache->image = image;
+		/*
+		 * Objects are paged in lazily only into an empty cache. Otherwise an
+		 * older object from the file could replace a newer one later, and the
+		 * indexes have to hold everything.
+		 */
+		if (cache->count || cache->frozen || cache->time_index
+		    || cache->size_index || cache->name_index)
+			falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+		g_mutex_unlock(cache->lock);
+
+		return TRUE;
 	}
 
-	if (read(fd, &(count), 8) == -1) {
-		g_critical(_("Failed to read cache file %s: %s"), name,
-		           g_strerror(errno));
-		close(fd);
+	stream = falcon_stream_open(name, &count);
+	if (!stream)
 		return FALSE;
-	}
-	count = GUINT64_FROM_BE(count);
 
 	g_debug(_("Loaded %lu cache keys."), count);
 
+	/*
+	 * Each name is rebuilt from the one before, and the nodes of the part they
+	 * share are reused. The file is only read at startup, keep the cache
+	 * locked all along.
+	 */
+	path = g_string_new(NULL);
+	levels = g_array_new(FALSE, TRUE, sizeof(falcon_cache_level_t));
+	g_mutex_lock(cache->lock);
+	falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
+	/*
+	 * Into an empty cache, as long as the names come in trie order, the trie
+	 * is built without looking anything up, and the totals and the filter are
+	 * computed once at the end.
+	 */
+	sorted = !cache->count && !trie_child(cache->objects);
 	for (i = 1; i <= count; i++) {
 		object = falcon_object_new(NULL);
-		if (!falcon_object_load(object, GINT_TO_POINTER(fd))) {
+		if (!falcon_object_load(object, path, &shared, stream)) {
 			g_critical(_("Failed to load object %lu"), i);
-			falcon_object_free(object);
+			falcon_object_unref(object);
 			ret = FALSE;
 			break;
 		}
 
-		g_debug(_("Loaded object \"%s\": dir=%s, size=%ld, time=%ld, watch=%s"),
-		        falcon_object_get_name(object),
-		        falcon_object_isdir(object) ? "yes" : "no",
-		        falcon_object_get_size(object),
-		        falcon_object_get_time(object),
-		        falcon_object_get_watch(object) ? "yes" : "no");
-
-		falcon_cache_add(cache, object);
+		key = falcon_object_get_name(object);
+		if (sorted && prev && !falcon_cache_follows(prev, key, shared)) {
+			g_debug(_("Cache file %s is not sorted."), name);
+			falcon_summary_build(cache->objects);
+			sorted = FALSE;
+		}
+		prev = key;
 
-		falcon_object_free(object);
+		node = falcon_cache_insert_next(cache, levels, key, shared, sorted);
+		if (!node) {
+			/* prev goes with it, stop relying on the order. */
+			falcon_object_unref(object);
+			if (sorted)
+				falcon_summary_build(cache->objects);
+			sorted = FALSE;
+		} else if (sorted) {
+			trie_set_data(node, object);
+			falcon_cache_index_add(cache, object);
+			cache->count++;
+			if (cache->frozen) {
+				falcon_frozen_set(cache->frozen, object);
+				falcon_cache_frozen_check(cache);
+			}
+		} else {
+			falcon_cache_store(cache, node, object);
+		}
 		object = NULL;
 	}
 
-	close(fd);
+	/* Also checks that nothing follows the objects. */
+	if (!falcon_stream_close(stream))
+		ret = FALSE;
+
+	if (sorted)
+		falcon_summary_build(cache->objects);
+	/* The filter grew with the load, size it for the final content. */
+	if (cache->filter)
+		falcon_cache_filter_rebuild(cache);
+	g_mutex_unlock(cache->lock);
+	g_array_free(levels, TRUE);
+	g_string_free(path, TRUE);
 
 	return ret;
 }
 
-gboolean falcon_cache_save(const falcon_cache_t *cache, const gchar *name)
+/* Accounts for the objects grafted under node in what the summaries don't. */
+static void falcon_cache_graft_indexes(falcon_cache_t *cache,
+                                       trie_node_t *node)
 {
-	int fd = 0;
+	trie_iter_t iter;
+	trie_node_t *cur = node;
+	falcon_object_t *data = NULL;
+
+	trie_iter_init(&iter, node, TRIE_PRE_ORDER);
+	do {
+		if (!(data = trie_data(cur)))
+			continue;
+		falcon_cache_index_add(cache, data);
+		if (cache->frozen)
+			falcon_frozen_set(cache->frozen, data);
+		if (cache->filter)
+			falcon_bloom_add(cache->filter, falcon_object_get_name(data));
+	} while ((cur = trie_iter_next(&iter)));
+
+	if (cache->frozen)
+		falcon_cache_frozen_check(cache);
+	if (cache->filter && falcon_bloom_stale(cache->filter))
+		falcon_cache_filter_rebuild(cache);
+}
+
+void falcon_cache_graft(falcon_cache_t *cache, falcon_cache_t *part,
+                        const gchar *name)
+{
+	trie_node_t *node = NULL;
+	trie_node_t *from = NULL;
+	trie_iter_t iter;
+	falcon_summary_t summary;
+	falcon_object_t *data = NULL;
 	guint64 count = 0;
 
+	g_return_if_fail(cache);
+	g_return_if_fail(part);
+	g_return_if_fail(name);
+
+	g_mutex_lock(cache->lock);
+	g_mutex_lock(part->lock);
+	falcon_cache_fault(cache, name, IMAGE_SUBTREE);
+	falcon_cache_fault(part, NULL, IMAGE_SUBTREE);
+
+	if ((from = trie_find(part->objects, name))) {
+		falcon_summary_get(from, &summary);
+		count = summary.files + summary.dirs + (trie_data(from) ? 1 : 0);
+	}
+	node = trie_find(cache->objects, name);
+	if (from && count == part->count
+	    && (!node || (!trie_data(node) && !trie_child(node)))
+	    && (node = trie_insert(cache->objects, name))
+	    && trie_graft(node, from) == 0) {
+		/* The subtree moves as it is, only the ancestors are updated. */
+		part->count = 0;
+		cache->count += count;
+		falcon_summary_graft(node);
+		if (cache->time_index || cache->size_index || cache->name_index
+		    || cache->frozen || cache->filter)
+			falcon_cache_graft_indexes(cache, node);
+	} else if (part->count) {
+		/* Something is in the way, add the objects one by one. */
+		from = part->objects;
+		trie_iter_init(&iter, from, TRIE_PRE_ORDER);
+		while ((from = trie_iter_next(&iter))) {
+			if (!(data = trie_data(from)))
+				continue;
+			falcon_cache_fault(cache, falcon_object_get_name(data),
+			                   IMAGE_PATH);
+			node = trie_insert(cache->objects, falcon_object_get_name(data));
+			if (node)
+				falcon_cache_store(cache, node, falcon_object_ref(data));
+		}
+	}
+	g_mutex_unlock(part->lock);
+	g_mutex_unlock(cache->lock);
+}
+
+gboolean falcon_cache_save(falcon_cache_t *cache, const gchar *name)
+{
+	falcon_save_t *save = NULL;
+
 	g_return_val_if_fail(cache, FALSE);
 	if (!name)
 		return FALSE;
 
-	fd = g_open(name, O_WRONLY | O_TRUNC | O_CREAT,
-	            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (fd == -1) {
-		g_critical(_("Failed to open cache file %s: %s"), name,
-		           g_strerror(errno));
+	/* The file is written from a snapshot, the cache stays usable meanwhile. */
+	if (!(save = falcon_cache_save_begin(cache, name)))
 		return FALSE;
-	}
+	return falcon_cache_save_finish(save, NULL);
+}
+
+falcon_save_t *falcon_cache_save_begin(falcon_cache_t *cache,
+                                       const gchar *name)
+{
+	falcon_format_t format = FORMAT_IMAGE;
+	guint shards = 0;
+
+	g_return_val_if_fail(cache, NULL);
+	if (!name)
+		return NULL;
 
 	g_mutex_lock(cache->lock);
-	count = GUINT64_TO_BE(cache->count);
-	if (write(fd, &count, 8) == -1) {
-		g_critical(_("Failed to write to file %s: %s"), name, g_strerror(errno));
-		g_mutex_unlock(cache->lock);
-		close(fd);
-		return FALSE;
+	format = cache->format;
+	shards = cache->shards;
+	g_mutex_unlock(cache->lock);
+
+	return falcon_shard_begin(cache, name, format, shards);
+}
+
+gboolean falcon_cache_save_finish(falcon_save_t *save, guint64 *bytes)
+{
+	g_return_val_if_fail(save, FALSE);
+
+	return falcon_shard_finish(save, bytes);
+}
+
+void falcon_cache_set_format(falcon_cache_t *cache, falcon_format_t format)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+	cache->format = format;
+	g_mutex_unlock(cache->lock);
+}
+
+void falcon_cache_set_shards(falcon_cache_t *cache, guint depth)
+{
+	g_return_if_fail(cache);
+
+	g_mutex_lock(cache->lock);
+	cache->shards = depth;
+	if (!depth && cache->local_changes) {
+		g_hash_table_destroy(cache->local_changes);
+		cache->local_changes = NULL;
 	}
-	trie_foreach(cache->objects, falcon_object_save, GINT_TO_POINTER(fd));
 	g_mutex_unlock(cache->lock);
-	close(fd);
+}
 
-	return TRUE;
+GHashTable *falcon_cache_take_local_changes(falcon_cache_t *cache)
+{
+	GHashTable *names = NULL;
+
+	g_return_val_if_fail(cache, NULL);
+
+	names = cache->local_changes;
+	cache->local_changes = NULL;
+
+	return names;
+}
+
+void falcon_cache_return_local_changes(falcon_cache_t *cache,
+                                       GHashTable *names)
+{
+	GHashTableIter iter;
+	gpointer name = NULL;
+
+	g_return_if_fail(cache);
+	g_return_if_fail(names);
+
+	g_mutex_lock(cache->lock);
+	g_hash_table_iter_init(&iter, names);
+	while (g_hash_table_iter_next(&iter, &name, NULL))
+		falcon_cache_local_changed(cache, name);
+	g_mutex_unlock(cache->lock);
+	g_hash_table_destroy(names);
 }
 
-void falcon_cache_print(const falcon_cache_t *cache)
+void falcon_cache_print(falcon_cache_t *cache)
 {
+	falcon_cache_fault(cache, NULL, IMAGE_SUBTREE);
 	recursive_print(cache->objects, 6);
 }
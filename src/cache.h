@@ -36,29 +36,189 @@ falcon_cache_t *falcon_cache_new(void);
 void falcon_cache_free(falcon_cache_t *cache);
 
 /*
- * Gets the object with the given name. If the object is not found, return NULL.
+ * Gets a reference to the object with the given name. The caller must release
+ * it with falcon_object_unref(). If the object is not found, return NULL.
  */
 falcon_object_t *falcon_cache_get(falcon_cache_t *cache, const gchar *name);
 /*
- * Adds an object to the cache. If another object with the same name exists, the
- * old one is updated with the new one.
+ * Looks up count names at once, see falcon_lookup(). Either found or objects
+ * may be NULL. Returns the number of names found.
+ */
+guint falcon_cache_lookup(falcon_cache_t *cache, const gchar * const *names,
+                          guint count, guint8 *found, falcon_object_t **objects);
+/*
+ * Adds a copy of the object to the cache. If another object with the same name
+ * exists, it is replaced by the new one. Readers holding a reference to the old
+ * object still see the old state.
  */
 gboolean falcon_cache_add(falcon_cache_t *cache, falcon_object_t *object);
+/*
+ * Same as falcon_cache_add(), but takes the ownership of the caller's reference
+ * instead of copying the object. The object must not be modified afterwards.
+ */
+gboolean falcon_cache_add_steal(falcon_cache_t *cache, falcon_object_t *object);
 /*
  * Deletes an object.
  */
 gboolean falcon_cache_delete(falcon_cache_t *cache, const gchar *name);
+/*
+ * Sets the watchability flag of an object and all its descendants. The affected
+ * objects are replaced, not modified.
+ */
+gboolean falcon_cache_set_watch(falcon_cache_t *cache, const gchar *name,
+                                gboolean watch);
+/*
+ * Gets the totals of all the descendants of an object. This doesn't traverse
+ * the subtree, the totals are maintained as the cache changes.
+ */
+gboolean falcon_cache_get_summary(falcon_cache_t *cache, const gchar *name,
+                                  falcon_summary_t *summary);
+/*
+ * Calls func for each object in the subtree of name, or in the whole cache if
+ * name is NULL, that differs between the two caches. Only the subtrees whose
+ * digests differ are visited, so objects that only differ in their device,
+ * inode or status change time may be missed. Both caches are locked while func
+ * is called.
+ */
+void falcon_cache_diff(falcon_cache_t *cache, falcon_cache_t *reference,
+                       const gchar *name, falcon_diff_func func,
+                       gpointer userdata);
 void falcon_cache_clear(falcon_cache_t *cache);
+/*
+ * Sets the secondary indexes to maintain. Indexes not in the given set are
+ * dropped, new ones are built from the current content.
+ */
+void falcon_cache_set_indexes(falcon_cache_t *cache,
+                              falcon_index_type_t indexes);
+/*
+ * A cursor remembers the node of a directory, so entries directly under it
+ * can be looked up, added and deleted by their last component alone, without
+ * walking down from the root. The node is looked up again after deletions.
+ * A cursor is used by one thread at a time.
+ */
+typedef struct falcon_cursor_st falcon_cursor_t;
+
+/* Points at the directory name, or at the root if name is NULL. */
+falcon_cursor_t *falcon_cache_cursor_new(falcon_cache_t *cache,
+                                        const gchar *name);
+void falcon_cursor_free(falcon_cursor_t *cursor);
+/*
+ * Moves the cursor to the parent directory of name, unless it is there
+ * already, and returns the last component of name. Returns NULL if name has
+ * no parent directory.
+ */
+const gchar *falcon_cursor_seek(falcon_cursor_t *cursor, const gchar *name);
+/* Same as falcon_cache_get() for the entry key of the directory. */
+falcon_object_t *falcon_cursor_get(falcon_cursor_t *cursor, const gchar *key);
+/*
+ * Same as falcon_cache_add_steal(). Objects not directly under the directory
+ * are added by their full name.
+ */
+gboolean falcon_cursor_add_steal(falcon_cursor_t *cursor,
+                                 falcon_object_t *object);
+gboolean falcon_cursor_delete(falcon_cursor_t *cursor, const gchar *key);
+/* Same as falcon_cache_foreach_child() for the entry key of the directory. */
+void falcon_cursor_foreach_child(falcon_cursor_t *cursor, const gchar *key,
+                                 GFunc func, gpointer userdata);
+/* Gets the filter counters. Returns FALSE if INDEX_FILTER is not enabled. */
+gboolean falcon_cache_get_filter_stats(falcon_cache_t *cache,
+                                       falcon_filter_stats_t *stats);
+/*
+ * Builds a flat read-only copy of the cache that serves lookups and subtree
+ * scans, or rebuilds it if there is one already. Later changes are kept aside
+ * until there are enough of them to rebuild it. If freeze is FALSE, the copy
+ * is dropped.
+ */
+void falcon_cache_freeze(falcon_cache_t *cache, gboolean freeze);
+/*
+ * Gets an iterator over the objects whose indexed value is between min and max.
+ * Returns NULL if the index is not enabled.
+ */
+falcon_range_t *falcon_cache_range_new(falcon_cache_t *cache,
+                                       falcon_index_type_t index, guint64 min,
+                                       guint64 max);
+/*
+ * Gets references to the objects whose base name matches pattern, see
+ * falcon_search(). Returns NULL if the name index is not enabled.
+ */
+GPtrArray *falcon_cache_search(falcon_cache_t *cache, const gchar *pattern,
+                               guint max_errors);
+/*
+ * The following functions take references to the matching objects with the
+ * cache locked, then call func on them after unlocking. So func may use the
+ * cache, but it has to take a reference if it wants to keep an object.
+ */
 void falcon_cache_foreach_top(falcon_cache_t *cache, GFunc func,
                               gpointer userdata);
 void falcon_cache_foreach_child(falcon_cache_t *cache, const gchar *name,
                                 GFunc func, gpointer userdata);
 void falcon_cache_foreach_descendant(falcon_cache_t *cache, const gchar *name,
                                      GFunc func, gpointer userdata);
+/*
+ * Same as falcon_cache_foreach_descendant(), but func is called from several
+ * threads at once and in no particular order. func has to be thread-safe.
+ */
+void falcon_cache_foreach_descendant_parallel(falcon_cache_t *cache,
+                                              const gchar *name, GFunc func,
+                                              gpointer userdata);
 
+/*
+ * Direct access to the trie for the modules that traverse it. The nodes may
+ * only be used with the cache locked. The generation changes whenever nodes
+ * are freed, so a node pointer saved under an older generation must be looked
+ * up again.
+ */
+void falcon_cache_lock(falcon_cache_t *cache);
+void falcon_cache_unlock(falcon_cache_t *cache);
+/* Pages in all the objects of a mapped cache file first. */
+trie_node_t *falcon_cache_root(falcon_cache_t *cache);
+guint falcon_cache_generation(const falcon_cache_t *cache);
+
+/*
+ * Reads a cache file. A file in the image format is only mapped, its objects
+ * are paged in as the cache is used, see image.h. The shards listed in a
+ * manifest are read completely, see shard.h.
+ */
 gboolean falcon_cache_load(falcon_cache_t *cache, const gchar *name);
-gboolean falcon_cache_save(const falcon_cache_t *cache, const gchar *name);
+/* Only locks the cache while a snapshot is taken, see falcon_cache_snapshot(). */
+gboolean falcon_cache_save(falcon_cache_t *cache, const gchar *name);
+/*
+ * The same in two steps. The first one takes what has to be written with the
+ * cache locked, the second one writes it and frees save, the cache may have
+ * changed in between. If bytes is not NULL, it is set to the number of bytes
+ * written.
+ */
+typedef struct falcon_save_st falcon_save_t;
+
+falcon_save_t *falcon_cache_save_begin(falcon_cache_t *cache,
+                                       const gchar *name);
+gboolean falcon_cache_save_finish(falcon_save_t *save, guint64 *bytes);
+/* Sets the format written by falcon_cache_save(), FORMAT_IMAGE by default. */
+void falcon_cache_set_format(falcon_cache_t *cache, falcon_format_t format);
+/*
+ * Sets the depth below the topmost objects at which falcon_cache_save() cuts
+ * the cache into shards, see falcon_set_shards(). 0, the default, writes a
+ * single file.
+ */
+void falcon_cache_set_shards(falcon_cache_t *cache, guint depth);
+/*
+ * The watchability flags, devices, inodes and status change times are not part
+ * of the digests, so while the cache is saved in shards, it remembers the names
+ * where they changed. This takes them, or returns NULL if there are none. The
+ * caller must lock the cache.
+ */
+GHashTable *falcon_cache_take_local_changes(falcon_cache_t *cache);
+/* Gives back the names taken before, after they failed to be saved. */
+void falcon_cache_return_local_changes(falcon_cache_t *cache,
+                                       GHashTable *names);
+/*
+ * Adds the objects of part, loaded on its own, to cache. If they are all in
+ * the subtree of name and that subtree is empty in cache, it is moved over at
+ * once. Otherwise the objects are added one by one.
+ */
+void falcon_cache_graft(falcon_cache_t *cache, falcon_cache_t *part,
+                        const gchar *name);
 
-void falcon_cache_print(const falcon_cache_t *cache);
+void falcon_cache_print(falcon_cache_t *cache);
 
 #endif
@@ -22,6 +22,13 @@
  * THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
 #include "common.h"
 
 #define DEFAULT_LOG_LEVEL (G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_ERROR \
@@ -58,6 +65,53 @@ gint falcon_object_compare(gconstpointer a, gconstpointer b)
 	                 (const gchar *)b);
 }
 
+const gchar *falcon_path_component(const gchar *name, const gchar *pos,
+                                   const gchar **end)
+{
+	if (pos == name && *pos == G_DIR_SEPARATOR) {
+		*end = pos + 1;
+		return pos;
+	}
+
+	while (*pos == G_DIR_SEPARATOR)
+		pos++;
+	if (*pos == '\0')
+		return NULL;
+	if (!(*end = strchr(pos, G_DIR_SEPARATOR)))
+		*end = pos + strlen(pos);
+
+	return pos;
+}
+
+gint falcon_path_compare(const gchar *a, const gchar *b)
+{
+	const gchar *apos = a;
+	const gchar *bpos = b;
+	const gchar *astart = NULL;
+	const gchar *bstart = NULL;
+	const gchar *aend = NULL;
+	const gchar *bend = NULL;
+	gsize alen = 0;
+	gsize blen = 0;
+	gint ret = 0;
+
+	while (TRUE) {
+		astart = falcon_path_component(a, apos, &aend);
+		bstart = falcon_path_component(b, bpos, &bend);
+		if (!astart || !bstart)
+			return (astart != NULL) - (bstart != NULL);
+
+		alen = aend - astart;
+		blen = bend - bstart;
+		if ((ret = memcmp(astart, bstart, MIN(alen, blen))))
+			return ret;
+		if (alen != blen)
+			return alen < blen ? -1 : 1;
+		apos = aend;
+		bpos = bend;
+	}
+}
+
 void falcon_error_report(GError *error)
 {
 	if (error) {
@@ -80,3 +134,89 @@ void falcon_error_report(GError *error)
 		}
 	}
 }
+
+guint falcon_varint_encode(guint8 *bytes, guint64 value)
+{
+	guint len = 0;
+
+	while (value >= 0x80) {
+		bytes[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	bytes[len++] = value;
+
+	return len;
+}
+
+void falcon_varint_put(GString *data, guint64 value)
+{
+	guint8 bytes[VARINT_MAX];
+
+	g_string_append_len(data, (const gchar *)bytes,
+	                    falcon_varint_encode(bytes, value));
+}
+
+gboolean falcon_varint_get(const guint8 **pos, const guint8 *end,
+                           guint64 *value)
+{
+	guint8 byte = 0;
+	guint shift = 0;
+
+	*value = 0;
+	do {
+		/* The tenth byte only has room for the top bit. */
+		if (*pos == end || (shift == 63 ? **pos > 1 : shift > 63))
+			return FALSE;
+		byte = *(*pos)++;
+		*value |= (guint64)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return TRUE;
+}
+
+gboolean falcon_write_all(int fd, gconstpointer data, gsize len)
+{
+	const gchar *cur = (const gchar *)data;
+	gssize ret = 0;
+
+	while (len) {
+		ret = write(fd, cur, len);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			return FALSE;
+		cur += ret;
+		len -= ret;
+	}
+
+	return TRUE;
+}
+
+int falcon_temp_open(const gchar *name, gchar **temp)
+{
+	*temp = g_strconcat(name, ".tmp", NULL);
+
+	return g_open(*temp, O_WRONLY | O_CREAT | O_TRUNC,
+	              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+gboolean falcon_temp_commit(int fd, const gchar *temp, const gchar *name,
+                            gboolean ok)
+{
+	int saved = 0;
+
+	if (ok && fd != -1 && fsync(fd) == -1)
+		ok = FALSE;
+	if (fd != -1 && close(fd) == -1)
+		ok = FALSE;
+	if (ok && g_rename(temp, name) == 0)
+		return TRUE;
+
+	/* Don't let the cleanup hide what went wrong. */
+	saved = errno;
+	g_unlink(temp);
+	errno = saved;
+
+	return FALSE;
+}
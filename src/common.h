@@ -44,6 +44,46 @@ void falcon_log_handler (const gchar *log_domain, GLogLevelFlags log_level,
                          const gchar *message, gpointer user_data);
 
 gint falcon_object_compare(gconstpointer a, gconstpointer b);
+/*
+ * Gets the component of name at pos, or NULL past the last one, and stores
+ * where it ends in end. A leading separator is a component of its own, like in
+ * the trie.
+ */
+const gchar *falcon_path_component(const gchar *name, const gchar *pos,
+                                   const gchar **end);
+/*
+ * Orders paths component by component, the order of a pre-order walk of the
+ * trie with the children sorted: a directory comes right before its content.
+ */
+gint falcon_path_compare(const gchar *a, const gchar *b);
 void falcon_error_report(GError *error);
 
+/* Longest varint, 7 bits per byte. */
+#define VARINT_MAX 10
+
+/* Encodes value into bytes, which must hold VARINT_MAX, returns its length. */
+guint falcon_varint_encode(guint8 *bytes, guint64 value);
+void falcon_varint_put(GString *data, guint64 value);
+/*
+ * Decodes the varint at *pos and moves past it. Returns FALSE if it reaches
+ * end or does not fit in 64 bits.
+ */
+gboolean falcon_varint_get(const guint8 **pos, const guint8 *end,
+                           guint64 *value);
+/* Writes all of data, returns FALSE with errno set on failure. */
+gboolean falcon_write_all(int fd, gconstpointer data, gsize len);
+/*
+ * Files are replaced by writing name.tmp, stored in temp, and renaming it over
+ * name once it is durable, so a crash leaves the old or the new file whole.
+ * Returns the descriptor, or -1 with errno set.
+ */
+int falcon_temp_open(const gchar *name, gchar **temp);
+/*
+ * If ok, syncs and closes fd and renames temp to name, otherwise closes fd and
+ * deletes temp. fd may be -1 if the caller has already synced and closed it.
+ * Returns FALSE with errno set if ok is FALSE or any step fails.
+ */
+gboolean falcon_temp_commit(int fd, const gchar *temp, const gchar *name,
+                            gboolean ok);
+
 #endif
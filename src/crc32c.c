@@ -0,0 +1,142 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "common.h"
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78	/* Reversed Castagnoli polynomial */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42
+#endif
+
+typedef guint32 (*falcon_crc32c_func)(guint32 crc, const guint8 *data,
+                                      gsize len);
+
+/* Slicing by eight, table[k][i] is the CRC of i followed by k zero bytes. */
+static guint32 table[8][256];
+static falcon_crc32c_func update = NULL;
+
+static guint32 falcon_crc32c_sw(guint32 crc, const guint8 *data, gsize len)
+{
+	guint32 low = 0;
+	guint32 high = 0;
+
+	while (len && ((gsize)data & 7)) {
+		crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low = GUINT32_FROM_LE(low) ^ crc;
+		high = GUINT32_FROM_LE(high);
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff]
+			^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+			^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff]
+			^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static guint32 falcon_crc32c_hw(guint32 crc, const guint8 *data, gsize len)
+{
+#ifdef __x86_64__
+	guint64 crc64 = 0;
+	guint64 word = 0;
+#endif
+	guint32 word32 = 0;
+
+	while (len && ((gsize)data & 7)) {
+		crc = __builtin_ia32_crc32qi(crc, *data++);
+		len--;
+	}
+
+#ifdef __x86_64__
+	crc64 = crc;
+	for (; len >= 8; data += 8, len -= 8) {
+		memcpy(&word, data, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
+	crc = (guint32)crc64;
+#endif
+
+	for (; len >= 4; data += 4, len -= 4) {
+		memcpy(&word32, data, 4);
+		crc = __builtin_ia32_crc32si(crc, word32);
+	}
+
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *data++);
+
+	return crc;
+}
+#endif
+
+static gpointer falcon_crc32c_init(gpointer data ATTRIBUTE_UNUSED)
+{
+	guint32 crc = 0;
+	guint i;
+	guint j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = table[0][table[j - 1][i] & 0xff]
+				^ (table[j - 1][i] >> 8);
+
+	update = falcon_crc32c_sw;
+#ifdef CRC32C_SSE42
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		update = falcon_crc32c_hw;
+#endif
+
+	return NULL;
+}
+
+guint32 falcon_crc32c(guint32 crc, gconstpointer data, gsize len)
+{
+	static GOnce once = G_ONCE_INIT;
+
+	g_once(&once, falcon_crc32c_init, NULL);
+
+	return ~update(~crc, (const guint8 *)data, len);
+}
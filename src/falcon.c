@@ -28,6 +28,10 @@
 #include "falcon.h"
 #include "filter.h"
 #include "handler.h"
+#include "journal.h"
+#include "query.h"
+#include "queue.h"
+#include "snapshot.h"
 #include "watcher.h"
 
 typedef struct {
@@ -38,9 +42,24 @@ typedef struct {
 	GThreadPool *walkers;
 	GCond *running_cond;
 	guint running;				/* Currently scheduled tasks */
+	GHashTable *active;			/* Copies of the running tasks, by batch */
+	volatile gint stopping;		/* Walkers put their tasks back */
+	falcon_start_t start;		/* Until the startup crawl is over */
+	GHashTable *resumed;		/* Directories left by the last crawl */
 } falcon_context_t;
 
 static falcon_context_t context;
+static falcon_start_t falcon_start = START_COLD;
+
+static void falcon_batch_free(gpointer data)
+{
+	GPtrArray *objects = (GPtrArray *)data;
+	guint i;
+
+	for (i = 0; i < objects->len; i++)
+		falcon_object_unref(g_ptr_array_index(objects, i));
+	g_ptr_array_free(objects, TRUE);
+}
 
 static void falcon_context_init(void)
 {
@@ -55,6 +74,11 @@ static void falcon_context_init(void)
 	                                    NULL);
 	context.running_cond = g_cond_new();
 	context.running = 0;
+	context.active = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                       NULL, falcon_batch_free);
+	context.stopping = 0;
+	context.start = falcon_start;
+	context.resumed = NULL;
 }
 
 static void falcon_context_free(gboolean wait)
@@ -62,18 +86,24 @@ static void falcon_context_free(gboolean wait)
 	falcon_object_t *object = NULL;
 
 	while ((object = g_queue_pop_head(&context.pending_objects))) {
-		falcon_object_free(object);
+		falcon_object_unref(object);
 	}
 	while ((object = g_queue_pop_head(&context.failed_objects))) {
-		falcon_object_free(object);
+		falcon_object_unref(object);
 	}
 	g_thread_pool_free(context.walkers, !wait, wait);
+	g_hash_table_destroy(context.active);
+	if (context.resumed)
+		g_hash_table_destroy(context.resumed);
 	g_cond_free(context.running_cond);
 	g_mutex_free(context.lock);
 	falcon_cache_free(context.cache);
 }
 
-/* The caller must lock the context. */
+/*
+ * The caller must lock the context. The queue takes the ownership of the
+ * object.
+ */
 static void falcon_push(GQueue *queue, falcon_object_t *object)
 {
 	GList *l = NULL;
@@ -84,15 +114,19 @@ static void falcon_push(GQueue *queue, falcon_object_t *object)
 	                        falcon_object_compare);
 	if (!l)
 		g_queue_push_tail(queue, object);
+	else
+		falcon_object_unref(object);
 }
 
 /* The caller must lock the context. */
 static void falcon_dispatch(gboolean force)
 {
 	GQueue *objects = NULL;
+	GPtrArray *copy = NULL;
+	GList *l = NULL;
 	guint length = g_queue_get_length(&context.pending_objects);
 
-	if (length == 0)
+	if (length == 0 || g_atomic_int_get(&context.stopping))
 		return;
 
 	g_debug(_("Dispatching conditions: force (%s), length (%d), running (%d)."),
@@ -111,11 +145,89 @@ static void falcon_dispatch(gboolean force)
 	}
 
 	if (objects) {
+		/* Kept until the walker returns, for the queue of a checkpoint. */
+		copy = g_ptr_array_sized_new(g_queue_get_length(objects));
+		for (l = objects->head; l; l = l->next)
+			g_ptr_array_add(copy, falcon_object_ref(l->data));
+		g_hash_table_insert(context.active, objects, copy);
 		g_thread_pool_push(context.walkers, objects, NULL);
 		context.running++;
 	}
 }
 
+/*
+ * Gets the tasks that are not done yet, and the failed ones. Running tasks are
+ * included, whatever they found may not have been saved yet.
+ */
+static falcon_queue_t *falcon_frontier(void)
+{
+	falcon_queue_t *queue = falcon_queue_new();
+	GHashTableIter iter;
+	gpointer value = NULL;
+	GPtrArray *objects = NULL;
+	GList *l = NULL;
+	guint i;
+
+	g_mutex_lock(context.lock);
+	for (l = context.pending_objects.head; l; l = l->next)
+		falcon_queue_add(queue, l->data, FALSE);
+	g_hash_table_iter_init(&iter, context.active);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		objects = (GPtrArray *)value;
+		for (i = 0; i < objects->len; i++)
+			falcon_queue_add(queue, g_ptr_array_index(objects, i), FALSE);
+	}
+	for (l = context.failed_objects.head; l; l = l->next)
+		falcon_queue_add(queue, l->data, TRUE);
+	g_mutex_unlock(context.lock);
+
+	return queue;
+}
+
+/*
+ * Puts back the tasks of an interrupted crawl. The directories among them are
+ * listed again, with everything below them, the rest of the cache is checked
+ * as in a warm start.
+ */
+static void falcon_resume(falcon_queue_t *queue)
+{
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	falcon_object_t *object = NULL;
+	const gchar *name = NULL;
+	guint i;
+
+	g_message(_("Resuming the crawl with %u pending and %u failed objects."),
+	          queue->pending->len, queue->failed->len);
+
+	g_mutex_lock(context.lock);
+	context.resumed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                        NULL);
+	for (i = 0; i < queue->pending->len; i++) {
+		object = g_ptr_array_index(queue->pending, i);
+		name = falcon_object_get_name(object);
+		if (g_hash_table_lookup(seen, name))
+			continue;
+		g_hash_table_insert(seen, (gpointer)name, object);
+		g_hash_table_insert(context.resumed, g_strdup(name), NULL);
+		g_queue_push_tail(&context.pending_objects, falcon_object_ref(object));
+	}
+	g_hash_table_remove_all(seen);
+	for (i = 0; i < queue->failed->len; i++) {
+		object = g_ptr_array_index(queue->failed, i);
+		name = falcon_object_get_name(object);
+		if (g_hash_table_lookup(seen, name))
+			continue;
+		g_hash_table_insert(seen, (gpointer)name, object);
+		g_queue_push_tail(&context.failed_objects, falcon_object_ref(object));
+	}
+	if (queue->pending->len && context.start == START_COLD)
+		context.start = START_WARM;
+	falcon_dispatch(FALSE);
+	g_mutex_unlock(context.lock);
+
+	g_hash_table_destroy(seen);
+}
+
 static gchar *falcon_normalize_path(const gchar *name)
 {
 	gchar *path = NULL;
@@ -132,9 +244,8 @@ static gchar *falcon_normalize_path(const gchar *name)
 
 static void falcon_start_one(gpointer data, gpointer userdata ATTRIBUTE_UNUSED)
 {
-	const falcon_object_t *object = (const falcon_object_t *)data;
-	falcon_object_t *tmp = falcon_object_copy(object);
-	falcon_task_add(tmp);
+	falcon_object_t *object = (falcon_object_t *)data;
+	falcon_task_add(object);
 }
 
 static void falcon_start_all(void)
@@ -142,14 +253,16 @@ static void falcon_start_all(void)
 	falcon_cache_foreach_top(context.cache, falcon_start_one, NULL);
 }
 
+/*
+ * The flag of the cached object is set by falcon_cache_set_watch(). This runs
+ * on several threads at once, the watcher does its own locking.
+ */
 static void falcon_set_watch_one(gpointer data, gpointer userdata)
 {
-	falcon_object_t *object = (falcon_object_t *)data;
+	const falcon_object_t *object = (const falcon_object_t *)data;
 	gboolean watch = GPOINTER_TO_INT(userdata);
 	gboolean ret = FALSE;
 
-	falcon_object_set_watch(object, watch);
-
 	if (!falcon_object_isdir(object))
 		return;
 
@@ -163,8 +276,15 @@ static void falcon_set_watch_one(gpointer data, gpointer userdata)
 		          falcon_object_get_name(object));
 }
 
+void falcon_set_start(falcon_start_t start)
+{
+	falcon_start = start;
+}
+
 void falcon_init(const gchar *name)
 {
+	falcon_queue_t *queue = NULL;
+
 	setlocale(LC_ALL, "");
 
 	g_log_set_handler(G_LOG_DOMAIN, G_LOG_LEVEL_MASK, falcon_log_handler, NULL);
@@ -175,29 +295,49 @@ void falcon_init(const gchar *name)
 	falcon_watcher_init(context.cache);
 
 	falcon_cache_load(context.cache, name);
+	/* The changes made after the file was written. */
+	falcon_journal_init(context.cache, name);
+	falcon_journal_set_queue(falcon_frontier);
+	if ((queue = falcon_queue_load(name))) {
+		falcon_resume(queue);
+		falcon_queue_free(queue);
+	}
 	falcon_start_all();
 }
 
 void falcon_shutdown(const gchar *name, gboolean wait)
 {
+	falcon_queue_t *queue = NULL;
+
 	if (!context.lock || !context.cache || !context.walkers
 	    || !context.running_cond) {
 		g_critical(_("Please initialize the system first."));
 		return;
 	}
 
-	if (wait) {
-		g_mutex_lock(context.lock);
-		while (context.running != 0
-		       || g_queue_get_length(&context.pending_objects) > 0) {
-			if (g_queue_get_length(&context.pending_objects) > 0)
-				falcon_dispatch(TRUE);
-			g_cond_wait(context.running_cond, context.lock);
-		}
-		g_mutex_unlock(context.lock);
+	g_mutex_lock(context.lock);
+	if (!wait)
+		g_atomic_int_set(&context.stopping, 1);
+	/* Walkers that were told to stop return what they didn't walk. */
+	while (context.running != 0
+	       || (wait && g_queue_get_length(&context.pending_objects) > 0)) {
+		if (wait && g_queue_get_length(&context.pending_objects) > 0)
+			falcon_dispatch(TRUE);
+		g_cond_wait(context.running_cond, context.lock);
 	}
+	g_mutex_unlock(context.lock);
 
-	falcon_cache_save(context.cache, name);
+	/*
+	 * Once the whole cache is written, the journal is not needed anymore.
+	 * What is left to walk is kept either way, the cache and the journal are
+	 * up to date.
+	 */
+	falcon_journal_shutdown();
+	queue = falcon_frontier();
+	falcon_queue_save(queue, name);
+	falcon_queue_free(queue);
+	if (falcon_cache_save(context.cache, name))
+		falcon_journal_remove(name);
 
 	falcon_watcher_shutdown();
 	falcon_handler_shutdown();
@@ -228,10 +368,12 @@ gboolean falcon_add(const gchar *name, gboolean watch)
 	g_mutex_lock(context.lock);
 	object = falcon_cache_get(context.cache, path);
 	g_mutex_unlock(context.lock);
-	if (!object) {
+	if (object) {
+		falcon_object_unref(object);
+	} else {
 		object = falcon_object_new(path);
 		falcon_object_set_watch(object, watch);
-		falcon_task_add(object);
+		falcon_task_add_steal(object);
 	}
 
 	g_free(path);
@@ -262,10 +404,15 @@ gboolean falcon_delete(const gchar *name)
 	while (context.running != 0
 	       || g_queue_get_length(&context.pending_objects) > 0)
 		g_cond_wait(context.running_cond, context.lock);
-	falcon_cache_foreach_descendant(context.cache, path, falcon_set_watch_one,
-	                                GINT_TO_POINTER(FALSE));
-	if (!falcon_cache_delete(context.cache, path))
-	    g_warning(_("Failed to delete \"%s\" by name."), path);
+	falcon_cache_foreach_descendant_parallel(context.cache, path,
+	                                         falcon_set_watch_one,
+	                                         GINT_TO_POINTER(FALSE));
+	falcon_journal_lock();
+	if (falcon_cache_delete(context.cache, path))
+		falcon_journal_delete(path);
+	else
+		g_warning(_("Failed to delete \"%s\" by name."), path);
+	falcon_journal_unlock();
 	g_mutex_unlock(context.lock);
 
 	g_free(path);
@@ -288,7 +435,10 @@ void falcon_clear(void)
 	       || g_queue_get_length(&context.pending_objects) > 0)
 		g_cond_wait(context.running_cond, context.lock);
 	falcon_watcher_clear();
+	falcon_journal_lock();
 	falcon_cache_clear(context.cache);
+	falcon_journal_clear();
+	falcon_journal_unlock();
 	g_mutex_unlock(context.lock);
 }
 
@@ -314,8 +464,13 @@ gboolean falcon_set_watch(const gchar *name, gboolean watch)
 	        watch ? _("true") : _("false"));
 
 	g_mutex_lock(context.lock);
-	falcon_cache_foreach_descendant(context.cache, path, falcon_set_watch_one,
-	                                GINT_TO_POINTER(watch));
+	falcon_journal_lock();
+	if (falcon_cache_set_watch(context.cache, path, watch))
+		falcon_journal_set_watch(path, watch);
+	falcon_journal_unlock();
+	falcon_cache_foreach_descendant_parallel(context.cache, path,
+	                                         falcon_set_watch_one,
+	                                         GINT_TO_POINTER(watch));
 	g_mutex_unlock(context.lock);
 	g_free(path);
 
@@ -325,6 +480,7 @@ gboolean falcon_set_watch(const gchar *name, gboolean watch)
 gboolean falcon_has(const gchar *name)
 {
 	gchar *path = NULL;
+	falcon_object_t *object = NULL;
 	gboolean ret = FALSE;
 
 	if (!context.lock || !context.cache || !context.walkers
@@ -341,17 +497,277 @@ gboolean falcon_has(const gchar *name)
 	path = falcon_normalize_path(name);
 
 	g_mutex_lock(context.lock);
-	if (falcon_cache_get(context.cache, path))
+	if ((object = falcon_cache_get(context.cache, path))) {
+		falcon_object_unref(object);
 		ret = TRUE;
+	}
 	g_mutex_unlock(context.lock);
-	g_free(path);
 
 	g_debug(_("\"%s\" is%sin the cache."), path, ret ? " " : " not ");
+	g_free(path);
 
 	return ret;
 }
 
+guint falcon_lookup(const gchar * const *names, guint count, guint8 *found,
+                    falcon_object_t **objects)
+{
+	guint ret = 0;
+
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return 0;
+	}
+
+	if (!names && count) {
+		g_warning(_("Failed to check cache, object names not provided."));
+		return 0;
+	}
+
+	/* The trie ignores trailing separators, no need to normalize. */
+	g_mutex_lock(context.lock);
+	ret = falcon_cache_lookup(context.cache, names, count, found, objects);
+	g_mutex_unlock(context.lock);
+
+	return ret;
+}
+
+gboolean falcon_get_summary(const gchar *name, falcon_summary_t *summary)
+{
+	gchar *path = NULL;
+	gboolean ret = FALSE;
+
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	if (!name || !summary) {
+		g_warning(_("Failed to get summary, object name not provided."));
+		return FALSE;
+	}
+
+	path = falcon_normalize_path(name);
+
+	g_mutex_lock(context.lock);
+	ret = falcon_cache_get_summary(context.cache, path, summary);
+	g_mutex_unlock(context.lock);
+	g_free(path);
+
+	return ret;
+}
+
+gboolean falcon_get_filter_stats(falcon_filter_stats_t *stats)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	if (!stats) {
+		g_warning(_("Failed to get filter counters, no place to store them."));
+		return FALSE;
+	}
+
+	return falcon_cache_get_filter_stats(context.cache, stats);
+}
+
+gboolean falcon_diff(const gchar *reference, const gchar *name,
+                     falcon_diff_func func, gpointer userdata)
+{
+	falcon_cache_t *cache = NULL;
+	gchar *path = NULL;
+
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	if (!reference || !func) {
+		g_warning(_("Failed to compare caches, reference not provided."));
+		return FALSE;
+	}
+
+	cache = falcon_cache_new();
+	if (!falcon_cache_load(cache, reference)) {
+		falcon_cache_free(cache);
+		return FALSE;
+	}
+
+	if (name)
+		path = falcon_normalize_path(name);
+
+	g_mutex_lock(context.lock);
+	falcon_cache_diff(context.cache, cache, path, func, userdata);
+	g_mutex_unlock(context.lock);
+
+	g_free(path);
+	falcon_cache_free(cache);
+
+	return TRUE;
+}
+
+gboolean falcon_set_format(falcon_format_t format)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	falcon_cache_set_format(context.cache, format);
+
+	return TRUE;
+}
+
+gboolean falcon_set_shards(guint depth)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	falcon_cache_set_shards(context.cache, depth);
+
+	return TRUE;
+}
+
+gboolean falcon_set_checkpoint(guint interval, guint64 changes)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	return falcon_journal_set_checkpoint(interval, changes);
+}
+
+gboolean falcon_get_checkpoint_stats(falcon_checkpoint_stats_t *stats)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	if (!stats) {
+		g_warning(_("Failed to get checkpoint counters, no place to store "
+		            "them."));
+		return FALSE;
+	}
+
+	return falcon_journal_get_stats(stats);
+}
+
+gboolean falcon_set_indexes(falcon_index_type_t indexes)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	falcon_cache_set_indexes(context.cache, indexes);
+
+	return TRUE;
+}
+
+gboolean falcon_freeze(gboolean freeze)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	falcon_cache_freeze(context.cache, freeze);
+
+	return TRUE;
+}
+
+falcon_range_t *falcon_range_new(falcon_index_type_t index, guint64 min,
+                                 guint64 max)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return NULL;
+	}
+
+	return falcon_cache_range_new(context.cache, index, min, max);
+}
+
+falcon_query_t *falcon_query_new(const gchar *pattern)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return NULL;
+	}
+
+	if (!pattern) {
+		g_warning(_("Failed to query, pattern not provided."));
+		return NULL;
+	}
+
+	return falcon_cache_query_new(context.cache, pattern);
+}
+
+gboolean falcon_search(const gchar *pattern, guint max_errors,
+                       falcon_search_func func, gpointer userdata)
+{
+	GPtrArray *result = NULL;
+	guint i;
+
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return FALSE;
+	}
+
+	if (!pattern || !func) {
+		g_warning(_("Failed to search, pattern not provided."));
+		return FALSE;
+	}
+
+	if (!(result = falcon_cache_search(context.cache, pattern, max_errors)))
+		return FALSE;
+
+	/* The cache is not locked while calling func. */
+	for (i = 0; i < result->len; i++) {
+		func(g_ptr_array_index(result, i), userdata);
+		falcon_object_unref(g_ptr_array_index(result, i));
+	}
+	g_ptr_array_free(result, TRUE);
+
+	return TRUE;
+}
+
+falcon_snapshot_t *falcon_snapshot_new(const gchar *name)
+{
+	if (!context.lock || !context.cache || !context.walkers
+	    || !context.running_cond) {
+		g_critical(_("Please initialize the system first."));
+		return NULL;
+	}
+
+	return falcon_cache_snapshot(context.cache, name);
+}
+
 void falcon_task_add(falcon_object_t *object)
+{
+	g_return_if_fail(object);
+
+	falcon_task_add_steal(falcon_object_ref(object));
+}
+
+void falcon_task_add_steal(falcon_object_t *object)
 {
 	if (!context.lock || !context.cache || !context.walkers
 	    || !context.running_cond) {
@@ -382,7 +798,7 @@ void falcon_failed_add(falcon_object_t *object)
 	g_mutex_unlock(context.lock);
 }
 
-void falcon_walker_return(GError *error)
+void falcon_walker_return(GQueue *objects, GError *error)
 {
 	if (!context.lock || !context.cache || !context.walkers
 	    || !context.running_cond) {
@@ -393,8 +809,79 @@ void falcon_walker_return(GError *error)
 	falcon_error_report(error);
 
 	g_mutex_lock(context.lock);
+	g_hash_table_remove(context.active, objects);
 	context.running--;
+	if (context.start != START_COLD && context.running == 0
+	    && g_queue_get_length(&context.pending_objects) == 0
+	    && !g_atomic_int_get(&context.stopping)) {
+		g_message(_("Startup crawl finished."));
+		context.start = START_COLD;
+		if (context.resumed) {
+			g_hash_table_destroy(context.resumed);
+			context.resumed = NULL;
+		}
+	}
 	g_cond_signal(context.running_cond);
 	falcon_dispatch(FALSE);
 	g_mutex_unlock(context.lock);
 }
+
+gboolean falcon_task_stopping(void)
+{
+	return context.lock && g_atomic_int_get(&context.stopping);
+}
+
+void falcon_task_requeue(GQueue *objects)
+{
+	falcon_object_t *object = NULL;
+
+	g_return_if_fail(objects);
+	if (!context.lock)
+		return;
+
+	g_mutex_lock(context.lock);
+	while ((object = g_queue_pop_head(objects)))
+		falcon_push(&context.pending_objects, object);
+	g_mutex_unlock(context.lock);
+}
+
+gboolean falcon_task_resumed(const gchar *name)
+{
+	gchar *path = NULL;
+	gchar *sep = NULL;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(name, FALSE);
+	if (!context.lock)
+		return FALSE;
+
+	g_mutex_lock(context.lock);
+	if (context.resumed) {
+		path = g_strdup(name);
+		do {
+			ret = g_hash_table_lookup_extended(context.resumed, path, NULL,
+			                                   NULL);
+			sep = strrchr(path, G_DIR_SEPARATOR);
+			if (sep)
+				*sep = '\0';
+		} while (!ret && sep && *path);
+		g_free(path);
+	}
+	g_mutex_unlock(context.lock);
+
+	return ret;
+}
+
+falcon_start_t falcon_start_mode(void)
+{
+	falcon_start_t start = START_COLD;
+
+	if (!context.lock)
+		return START_COLD;
+
+	g_mutex_lock(context.lock);
+	start = context.start;
+	g_mutex_unlock(context.lock);
+
+	return start;
+}
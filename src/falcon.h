@@ -31,8 +31,24 @@
 #include "cache.h"
 #include "walker.h"
 
+/*
+ * Queues an object for the walkers. falcon_task_add() takes a new reference,
+ * falcon_task_add_steal() takes the ownership of the caller's reference. The
+ * object is dropped if another one with the same name is already pending.
+ */
 void falcon_task_add(falcon_object_t *object);
+void falcon_task_add_steal(falcon_object_t *object);
+/* Takes the ownership of the caller's reference. */
 void falcon_failed_add(falcon_object_t *object);
-void falcon_walker_return(GError *error);
+/* Called by a walker when it is done with objects, before freeing it. */
+void falcon_walker_return(GQueue *objects, GError *error);
+/* Whether walkers have to stop and put back what they didn't walk. */
+gboolean falcon_task_stopping(void);
+/* Puts back the objects left in a batch, which is emptied. */
+void falcon_task_requeue(GQueue *objects);
+/* Whether name is in a directory left by the last crawl, to be listed again. */
+gboolean falcon_task_resumed(const gchar *name);
+/* How the walkers check the cache, see falcon_set_start(). */
+falcon_start_t falcon_start_mode(void);
 
 #endif
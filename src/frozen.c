@@ -0,0 +1,540 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "frozen.h"
+
+#define FROZEN_NONE G_MAXUINT32
+/* The object and its descendants have been deleted since the build. */
+#define FROZEN_DEAD (1 << 0)
+/* The index is rebuilt once the overlay is this large compared to it. */
+#define FROZEN_OVERLAY_RATIO 8
+#define FROZEN_OVERLAY_MIN 1024
+
+typedef struct {
+	guint32 name;				/* Offset of the key in the name pool */
+	guint32 len;
+	guint32 parent;
+	guint32 end;				/* One past the last descendant */
+	guint32 children;			/* First entry of the child list in links */
+	guint32 count;
+} falcon_frozen_node_t;
+
+/*
+ * The first bytes of the key are kept next to the child, so the binary search
+ * only reads the name pool to confirm a match.
+ */
+typedef struct {
+	guint32 prefix;
+	guint32 node;
+} falcon_frozen_link_t;
+
+/*
+ * The objects and the flags are kept in separate columns, so scanning a
+ * subtree doesn't drag the node records through the cache.
+ */
+struct falcon_frozen_st {
+	falcon_frozen_node_t *nodes;
+	falcon_object_t **objects;
+	guint8 *flags;
+	falcon_frozen_link_t *links;	/* The children of each node, sorted */
+	gchar *names;
+	guint32 length;
+	GSequence *overlay;			/* Entries in path order, see below */
+	GHashTable *entries;		/* Name to its iter in the overlay */
+};
+
+/* A change made since the build, the name is canonical. */
+typedef struct {
+	gchar *name;
+	falcon_object_t *object;	/* NULL if deleted */
+} falcon_frozen_entry_t;
+
+typedef struct {
+	trie_node_t *node;
+	guint32 parent;
+	guint32 slot;				/* Entry in links to fill, if any */
+} falcon_frozen_pending_t;
+
+static void falcon_frozen_entry_free(gpointer data)
+{
+	falcon_frozen_entry_t *entry = (falcon_frozen_entry_t *)data;
+
+	if (entry->object)
+		falcon_object_unref(entry->object);
+	g_free(entry->name);
+	g_free(entry);
+}
+
+/*
+ * Orders names like strcmp(), except that the separator comes before any other
+ * byte. A name is then directly followed by its descendants, so the changes
+ * under a name are a range of the overlay.
+ */
+static gint falcon_frozen_compare_entries(gconstpointer a, gconstpointer b,
+                                          gpointer userdata ATTRIBUTE_UNUSED)
+{
+	const gchar *name_a = ((const falcon_frozen_entry_t *)a)->name;
+	const gchar *name_b = ((const falcon_frozen_entry_t *)b)->name;
+
+	while (*name_a && *name_a == *name_b) {
+		name_a++;
+		name_b++;
+	}
+	if (*name_a == *name_b)
+		return 0;
+	if (!*name_a || (*name_a == G_DIR_SEPARATOR && *name_b))
+		return -1;
+	if (!*name_b || *name_b == G_DIR_SEPARATOR)
+		return 1;
+	return (guchar)*name_a < (guchar)*name_b ? -1 : 1;
+}
+
+static gint falcon_frozen_compare_keys(gconstpointer a, gconstpointer b)
+{
+	return strcmp(trie_key(*(trie_node_t **)a), trie_key(*(trie_node_t **)b));
+}
+
+/* Compares like strcmp() on the first four bytes. */
+static guint32 falcon_frozen_prefix(const gchar *key, gsize len)
+{
+	guint32 prefix = 0;
+	gsize i;
+
+	for (i = 0; i < 4; i++)
+		prefix = (prefix << 8) | (i < len ? (guint8)key[i] : 0);
+
+	return prefix;
+}
+
+falcon_frozen_t *falcon_frozen_new(trie_node_t *root)
+{
+	falcon_frozen_t *frozen = NULL;
+	falcon_frozen_node_t *cur = NULL;
+	falcon_frozen_pending_t pending;
+	trie_iter_t iter;
+	trie_node_t *node = NULL;
+	GArray *stack = NULL;
+	GPtrArray *children = NULL;
+	gsize names = 0;
+	guint32 links = 0;
+	guint32 count = 1;
+	guint32 i;
+	gint j;
+
+	g_return_val_if_fail(root, NULL);
+
+	/* Size the arrays first, the trie doesn't know its own size. */
+	trie_iter_init(&iter, root, TRIE_PRE_ORDER);
+	while ((node = trie_iter_next(&iter))) {
+		names += strlen(trie_key(node));
+		count++;
+	}
+
+	frozen = g_new0(falcon_frozen_t, 1);
+	frozen->nodes = g_new(falcon_frozen_node_t, count);
+	frozen->objects = g_new0(falcon_object_t *, count);
+	frozen->flags = g_new0(guint8, count);
+	frozen->links = g_new(falcon_frozen_link_t, count);
+	frozen->names = g_malloc(names + 1);
+	frozen->overlay = g_sequence_new(falcon_frozen_entry_free);
+	frozen->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	names = 0;
+
+	/* Pre-order with the children sorted, so a subtree is a range. */
+	stack = g_array_new(FALSE, FALSE, sizeof(falcon_frozen_pending_t));
+	children = g_ptr_array_new();
+	pending.node = root;
+	pending.parent = FROZEN_NONE;
+	pending.slot = FROZEN_NONE;
+	g_array_append_val(stack, pending);
+	while (stack->len) {
+		pending = g_array_index(stack, falcon_frozen_pending_t, stack->len - 1);
+		g_array_set_size(stack, stack->len - 1);
+
+		i = frozen->length++;
+		cur = &frozen->nodes[i];
+		cur->name = names;
+		cur->len = 0;
+		if (trie_key(pending.node)) {
+			cur->len = strlen(trie_key(pending.node));
+			memcpy(frozen->names + names, trie_key(pending.node), cur->len);
+			names += cur->len;
+		}
+		cur->parent = pending.parent;
+		cur->end = i + 1;
+		if (pending.slot != FROZEN_NONE) {
+			frozen->links[pending.slot].prefix =
+				falcon_frozen_prefix(frozen->names + cur->name, cur->len);
+			frozen->links[pending.slot].node = i;
+		}
+		if (trie_data(pending.node))
+			frozen->objects[i] = falcon_object_ref(trie_data(pending.node));
+
+		g_ptr_array_set_size(children, 0);
+		for (node = trie_child(pending.node); node; node = trie_next(node))
+			g_ptr_array_add(children, node);
+		g_ptr_array_sort(children, falcon_frozen_compare_keys);
+		cur->children = links;
+		cur->count = children->len;
+		links += children->len;
+
+		for (j = children->len - 1; j >= 0; j--) {
+			pending.node = g_ptr_array_index(children, j);
+			pending.parent = i;
+			pending.slot = cur->children + j;
+			g_array_append_val(stack, pending);
+		}
+	}
+	g_ptr_array_free(children, TRUE);
+	g_array_free(stack, TRUE);
+
+	/* A node's range ends where the last of its descendants ends. */
+	for (i = frozen->length - 1; i > 0; i--) {
+		cur = &frozen->nodes[frozen->nodes[i].parent];
+		if (cur->end < frozen->nodes[i].end)
+			cur->end = frozen->nodes[i].end;
+	}
+
+	return frozen;
+}
+
+void falcon_frozen_free(falcon_frozen_t *frozen)
+{
+	guint32 i;
+
+	g_return_if_fail(frozen);
+
+	for (i = 0; i < frozen->length; i++)
+		if (frozen->objects[i])
+			falcon_object_unref(frozen->objects[i]);
+	g_hash_table_destroy(frozen->entries);
+	g_sequence_free(frozen->overlay);
+	g_free(frozen->nodes);
+	g_free(frozen->objects);
+	g_free(frozen->flags);
+	g_free(frozen->links);
+	g_free(frozen->names);
+	g_free(frozen);
+}
+
+/* Same order as strcmp() on the keys. */
+static gint falcon_frozen_compare(const falcon_frozen_t *frozen, guint32 node,
+                                  const gchar *key, gsize len)
+{
+	const falcon_frozen_node_t *cur = &frozen->nodes[node];
+	gint ret = memcmp(frozen->names + cur->name, key, MIN(cur->len, len));
+
+	if (ret)
+		return ret;
+	return cur->len < len ? -1 : (cur->len > len ? 1 : 0);
+}
+
+static guint32 falcon_frozen_child(const falcon_frozen_t *frozen, guint32 node,
+                                   const gchar *key, gsize len)
+{
+	const falcon_frozen_link_t *links = NULL;
+	guint32 prefix = falcon_frozen_prefix(key, len);
+	guint32 low = 0;
+	guint32 high = frozen->nodes[node].count;
+	guint32 mid = 0;
+	gint ret = 0;
+
+	links = frozen->links + frozen->nodes[node].children;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (links[mid].prefix != prefix)
+			ret = links[mid].prefix < prefix ? -1 : 1;
+		else
+			ret = falcon_frozen_compare(frozen, links[mid].node, key, len);
+		if (ret == 0)
+			return links[mid].node;
+		if (ret < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return FROZEN_NONE;
+}
+
+/*
+ * Splits name into components the same way the trie does. Unless all is TRUE,
+ * deleted nodes are not found.
+ */
+static guint32 falcon_frozen_find(const falcon_frozen_t *frozen,
+                                  const gchar *name, gboolean all)
+{
+	const gchar *start = name;
+	const gchar *end = NULL;
+	guint32 node = 0;
+
+	if (!name || *name == '\0')
+		return FROZEN_NONE;
+
+	while (*start) {
+		if (start == name && *start == G_DIR_SEPARATOR) {
+			end = start + 1;
+		} else {
+			end = strchr(start, G_DIR_SEPARATOR);
+			if (!end)
+				end = start + strlen(start);
+		}
+
+		node = falcon_frozen_child(frozen, node, start, end - start);
+		if (node == FROZEN_NONE
+		    || (!all && (frozen->flags[node] & FROZEN_DEAD)))
+			return FROZEN_NONE;
+
+		for (start = end; *start == G_DIR_SEPARATOR; start++)
+			;
+	}
+
+	return node;
+}
+
+/*
+ * The overlay is keyed by name, so names that the trie considers equal must
+ * be spelled the same. Returns NULL if name is canonical already.
+ */
+static gchar *falcon_frozen_canonical(const gchar *name)
+{
+	const gchar *src = NULL;
+	gchar *ret = NULL;
+	gchar *dst = NULL;
+	gsize len = strlen(name);
+
+	if (!strstr(name, G_DIR_SEPARATOR_S G_DIR_SEPARATOR_S)
+	    && (len <= 1 || name[len - 1] != G_DIR_SEPARATOR))
+		return NULL;
+
+	ret = dst = g_malloc(len + 1);
+	for (src = name; *src; src++)
+		if (*src != G_DIR_SEPARATOR || dst == ret
+		    || dst[-1] != G_DIR_SEPARATOR)
+			*dst++ = *src;
+	if (dst - ret > 1 && dst[-1] == G_DIR_SEPARATOR)
+		dst--;
+	*dst = '\0';
+
+	return ret;
+}
+
+/* Whether name is prefix or one of its descendants. */
+static gboolean falcon_frozen_is_under(const gchar *name, const gchar *prefix)
+{
+	gsize len = strlen(prefix);
+
+	if (strncmp(name, prefix, len) != 0)
+		return FALSE;
+	return name[len] == '\0' || name[len] == G_DIR_SEPARATOR
+	       || (len && prefix[len - 1] == G_DIR_SEPARATOR);
+}
+
+/*
+ * Returns the first entry of the overlay at or after name, which starts the
+ * changes to name and its descendants if there are any.
+ */
+static GSequenceIter *falcon_frozen_first(const falcon_frozen_t *frozen,
+                                          const gchar *name)
+{
+	falcon_frozen_entry_t key;
+	GSequenceIter *iter = NULL;
+	GSequenceIter *prev = NULL;
+
+	key.name = (gchar *)name;
+	key.object = NULL;
+
+	/* The search ends right after the entry that compares equal. */
+	iter = g_sequence_search(frozen->overlay, &key,
+	                         falcon_frozen_compare_entries, NULL);
+	if (!g_sequence_iter_is_begin(iter)) {
+		prev = g_sequence_iter_prev(iter);
+		if (falcon_frozen_compare_entries(g_sequence_get(prev), &key,
+		                                  NULL) == 0)
+			iter = prev;
+	}
+
+	return iter;
+}
+
+/* Whether the overlay has changes to name or its descendants. */
+static gboolean falcon_frozen_changed(const falcon_frozen_t *frozen,
+                                      const gchar *name)
+{
+	GSequenceIter *iter = falcon_frozen_first(frozen, name);
+	falcon_frozen_entry_t *entry = NULL;
+
+	if (g_sequence_iter_is_end(iter))
+		return FALSE;
+	entry = g_sequence_get(iter);
+	return falcon_frozen_is_under(entry->name, name);
+}
+
+/* Stores object, or NULL, for name in the overlay, taking both. */
+static void falcon_frozen_record(falcon_frozen_t *frozen, gchar *name,
+                                 falcon_object_t *object)
+{
+	falcon_frozen_entry_t *entry = NULL;
+	GSequenceIter *iter = NULL;
+
+	if ((iter = g_hash_table_lookup(frozen->entries, name))) {
+		entry = g_sequence_get(iter);
+		if (entry->object)
+			falcon_object_unref(entry->object);
+		entry->object = object;
+		g_free(name);
+		return;
+	}
+
+	entry = g_new0(falcon_frozen_entry_t, 1);
+	entry->name = name;
+	entry->object = object;
+	iter = g_sequence_insert_sorted(frozen->overlay, entry,
+	                                falcon_frozen_compare_entries, NULL);
+	g_hash_table_insert(frozen->entries, entry->name, iter);
+}
+
+falcon_object_t *falcon_frozen_get(const falcon_frozen_t *frozen,
+                                   const gchar *name)
+{
+	falcon_frozen_entry_t *entry = NULL;
+	GSequenceIter *iter = NULL;
+	gchar *canonical = NULL;
+	guint32 node;
+
+	g_return_val_if_fail(frozen, NULL);
+	g_return_val_if_fail(name, NULL);
+
+	if (g_hash_table_size(frozen->entries)) {
+		canonical = falcon_frozen_canonical(name);
+		iter = g_hash_table_lookup(frozen->entries,
+		                           canonical ? canonical : name);
+		g_free(canonical);
+		if (iter) {
+			entry = g_sequence_get(iter);
+			return entry->object;
+		}
+	}
+
+	node = falcon_frozen_find(frozen, name, FALSE);
+	return node == FROZEN_NONE ? NULL : frozen->objects[node];
+}
+
+void falcon_frozen_set(falcon_frozen_t *frozen, falcon_object_t *object)
+{
+	const gchar *name = NULL;
+	gchar *canonical = NULL;
+
+	g_return_if_fail(frozen);
+	g_return_if_fail(object);
+
+	name = falcon_object_get_name(object);
+	if (!(canonical = falcon_frozen_canonical(name)))
+		canonical = g_strdup(name);
+	falcon_frozen_record(frozen, canonical, falcon_object_ref(object));
+}
+
+void falcon_frozen_delete(falcon_frozen_t *frozen, const gchar *name)
+{
+	falcon_frozen_entry_t *entry = NULL;
+	GSequenceIter *iter = NULL;
+	GSequenceIter *next = NULL;
+	gchar *canonical = NULL;
+	guint32 node;
+
+	g_return_if_fail(frozen);
+	g_return_if_fail(name);
+
+	if (!(canonical = falcon_frozen_canonical(name)))
+		canonical = g_strdup(name);
+
+	/* The changes under name follow each other. */
+	for (iter = falcon_frozen_first(frozen, canonical);
+	     !g_sequence_iter_is_end(iter); iter = next) {
+		entry = g_sequence_get(iter);
+		if (!falcon_frozen_is_under(entry->name, canonical))
+			break;
+		next = g_sequence_iter_next(iter);
+		g_hash_table_remove(frozen->entries, entry->name);
+		g_sequence_remove(iter);
+	}
+
+	/*
+	 * The mark hides the descendants as well, see falcon_frozen_find(). The
+	 * overlay entry tells falcon_frozen_foreach() that the subtree changed.
+	 */
+	node = falcon_frozen_find(frozen, canonical, TRUE);
+	if (node != FROZEN_NONE) {
+		frozen->flags[node] |= FROZEN_DEAD;
+		falcon_frozen_record(frozen, canonical, NULL);
+	} else {
+		g_free(canonical);
+	}
+}
+
+gboolean falcon_frozen_stale(const falcon_frozen_t *frozen)
+{
+	guint size;
+
+	g_return_val_if_fail(frozen, FALSE);
+
+	size = g_hash_table_size(frozen->entries);
+	return size > FROZEN_OVERLAY_MIN
+	       && size > frozen->length / FROZEN_OVERLAY_RATIO;
+}
+
+gboolean falcon_frozen_foreach(const falcon_frozen_t *frozen,
+                               const gchar *name, GFunc func,
+                               gpointer userdata)
+{
+	gchar *canonical = NULL;
+	gboolean changed = FALSE;
+	guint32 node;
+	guint32 i;
+
+	g_return_val_if_fail(frozen, FALSE);
+	g_return_val_if_fail(func, FALSE);
+
+	if (name) {
+		if ((node = falcon_frozen_find(frozen, name, FALSE)) == FROZEN_NONE)
+			return FALSE;
+		canonical = falcon_frozen_canonical(name);
+		changed = falcon_frozen_changed(frozen, canonical ? canonical : name);
+		g_free(canonical);
+	} else {
+		node = 0;
+		changed = g_hash_table_size(frozen->entries) != 0;
+	}
+	if (changed)
+		return FALSE;
+
+	/* Reversed pre-order puts every node after its descendants. */
+	for (i = frozen->nodes[node].end; i-- > node;)
+		if (frozen->objects[i])
+			func(frozen->objects[i], userdata);
+
+	return TRUE;
+}
@@ -0,0 +1,66 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _FROZEN_H_
+#define _FROZEN_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "object.h"
+#include "trie.h"
+
+/*
+ * A read-only copy of the cache trie laid out for lookups. The nodes are kept
+ * in a contiguous array in pre-order, each with the range of its descendants
+ * and a sorted list of its children, so a lookup is a binary search per path
+ * component. Changes made after the build go to a small overlay until the
+ * index is rebuilt. It is not thread-safe, the cache lock protects it.
+ */
+typedef struct falcon_frozen_st falcon_frozen_t;
+
+/* Builds the index from the trie, taking a reference to each object. */
+falcon_frozen_t *falcon_frozen_new(trie_node_t *root);
+void falcon_frozen_free(falcon_frozen_t *frozen);
+
+/* Gets the object with the given name. No reference is taken. */
+falcon_object_t *falcon_frozen_get(const falcon_frozen_t *frozen,
+                                   const gchar *name);
+/* Records an object added or replaced since the build. */
+void falcon_frozen_set(falcon_frozen_t *frozen, falcon_object_t *object);
+/* Records the deletion of name and its descendants. */
+void falcon_frozen_delete(falcon_frozen_t *frozen, const gchar *name);
+/* Whether the overlay has grown large enough to rebuild the index. */
+gboolean falcon_frozen_stale(const falcon_frozen_t *frozen);
+/*
+ * Calls func on the objects of the subtree of name, or of the whole index if
+ * name is NULL, children before their parents. Returns FALSE without calling
+ * func if the subtree has changed since the build, the caller has to use the
+ * trie then.
+ */
+gboolean falcon_frozen_foreach(const falcon_frozen_t *frozen,
+                               const gchar *name, GFunc func,
+                               gpointer userdata);
+
+#endif
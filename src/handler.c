@@ -26,6 +26,7 @@
 
 #include "handler.h"
 #include "falcon.h"
+#include "journal.h"
 
 typedef struct {
 	falcon_handler_func func;
@@ -35,12 +36,24 @@ typedef struct {
 static GMutex *lock = NULL;
 static GHashTable *registry = NULL;
 
+/* Adds object through the cursor if there is one. */
+static gboolean falcon_handler_add(falcon_object_t *object,
+                                   falcon_cache_t *cache,
+                                   falcon_cursor_t *cursor)
+{
+	if (cursor)
+		return falcon_cursor_add_steal(cursor, falcon_object_ref(object));
+	return falcon_cache_add_steal(cache, falcon_object_ref(object));
+}
+
 static void
 falcon_handler_created_event(falcon_object_t *object,
                              falcon_event_code_t event ATTRIBUTE_UNUSED,
-                             falcon_cache_t *cache)
+                             falcon_cache_t *cache, falcon_cursor_t *cursor)
 {
-	if (!falcon_cache_add(cache, object))
+	if (falcon_handler_add(object, cache, cursor))
+		falcon_journal_add(object);
+	else
 		g_warning(_("Failed to add %s to the cache."),
 		          falcon_object_get_name(object));
 }
@@ -48,9 +61,19 @@ falcon_handler_created_event(falcon_object_t *object,
 static void
 falcon_handler_deleted_event(falcon_object_t *object,
                              falcon_event_code_t event ATTRIBUTE_UNUSED,
-                             falcon_cache_t *cache)
+                             falcon_cache_t *cache, falcon_cursor_t *cursor)
 {
-	if (!falcon_cache_delete(cache, falcon_object_get_name(object)))
+	const gchar *key = NULL;
+	gboolean ret = FALSE;
+
+	if (cursor && (key = falcon_cursor_seek(cursor,
+	                                        falcon_object_get_name(object))))
+		ret = falcon_cursor_delete(cursor, key);
+	else
+		ret = falcon_cache_delete(cache, falcon_object_get_name(object));
+	if (ret)
+		falcon_journal_delete(falcon_object_get_name(object));
+	else
 		g_warning(_("Failed to delete %s from the cache."),
 		          falcon_object_get_name(object));
 }
@@ -58,9 +81,11 @@ falcon_handler_deleted_event(falcon_object_t *object,
 static void
 falcon_handler_changed_event(falcon_object_t *object,
                              falcon_event_code_t event ATTRIBUTE_UNUSED,
-                             falcon_cache_t *cache)
+                             falcon_cache_t *cache, falcon_cursor_t *cursor)
 {
-	if (!falcon_cache_add(cache, object))
+	if (falcon_handler_add(object, cache, cursor))
+		falcon_journal_add(object);
+	else
 		g_warning(_("Failed to change %s in the cache."),
 		          falcon_object_get_name(object));
 }
@@ -182,6 +207,12 @@ void falcon_handler_shutdown(void)
 
 void falcon_handler(falcon_object_t *object, falcon_event_code_t event,
                     falcon_cache_t *cache)
+{
+	falcon_handler_cursor(object, event, cache, NULL);
+}
+
+void falcon_handler_cursor(falcon_object_t *object, falcon_event_code_t event,
+                           falcon_cache_t *cache, falcon_cursor_t *cursor)
 {
 	falcon_handler_t *value = NULL;
 	GSList *list = NULL;
@@ -217,21 +248,32 @@ void falcon_handler(falcon_object_t *object, falcon_event_code_t event,
 	g_hash_table_insert(registry, GUINT_TO_POINTER(event), list);
 	g_mutex_unlock(lock);
 
-	/* Update cache. */
+	/* Update cache, the journal keeps the records in the same order. */
+	falcon_journal_lock();
 	switch (event) {
 	case EVENT_DIR_CREATED:
 	case EVENT_FILE_CREATED:
-		falcon_handler_created_event(object, event, cache);
+		falcon_handler_created_event(object, event, cache, cursor);
 		break;
 	case EVENT_DIR_DELETED:
 	case EVENT_FILE_DELETED:
-		falcon_handler_deleted_event(object, event, cache);
+		falcon_handler_deleted_event(object, event, cache, cursor);
 		break;
 	case EVENT_DIR_CHANGED:
 	case EVENT_FILE_CHANGED:
-		falcon_handler_changed_event(object, event, cache);
+		falcon_handler_changed_event(object, event, cache, cursor);
 		break;
 	default:
 		break;
 	}
+	falcon_journal_unlock();
+}
+
+void falcon_handler_refresh(falcon_object_t *object, falcon_cache_t *cache,
+                            falcon_cursor_t *cursor)
+{
+	falcon_journal_lock();
+	if (falcon_handler_add(object, cache, cursor))
+		falcon_journal_add(object);
+	falcon_journal_unlock();
 }
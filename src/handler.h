@@ -43,5 +43,15 @@ void falcon_handler_shutdown(void);
  */
 void falcon_handler(falcon_object_t *object, falcon_event_code_t event,
                     falcon_cache_t *cache);
+/* Same as falcon_handler(), the cache is updated through cursor. */
+void falcon_handler_cursor(falcon_object_t *object, falcon_event_code_t event,
+                           falcon_cache_t *cache, falcon_cursor_t *cursor);
+/*
+ * Stores object in the cache without an event, for a cached copy that is equal
+ * but lacks the attributes older cache files didn't keep, or was on a device
+ * numbered differently.
+ */
+void falcon_handler_refresh(falcon_object_t *object, falcon_cache_t *cache,
+                            falcon_cursor_t *cursor);
 
 #endif
@@ -0,0 +1,864 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "common.h"
+#include "crc32c.h"
+#include "object.h"
+#include "snapshot.h"
+#include "image.h"
+
+#define IMAGE_MAGIC "FLCI"
+#define IMAGE_VERSION 2
+/* No flags are defined yet. */
+#define IMAGE_FLAGS 0
+/* Magic, version, flags, counts, the CRC-32C of all of them and padding. */
+#define IMAGE_HEADER 64
+#define IMAGE_HEADER_CRC 32
+/* Returned by the lookups for a missing node. */
+#define IMAGE_NONE G_MAXUINT32
+
+/* Node flags */
+#define NODE_OBJECT (1 << 0)	/* The columns hold an object */
+
+/* All values are stored in Little Endian order. */
+typedef struct {
+	guint32 name;				/* Offset of the component in the names */
+	guint32 parent;
+	guint32 end;				/* Index past the last descendant */
+	guint32 first;				/* Offset of the children in the links */
+	guint32 children;
+	guint16 len;				/* Length of the component */
+	guint16 flags;
+} falcon_image_node_t;
+
+/* The sections of the file, in order, each aligned for its values. */
+typedef enum {
+	SECTION_NODES,
+	SECTION_LINKS,
+	SECTION_SIZES,
+	SECTION_TIMES,
+	SECTION_DEVS,				/* The four of them since version 2 */
+	SECTION_INODES,
+	SECTION_MTIMES,
+	SECTION_CTIMES,
+	SECTION_MODES,
+	SECTION_WATCHES,
+	SECTION_NAMES,
+	SECTION_END
+} falcon_image_section_t;
+
+struct falcon_image_st {
+	gchar *name;
+	GMappedFile *file;
+	const falcon_image_node_t *nodes;
+	const guint32 *links;		/* Child indexes, sorted by name per parent */
+	const guint64 *sizes;
+	const guint64 *times;
+	const guint64 *devs;		/* NULL in version 1 files, as the next ones */
+	const guint64 *inodes;
+	const guint64 *mtimes;
+	const guint64 *ctimes;
+	const guint32 *modes;
+	const guint8 *watches;
+	const gchar *names;
+	guint32 count;				/* Nodes, the root included */
+	guint64 length;				/* Of the names */
+	guint64 pending;
+	guint8 *loaded;				/* Bit per node created or discarded */
+	gboolean failed;
+};
+
+/* Orders components by bytes, then by length, the order of the links. */
+static gint falcon_image_compare_key(const gchar *a, gsize alen, const gchar *b,
+                                     gsize blen)
+{
+	gint ret = memcmp(a, b, MIN(alen, blen));
+
+	if (ret)
+		return ret;
+	return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+/*
+ * Fills the offsets of the sections for count nodes and length name bytes in a
+ * file of the given version.
+ */
+static void falcon_image_layout(guint64 count, guint64 length, guint16 version,
+                                guint64 offsets[SECTION_END + 1])
+{
+	guint64 stats = version >= 2 ? count * 8 : 0;
+
+	offsets[SECTION_NODES] = IMAGE_HEADER;
+	offsets[SECTION_LINKS] = offsets[SECTION_NODES]
+		+ count * sizeof(falcon_image_node_t);
+	offsets[SECTION_SIZES] = (offsets[SECTION_LINKS] + (count - 1) * 4 + 7)
+		& ~(guint64)7;
+	offsets[SECTION_TIMES] = offsets[SECTION_SIZES] + count * 8;
+	offsets[SECTION_DEVS] = offsets[SECTION_TIMES] + count * 8;
+	offsets[SECTION_INODES] = offsets[SECTION_DEVS] + stats;
+	offsets[SECTION_MTIMES] = offsets[SECTION_INODES] + stats;
+	offsets[SECTION_CTIMES] = offsets[SECTION_MTIMES] + stats;
+	offsets[SECTION_MODES] = offsets[SECTION_CTIMES] + stats;
+	offsets[SECTION_WATCHES] = offsets[SECTION_MODES] + count * 4;
+	offsets[SECTION_NAMES] = offsets[SECTION_WATCHES] + count;
+	offsets[SECTION_END] = offsets[SECTION_NAMES] + length;
+}
+
+/*
+ * Builds the nodes from the sorted objects. The directories on the path of the
+ * previous object are kept on a stack, a node is closed when an object outside
+ * of it comes. data gets the object of each node, or NULL.
+ */
+static gboolean falcon_image_build(GPtrArray *sorted, GArray *nodes,
+                                   GString *names, GPtrArray *data,
+                                   guint64 *count)
+{
+	GArray *stack = NULL;
+	falcon_image_node_t node;
+	falcon_image_node_t *cur = NULL;
+	falcon_object_t *object = NULL;
+	const gchar *name = NULL;
+	const gchar *pos = NULL;
+	const gchar *start = NULL;
+	const gchar *end = NULL;
+	guint32 index = 0;
+	guint depth = 0;
+	guint i;
+
+	stack = g_array_new(FALSE, FALSE, sizeof(guint32));
+	memset(&node, 0, sizeof(node));
+	g_array_append_val(nodes, node);
+	g_ptr_array_add(data, NULL);
+	g_array_append_val(stack, index);
+
+	for (i = 0; i < sorted->len; i++) {
+		object = g_ptr_array_index(sorted, i);
+		name = falcon_object_get_name(object);
+		for (pos = name, depth = 1;
+		     (start = falcon_path_component(name, pos, &end)); pos = end) {
+			if (depth < stack->len) {
+				cur = &g_array_index(nodes, falcon_image_node_t,
+				                     g_array_index(stack, guint32, depth));
+				if (falcon_image_compare_key(names->str + cur->name, cur->len,
+				                             start, end - start) == 0) {
+					depth++;
+					continue;
+				}
+				while (stack->len > depth) {
+					index = g_array_index(stack, guint32, stack->len - 1);
+					g_array_index(nodes, falcon_image_node_t, index).end =
+						nodes->len;
+					g_array_set_size(stack, stack->len - 1);
+				}
+			}
+
+			if (end - start > G_MAXUINT16 || names->len > G_MAXUINT32
+			    || nodes->len == G_MAXUINT32) {
+				g_critical(_("Failed to save \"%s\", the cache is too large."),
+				           name);
+				g_array_free(stack, TRUE);
+				return FALSE;
+			}
+			memset(&node, 0, sizeof(node));
+			node.name = names->len;
+			node.len = end - start;
+			node.parent = g_array_index(stack, guint32, depth - 1);
+			g_string_append_len(names, start, end - start);
+			index = nodes->len;
+			g_array_append_val(nodes, node);
+			g_ptr_array_add(data, NULL);
+			g_array_append_val(stack, index);
+			depth++;
+		}
+		/* A name without components has no node, nothing can find it. */
+		if (depth == 1)
+			continue;
+
+		index = g_array_index(stack, guint32, depth - 1);
+		cur = &g_array_index(nodes, falcon_image_node_t, index);
+		if (!(cur->flags & NODE_OBJECT))
+			(*count)++;
+		cur->flags |= NODE_OBJECT;
+		g_ptr_array_index(data, index) = object;
+	}
+
+	for (i = 0; i < stack->len; i++)
+		g_array_index(nodes, falcon_image_node_t,
+		              g_array_index(stack, guint32, i)).end = nodes->len;
+
+	g_array_free(stack, TRUE);
+
+	return TRUE;
+}
+
+gboolean falcon_image_probe(const gchar *name)
+{
+	gchar magic[4];
+	gboolean ret = FALSE;
+	int fd = 0;
+
+	g_return_val_if_fail(name, FALSE);
+
+	fd = g_open(name, O_RDONLY, 0);
+	if (fd == -1)
+		return FALSE;
+	ret = read(fd, magic, 4) == 4 && memcmp(magic, IMAGE_MAGIC, 4) == 0;
+	close(fd);
+
+	return ret;
+}
+
+gboolean falcon_image_save(const falcon_snapshot_t *snapshot,
+                           const gchar *name)
+{
+	static const guint8 padding[8];
+	GPtrArray *objects = NULL;
+	GPtrArray *data = NULL;
+	GArray *nodes = NULL;
+	GString *names = NULL;
+	falcon_image_node_t *node = NULL;
+	falcon_object_t *object = NULL;
+	guint64 offsets[SECTION_END + 1];
+	guint8 header[IMAGE_HEADER];
+	guint32 *links = NULL;
+	guint32 *next = NULL;
+	guint64 *sizes = NULL;
+	guint64 *times = NULL;
+	guint64 *devs = NULL;
+	guint64 *inodes = NULL;
+	guint64 *mtimes = NULL;
+	guint64 *ctimes = NULL;
+	guint32 *modes = NULL;
+	guint8 *watches = NULL;
+	guint64 count = 0;
+	guint64 value = 0;
+	guint32 crc = 0;
+	guint16 half = 0;
+	gchar *temp = NULL;
+	gboolean ret = FALSE;
+	guint32 n = 0;
+	guint32 i;
+	int fd = 0;
+
+	g_return_val_if_fail(snapshot, FALSE);
+	if (!name)
+		return FALSE;
+
+	objects = falcon_snapshot_sorted(snapshot);
+
+	nodes = g_array_sized_new(FALSE, FALSE, sizeof(falcon_image_node_t),
+	                          objects->len + 1);
+	names = g_string_new(NULL);
+	data = g_ptr_array_sized_new(objects->len + 1);
+	if (!falcon_image_build(objects, nodes, names, data, &count))
+		goto out;
+	n = nodes->len;
+	node = (falcon_image_node_t *)nodes->data;
+
+	/* The children of a node follow each other, in the order of the nodes. */
+	links = g_new(guint32, MAX(n - 1, 1));
+	next = g_new0(guint32, n);
+	for (i = 1; i < n; i++)
+		node[node[i].parent].children++;
+	for (i = 1; i < n; i++)
+		node[i].first = node[i - 1].first + node[i - 1].children;
+	for (i = 1; i < n; i++)
+		links[node[node[i].parent].first + next[node[i].parent]++] = i;
+
+	sizes = g_new0(guint64, n);
+	times = g_new0(guint64, n);
+	devs = g_new0(guint64, n);
+	inodes = g_new0(guint64, n);
+	mtimes = g_new0(guint64, n);
+	ctimes = g_new0(guint64, n);
+	modes = g_new0(guint32, n);
+	watches = g_new0(guint8, n);
+	for (i = 0; i < n; i++) {
+		if (!(object = g_ptr_array_index(data, i)))
+			continue;
+		sizes[i] = falcon_object_get_size(object);
+		times[i] = falcon_object_get_time(object);
+		devs[i] = falcon_object_get_dev(object);
+		inodes[i] = falcon_object_get_ino(object);
+		mtimes[i] = falcon_object_get_mtime(object);
+		ctimes[i] = falcon_object_get_ctime(object);
+		modes[i] = falcon_object_get_mode(object);
+		watches[i] = falcon_object_get_watch(object);
+	}
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+	for (i = 0; i < n; i++) {
+		node[i].name = GUINT32_TO_LE(node[i].name);
+		node[i].parent = GUINT32_TO_LE(node[i].parent);
+		node[i].end = GUINT32_TO_LE(node[i].end);
+		node[i].first = GUINT32_TO_LE(node[i].first);
+		node[i].children = GUINT32_TO_LE(node[i].children);
+		node[i].len = GUINT16_TO_LE(node[i].len);
+		node[i].flags = GUINT16_TO_LE(node[i].flags);
+		if (i)
+			links[i - 1] = GUINT32_TO_LE(links[i - 1]);
+		sizes[i] = GUINT64_TO_LE(sizes[i]);
+		times[i] = GUINT64_TO_LE(times[i]);
+		devs[i] = GUINT64_TO_LE(devs[i]);
+		inodes[i] = GUINT64_TO_LE(inodes[i]);
+		mtimes[i] = GUINT64_TO_LE(mtimes[i]);
+		ctimes[i] = GUINT64_TO_LE(ctimes[i]);
+		modes[i] = GUINT32_TO_LE(modes[i]);
+	}
+#endif
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, IMAGE_MAGIC, 4);
+	half = GUINT16_TO_LE(IMAGE_VERSION);
+	memcpy(header + 4, &half, 2);
+	half = GUINT16_TO_LE(IMAGE_FLAGS);
+	memcpy(header + 6, &half, 2);
+	value = GUINT64_TO_LE((guint64)n);
+	memcpy(header + 8, &value, 8);
+	value = GUINT64_TO_LE(count);
+	memcpy(header + 16, &value, 8);
+	value = GUINT64_TO_LE((guint64)names->len);
+	memcpy(header + 24, &value, 8);
+	crc = GUINT32_TO_LE(falcon_crc32c(0, header, IMAGE_HEADER_CRC));
+	memcpy(header + IMAGE_HEADER_CRC, &crc, 4);
+
+	/* Readers keep the old file mapped, replace it instead of rewriting it. */
+	fd = falcon_temp_open(name, &temp);
+	if (fd == -1) {
+		g_critical(_("Failed to open cache file %s: %s"), temp,
+		           g_strerror(errno));
+		goto out;
+	}
+
+	falcon_image_layout(n, names->len, IMAGE_VERSION, offsets);
+	ret = falcon_write_all(fd, header, IMAGE_HEADER)
+		&& falcon_write_all(fd, node, n * sizeof(falcon_image_node_t))
+		&& falcon_write_all(fd, links, (n - 1) * 4)
+		&& falcon_write_all(fd, padding, offsets[SECTION_SIZES]
+		                    - offsets[SECTION_LINKS] - (n - 1) * 4)
+		&& falcon_write_all(fd, sizes, n * 8)
+		&& falcon_write_all(fd, times, n * 8)
+		&& falcon_write_all(fd, devs, n * 8)
+		&& falcon_write_all(fd, inodes, n * 8)
+		&& falcon_write_all(fd, mtimes, n * 8)
+		&& falcon_write_all(fd, ctimes, n * 8)
+		&& falcon_write_all(fd, modes, n * 4)
+		&& falcon_write_all(fd, watches, n)
+		&& falcon_write_all(fd, names->str, names->len);
+	if (!falcon_temp_commit(fd, temp, name, ret)) {
+		g_critical(_("Failed to write cache file %s: %s"), name,
+		           g_strerror(errno));
+		ret = FALSE;
+	}
+
+out:
+	g_free(temp);
+	g_free(watches);
+	g_free(modes);
+	g_free(ctimes);
+	g_free(mtimes);
+	g_free(inodes);
+	g_free(devs);
+	g_free(times);
+	g_free(sizes);
+	g_free(next);
+	g_free(links);
+	g_string_free(names, TRUE);
+	g_array_free(nodes, TRUE);
+	g_ptr_array_free(data, TRUE);
+	g_ptr_array_free(objects, TRUE);
+
+	return ret;
+}
+
+/* Reports a malformed file once, the image gives nothing more afterwards. */
+static void falcon_image_fail(falcon_image_t *image)
+{
+	if (!image->failed)
+		g_critical(_("Cache file %s is corrupted."), image->name);
+	image->failed = TRUE;
+}
+
+falcon_image_t *falcon_image_open(const gchar *name)
+{
+	falcon_image_t *image = NULL;
+	GMappedFile *file = NULL;
+	GError *error = NULL;
+	const guint8 *data = NULL;
+	guint64 offsets[SECTION_END + 1];
+	guint64 length = 0;
+	guint64 count = 0;
+	guint64 objects = 0;
+	guint64 names = 0;
+	guint32 crc = 0;
+	guint16 version = 0;
+	guint16 flags = 0;
+
+	g_return_val_if_fail(name, NULL);
+
+	file = g_mapped_file_new(name, FALSE, &error);
+	if (!file) {
+		g_critical(_("Failed to read cache file %s: %s"), name,
+		           error->message);
+		g_error_free(error);
+		return NULL;
+	}
+	data = (const guint8 *)g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+
+	if (length < IMAGE_HEADER || memcmp(data, IMAGE_MAGIC, 4) != 0) {
+		g_critical(_("%s is not a cache file."), name);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+
+	memcpy(&version, data + 4, 2);
+	memcpy(&flags, data + 6, 2);
+	memcpy(&count, data + 8, 8);
+	memcpy(&objects, data + 16, 8);
+	memcpy(&names, data + 24, 8);
+	memcpy(&crc, data + IMAGE_HEADER_CRC, 4);
+	version = GUINT16_FROM_LE(version);
+	flags = GUINT16_FROM_LE(flags);
+	count = GUINT64_FROM_LE(count);
+	objects = GUINT64_FROM_LE(objects);
+	names = GUINT64_FROM_LE(names);
+	crc = GUINT32_FROM_LE(crc);
+
+	if (falcon_crc32c(0, data, IMAGE_HEADER_CRC) != crc) {
+		g_critical(_("Cache file %s is corrupted."), name);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+	if (version > IMAGE_VERSION || (flags & ~IMAGE_FLAGS)) {
+		g_critical(_("Cache file %s has an unsupported version %u."), name,
+		           version);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+
+	/*
+	 * Only the sizes are checked here, the nodes are checked as they are
+	 * visited, so opening doesn't touch the whole file.
+	 */
+	if (count < 1 || count > G_MAXUINT32 || objects >= count
+	    || names > G_MAXUINT32) {
+		g_critical(_("Cache file %s is corrupted."), name);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+	falcon_image_layout(count, names, version, offsets);
+	if (length < offsets[SECTION_END]) {
+		g_critical(_("Cache file %s is truncated."), name);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+	if (length > offsets[SECTION_END]) {
+		g_critical(_("Cache file %s has trailing data."), name);
+		g_mapped_file_free(file);
+		return NULL;
+	}
+
+	image = g_new0(falcon_image_t, 1);
+	image->name = g_strdup(name);
+	image->file = file;
+	image->nodes = (const falcon_image_node_t *)(data + offsets[SECTION_NODES]);
+	image->links = (const guint32 *)(data + offsets[SECTION_LINKS]);
+	image->sizes = (const guint64 *)(data + offsets[SECTION_SIZES]);
+	image->times = (const guint64 *)(data + offsets[SECTION_TIMES]);
+	if (version >= 2) {
+		image->devs = (const guint64 *)(data + offsets[SECTION_DEVS]);
+		image->inodes = (const guint64 *)(data + offsets[SECTION_INODES]);
+		image->mtimes = (const guint64 *)(data + offsets[SECTION_MTIMES]);
+		image->ctimes = (const guint64 *)(data + offsets[SECTION_CTIMES]);
+	}
+	image->modes = (const guint32 *)(data + offsets[SECTION_MODES]);
+	image->watches = data + offsets[SECTION_WATCHES];
+	image->names = (const gchar *)(data + offsets[SECTION_NAMES]);
+	image->count = count;
+	image->length = names;
+	image->pending = objects;
+	image->loaded = g_new0(guint8, (count + 7) / 8);
+
+	g_debug(_("Mapped %lu cache keys."), objects);
+
+	return image;
+}
+
+void falcon_image_free(falcon_image_t *image)
+{
+	g_return_if_fail(image);
+
+	g_mapped_file_free(image->file);
+	g_free(image->loaded);
+	g_free(image->name);
+	g_free(image);
+}
+
+guint64 falcon_image_pending(const falcon_image_t *image)
+{
+	g_return_val_if_fail(image, 0);
+
+	return image->failed ? 0 : image->pending;
+}
+
+/*
+ * Gets node index in host order, checking that it fits in the file and in its
+ * parent. Returns FALSE if the image is corrupted.
+ */
+static gboolean falcon_image_node(falcon_image_t *image, guint32 index,
+                                  falcon_image_node_t *node)
+{
+	const falcon_image_node_t *raw = image->nodes + index;
+
+	if (image->failed || index >= image->count)
+		return FALSE;
+
+	node->name = GUINT32_FROM_LE(raw->name);
+	node->parent = GUINT32_FROM_LE(raw->parent);
+	node->end = GUINT32_FROM_LE(raw->end);
+	node->first = GUINT32_FROM_LE(raw->first);
+	node->children = GUINT32_FROM_LE(raw->children);
+	node->len = GUINT16_FROM_LE(raw->len);
+	node->flags = GUINT16_FROM_LE(raw->flags);
+
+	if ((guint64)node->name + node->len > image->length
+	    || node->end <= index || node->end > image->count
+	    || (index ? node->parent >= index : node->end != image->count)
+	    || (guint64)node->first + node->children > image->count - 1
+	    || (node->flags & ~NODE_OBJECT)) {
+		falcon_image_fail(image);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean falcon_image_loaded(const falcon_image_t *image, guint32 index)
+{
+	return image->loaded[index / 8] & (1 << (index % 8));
+}
+
+/* Marks the node as done, returns TRUE if it has an object to create. */
+static gboolean falcon_image_take(falcon_image_t *image, guint32 index,
+                                  const falcon_image_node_t *node)
+{
+	if (falcon_image_loaded(image, index))
+		return FALSE;
+	image->loaded[index / 8] |= 1 << (index % 8);
+	if (!(node->flags & NODE_OBJECT))
+		return FALSE;
+	if (!image->pending) {
+		falcon_image_fail(image);
+		return FALSE;
+	}
+	image->pending--;
+
+	return TRUE;
+}
+
+/* Creates the object of the node named path, unless it was done already. */
+static void falcon_image_page(falcon_image_t *image, guint32 index,
+                              const falcon_image_node_t *node,
+                              const gchar *path, GFunc func, gpointer userdata)
+{
+	falcon_object_t *object = NULL;
+
+	if (!falcon_image_take(image, index, node))
+		return;
+
+	object = falcon_object_new(path);
+	falcon_object_set_size(object, GUINT64_FROM_LE(image->sizes[index]));
+	falcon_object_set_time(object, GUINT64_FROM_LE(image->times[index]));
+	falcon_object_set_mode(object, GUINT32_FROM_LE(image->modes[index]));
+	if (image->devs) {
+		falcon_object_set_inode(object, GUINT64_FROM_LE(image->devs[index]),
+		                        GUINT64_FROM_LE(image->inodes[index]));
+		falcon_object_set_mtime(object, GUINT64_FROM_LE(image->mtimes[index]));
+		falcon_object_set_ctime(object, GUINT64_FROM_LE(image->ctimes[index]));
+	}
+	falcon_object_set_watch(object, image->watches[index] != 0);
+	func(object, userdata);
+}
+
+/* Appends the component of node to path, the way the trie joins them. */
+static void falcon_image_append(const falcon_image_t *image, GString *path,
+                                const falcon_image_node_t *node)
+{
+	if (path->len && path->str[path->len - 1] != G_DIR_SEPARATOR)
+		g_string_append_c(path, G_DIR_SEPARATOR);
+	g_string_append_len(path, image->names + node->name, node->len);
+}
+
+/* Finds the child of parent named key by binary search over the links. */
+static guint32 falcon_image_child(falcon_image_t *image, guint32 index,
+                                  const falcon_image_node_t *parent,
+                                  const gchar *key, gsize len,
+                                  falcon_image_node_t *node)
+{
+	guint32 low = parent->first;
+	guint32 high = parent->first + parent->children;
+	guint32 middle = 0;
+	guint32 child = 0;
+	gint ret = 0;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		child = GUINT32_FROM_LE(image->links[middle]);
+		if (!falcon_image_node(image, child, node))
+			return IMAGE_NONE;
+		if (node->parent != index) {
+			falcon_image_fail(image);
+			return IMAGE_NONE;
+		}
+
+		ret = falcon_image_compare_key(image->names + node->name, node->len,
+		                               key, len);
+		if (ret == 0)
+			return child;
+		if (ret < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return IMAGE_NONE;
+}
+
+/*
+ * Walks down to name. If func is not NULL, the objects on the way are created.
+ * path gets the name of the node as the trie would build it. Returns the index
+ * of the node, or IMAGE_NONE if it isn't in the image.
+ */
+static guint32 falcon_image_find(falcon_image_t *image, const gchar *name,
+                                 GString *path, falcon_image_node_t *node,
+                                 GFunc func, gpointer userdata)
+{
+	falcon_image_node_t child;
+	const gchar *pos = name;
+	const gchar *start = NULL;
+	const gchar *end = NULL;
+	guint32 index = 0;
+	guint32 next = 0;
+
+	if (!falcon_image_node(image, 0, node))
+		return IMAGE_NONE;
+
+	while ((start = falcon_path_component(name, pos, &end))) {
+		next = falcon_image_child(image, index, node, start, end - start,
+		                          &child);
+		if (next == IMAGE_NONE)
+			return IMAGE_NONE;
+
+		index = next;
+		*node = child;
+		falcon_image_append(image, path, node);
+		if (func)
+			falcon_image_page(image, index, node, path->str, func, userdata);
+		pos = end;
+	}
+
+	return index;
+}
+
+/* Creates the objects in the subtree of index, named path, in pre-order. */
+static void falcon_image_fault_subtree(falcon_image_t *image, guint32 index,
+                                       const falcon_image_node_t *root,
+                                       GString *path, GFunc func,
+                                       gpointer userdata)
+{
+	falcon_image_node_t node;
+	GArray *stack = NULL;
+	GArray *lengths = NULL;
+	gsize len = path->len;
+	guint32 i;
+
+	/* The directories from index down to the parent of the current node. */
+	stack = g_array_new(FALSE, FALSE, sizeof(guint32));
+	lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+	g_array_append_val(stack, index);
+	g_array_append_val(lengths, len);
+
+	for (i = index + 1; i < root->end; i++) {
+		if (!falcon_image_node(image, i, &node))
+			break;
+		while (stack->len
+		       && g_array_index(stack, guint32, stack->len - 1) != node.parent) {
+			g_array_set_size(stack, stack->len - 1);
+			g_array_set_size(lengths, lengths->len - 1);
+		}
+		if (!stack->len || node.end > root->end) {
+			falcon_image_fail(image);
+			break;
+		}
+
+		g_string_truncate(path, g_array_index(lengths, gsize, lengths->len - 1));
+		falcon_image_append(image, path, &node);
+		falcon_image_page(image, i, &node, path->str, func, userdata);
+
+		len = path->len;
+		g_array_append_val(stack, i);
+		g_array_append_val(lengths, len);
+	}
+
+	g_array_free(lengths, TRUE);
+	g_array_free(stack, TRUE);
+}
+
+void falcon_image_fault(falcon_image_t *image, const gchar *name,
+                        falcon_image_scope_t scope, GFunc func,
+                        gpointer userdata)
+{
+	falcon_image_node_t node;
+	falcon_image_node_t child;
+	GString *path = NULL;
+	guint32 index = 0;
+	gsize len = 0;
+	guint32 i;
+
+	g_return_if_fail(image);
+	g_return_if_fail(func);
+
+	if (image->failed || !image->pending)
+		return;
+
+	path = g_string_new(NULL);
+	if (name) {
+		index = falcon_image_find(image, name, path, &node, func, userdata);
+	} else {
+		scope = IMAGE_SUBTREE;
+		falcon_image_node(image, 0, &node);
+	}
+
+	if (index == IMAGE_NONE || image->failed) {
+		g_string_free(path, TRUE);
+		return;
+	}
+
+	if (scope == IMAGE_CHILDREN) {
+		len = path->len;
+		for (i = node.first; i < node.first + node.children; i++) {
+			if (!falcon_image_node(image, GUINT32_FROM_LE(image->links[i]),
+			                       &child))
+				break;
+			g_string_truncate(path, len);
+			falcon_image_append(image, path, &child);
+			falcon_image_page(image, GUINT32_FROM_LE(image->links[i]), &child,
+			                  path->str, func, userdata);
+		}
+	} else if (scope == IMAGE_SUBTREE) {
+		falcon_image_fault_subtree(image, index, &node, path, func, userdata);
+	}
+
+	g_string_free(path, TRUE);
+}
+
+/* Builds the name of node index from its ancestors. */
+static gboolean falcon_image_path(falcon_image_t *image, guint32 index,
+                                  GString *path)
+{
+	falcon_image_node_t node;
+	GArray *ancestors = NULL;
+	gboolean ret = TRUE;
+	guint i;
+
+	ancestors = g_array_new(FALSE, FALSE, sizeof(guint32));
+	for (; index; index = node.parent) {
+		if (!falcon_image_node(image, index, &node)) {
+			ret = FALSE;
+			break;
+		}
+		g_array_append_val(ancestors, index);
+	}
+
+	g_string_truncate(path, 0);
+	for (i = ancestors->len; ret && i > 0; i--) {
+		falcon_image_node(image, g_array_index(ancestors, guint32, i - 1),
+		                  &node);
+		falcon_image_append(image, path, &node);
+	}
+	g_array_free(ancestors, TRUE);
+
+	return ret;
+}
+
+void falcon_image_fault_top(falcon_image_t *image, GFunc func,
+                            gpointer userdata)
+{
+	falcon_image_node_t node;
+	GString *path = NULL;
+	guint32 i = 1;
+
+	g_return_if_fail(image);
+	g_return_if_fail(func);
+
+	path = g_string_new(NULL);
+	while (!image->failed && image->pending && i < image->count) {
+		if (!falcon_image_node(image, i, &node))
+			break;
+		if (!(node.flags & NODE_OBJECT)) {
+			i++;
+			continue;
+		}
+
+		/* Anything below is not topmost, whether it was created or not. */
+		if (!falcon_image_loaded(image, i) && falcon_image_path(image, i, path))
+			falcon_image_page(image, i, &node, path->str, func, userdata);
+		i = node.end;
+	}
+	g_string_free(path, TRUE);
+}
+
+void falcon_image_discard(falcon_image_t *image, const gchar *name)
+{
+	falcon_image_node_t node;
+	falcon_image_node_t root;
+	GString *path = NULL;
+	guint32 index = 0;
+	guint32 i;
+
+	g_return_if_fail(image);
+	g_return_if_fail(name);
+
+	if (image->failed || !image->pending)
+		return;
+
+	path = g_string_new(NULL);
+	index = falcon_image_find(image, name, path, &root, NULL, NULL);
+	g_string_free(path, TRUE);
+	if (index == IMAGE_NONE)
+		return;
+
+	for (i = index; i < root.end; i++) {
+		if (!falcon_image_node(image, i, &node))
+			break;
+		falcon_image_take(image, i, &node);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <glib.h>
+
+#include "include/falcon.h"
+
+/*
+ * A cache file laid out to be mapped into memory instead of read. It holds the
+ * directory tree as an array of nodes in pre-order, so a subtree is a range of
+ * it, the children of each node sorted by name for binary search, and the
+ * object attributes in fixed-width columns. Opening it only checks the header,
+ * objects are created when their part of the tree is first asked for.
+ *
+ * An image is not locked, the cache serializes the calls.
+ */
+typedef struct falcon_image_st falcon_image_t;
+
+typedef enum {
+	IMAGE_PATH,					/* The object and its ancestors */
+	IMAGE_CHILDREN,				/* Same, and its direct children */
+	IMAGE_SUBTREE				/* Same, and all its descendants */
+} falcon_image_scope_t;
+
+/* Returns TRUE if name starts like an image, without checking the rest. */
+gboolean falcon_image_probe(const gchar *name);
+/* Writes the objects of the snapshot to name, through a temporary file. */
+gboolean falcon_image_save(const falcon_snapshot_t *snapshot,
+                           const gchar *name);
+falcon_image_t *falcon_image_open(const gchar *name);
+void falcon_image_free(falcon_image_t *image);
+/* Number of objects in the image that have not been created or discarded. */
+guint64 falcon_image_pending(const falcon_image_t *image);
+/*
+ * Creates the objects of scope around name, or of the whole image if name is
+ * NULL, that were not created before, and hands each to func, which takes the
+ * ownership. Parents come before their children.
+ */
+void falcon_image_fault(falcon_image_t *image, const gchar *name,
+                        falcon_image_scope_t scope, GFunc func,
+                        gpointer userdata);
+/*
+ * Creates the topmost objects, those without an object above them, without
+ * going into their subtrees.
+ */
+void falcon_image_fault_top(falcon_image_t *image, GFunc func,
+                            gpointer userdata);
+/* Forgets name and its descendants, they will never be created. */
+void falcon_image_discard(falcon_image_t *image, const gchar *name);
+
+#endif
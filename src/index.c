@@ -0,0 +1,160 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+
+#include "index.h"
+
+struct falcon_index_st {
+	falcon_index_type_t type;
+	GSequence *entries;
+};
+
+/*
+ * The value and the name are copied out of the object so that comparisons
+ * don't have to chase the object pointer. Both are stable because cached
+ * objects are never modified.
+ */
+typedef struct {
+	guint64 value;
+	const gchar *name;
+	falcon_object_t *object;
+} falcon_index_entry_t;
+
+static void falcon_index_entry_free(gpointer data)
+{
+	falcon_index_entry_t *entry = (falcon_index_entry_t *)data;
+
+	if (entry->object)
+		falcon_object_unref(entry->object);
+	g_free(entry);
+}
+
+static gint falcon_index_compare(gconstpointer a, gconstpointer b,
+                                 gpointer userdata ATTRIBUTE_UNUSED)
+{
+	const falcon_index_entry_t *entry_a = (const falcon_index_entry_t *)a;
+	const falcon_index_entry_t *entry_b = (const falcon_index_entry_t *)b;
+
+	if (entry_a->value < entry_b->value)
+		return -1;
+	if (entry_a->value > entry_b->value)
+		return 1;
+	return g_strcmp0(entry_a->name, entry_b->name);
+}
+
+falcon_index_t *falcon_index_new(falcon_index_type_t type)
+{
+	falcon_index_t *index = NULL;
+
+	g_return_val_if_fail(type == INDEX_TIME || type == INDEX_SIZE, NULL);
+
+	index = g_new0(falcon_index_t, 1);
+	index->type = type;
+	index->entries = g_sequence_new(falcon_index_entry_free);
+
+	return index;
+}
+
+void falcon_index_free(falcon_index_t *index)
+{
+	g_return_if_fail(index);
+
+	g_sequence_free(index->entries);
+	g_free(index);
+}
+
+guint64 falcon_index_value(const falcon_index_t *index,
+                           const falcon_object_t *object)
+{
+	g_return_val_if_fail(index, 0);
+
+	if (index->type == INDEX_TIME)
+		return falcon_object_get_time(object);
+	return falcon_object_get_size(object);
+}
+
+void falcon_index_add(falcon_index_t *index, falcon_object_t *object)
+{
+	falcon_index_entry_t *entry = NULL;
+
+	g_return_if_fail(index);
+	g_return_if_fail(object);
+
+	entry = g_new0(falcon_index_entry_t, 1);
+	entry->value = falcon_index_value(index, object);
+	entry->name = falcon_object_get_name(object);
+	entry->object = falcon_object_ref(object);
+
+	g_sequence_insert_sorted(index->entries, entry, falcon_index_compare,
+	                         NULL);
+}
+
+void falcon_index_remove(falcon_index_t *index, const falcon_object_t *object)
+{
+	falcon_index_entry_t key;
+	GSequenceIter *iter = NULL;
+
+	g_return_if_fail(index);
+	g_return_if_fail(object);
+
+	key.value = falcon_index_value(index, object);
+	key.name = falcon_object_get_name(object);
+	key.object = NULL;
+
+	/* The search ends right after the entry that compares equal. */
+	iter = g_sequence_search(index->entries, &key, falcon_index_compare, NULL);
+	if (g_sequence_iter_is_begin(iter))
+		return;
+
+	iter = g_sequence_iter_prev(iter);
+	if (falcon_index_compare(g_sequence_get(iter), &key, NULL) == 0)
+		g_sequence_remove(iter);
+}
+
+falcon_object_t *falcon_index_next(falcon_index_t *index, guint64 value,
+                                   const gchar *name)
+{
+	falcon_index_entry_t key;
+	GSequenceIter *iter = NULL;
+
+	g_return_val_if_fail(index, NULL);
+
+	key.value = value;
+	key.name = name;
+	key.object = NULL;
+
+	iter = g_sequence_search(index->entries, &key, falcon_index_compare, NULL);
+	if (g_sequence_iter_is_end(iter))
+		return NULL;
+
+	return ((falcon_index_entry_t *)g_sequence_get(iter))->object;
+}
+
+guint falcon_index_length(falcon_index_t *index)
+{
+	g_return_val_if_fail(index, 0);
+
+	return g_sequence_get_length(index->entries);
+}
@@ -0,0 +1,57 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "object.h"
+
+/*
+ * A secondary index of the cache, ordered by an attribute of the objects, then
+ * by name. The index holds a reference to each indexed object. It is not
+ * thread-safe, the cache lock protects it.
+ */
+typedef struct falcon_index_st falcon_index_t;
+
+falcon_index_t *falcon_index_new(falcon_index_type_t type);
+void falcon_index_free(falcon_index_t *index);
+
+void falcon_index_add(falcon_index_t *index, falcon_object_t *object);
+void falcon_index_remove(falcon_index_t *index, const falcon_object_t *object);
+/*
+ * Gets the first object that comes after the given value and name. If name is
+ * NULL, the first object with a value not less than the given one is returned.
+ * No reference is taken.
+ */
+falcon_object_t *falcon_index_next(falcon_index_t *index, guint64 value,
+                                   const gchar *name);
+/* The value of object the index is ordered by. */
+guint64 falcon_index_value(const falcon_index_t *index,
+                           const falcon_object_t *object);
+guint falcon_index_length(falcon_index_t *index);
+
+#endif
@@ -0,0 +1,797 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "journal.h"
+#include "crc32c.h"
+#include "object.h"
+#include "shard.h"
+
+/*
+ * Journal file format, integers are big-endian:
+ *
+ * 4 bytes magic "FLCJ", 2 bytes version, 2 bytes flags (none yet), then the
+ * batches, each one:
+ *   4 bytes length of the records
+ *   4 bytes CRC-32C of the records
+ *   records
+ *
+ * A record is 1 byte type, varint name length and the name, followed by varint
+ * size, varint time, varint mode and 1 byte watch for JOURNAL_ADD, the same and
+ * varint device, inode, mtime and ctime for JOURNAL_ADD_STAT, or 1 byte watch
+ * for JOURNAL_SET_WATCH. JOURNAL_CLEAR has an empty name. JOURNAL_ADD is only
+ * read, from journals written before the inodes were kept.
+ *
+ * Records only hold the new state, never the difference to the old one, so
+ * replaying a journal on top of a cache file written after some of it is
+ * harmless. A crash can only leave the last batch incomplete, replay stops at
+ * the first bad one and the file is cut there.
+ */
+#define JOURNAL_MAGIC "FLCJ"
+#define JOURNAL_VERSION 1
+/* No flags are defined yet. */
+#define JOURNAL_FLAGS 0
+#define JOURNAL_HEADER 8
+#define JOURNAL_BATCH_HEADER 8
+#define JOURNAL_BATCH (64 * 1024)	/* Records that wake the writer up */
+#define JOURNAL_INTERVAL 1			/* Seconds between writes */
+#define JOURNAL_COMPACT (16 * 1024 * 1024)	/* Smallest size to compact at */
+
+typedef enum {
+	JOURNAL_ADD = 1,
+	JOURNAL_DELETE,
+	JOURNAL_SET_WATCH,
+	JOURNAL_CLEAR,
+	JOURNAL_ADD_STAT
+} falcon_journal_type_t;
+
+typedef struct {
+	GMutex *lock;
+	GCond *cond;
+	GThread *writer;
+	falcon_cache_t *cache;
+	gchar *name;				/* The cache file */
+	gchar *path;				/* The journal file */
+	int fd;						/* -1 after a failed write */
+	GString *records;			/* Not handed to the writer yet */
+	guint64 recorded;			/* Bytes ever recorded */
+	guint64 written;			/* Bytes of those on disk */
+	guint waiting;				/* Threads in falcon_journal_sync() */
+	gboolean running;
+	guint interval;				/* Seconds between checkpoints, 0 for none */
+	guint64 changes;			/* Records that make a checkpoint, 0 for none */
+	guint64 changed;			/* Records not in the cache file yet */
+	falcon_checkpoint_stats_t stats;
+	falcon_queue_func queue_func;
+	/* Only used by the writer once it is started. */
+	guint64 size;
+	guint64 limit;				/* Size to compact at */
+	glong checkpoint;			/* Time of the last checkpoint */
+} falcon_journal_context_t;
+
+static falcon_journal_context_t context;
+
+/* A cache file being written while the writer goes on. */
+typedef struct {
+	falcon_save_t *save;
+	falcon_queue_t *queue;
+	guint64 changed;			/* Records that went into it */
+	guint64 stall;				/* Changes were held up while it was taken */
+	guint64 covered;			/* Bytes of the journal it holds */
+	gboolean saved;
+	gboolean done;
+} falcon_journal_checkpoint_t;
+
+/* Starts a record, returns where it starts for falcon_journal_end(). */
+static gsize falcon_journal_begin(falcon_journal_type_t type,
+                                  const gchar *name)
+{
+	gsize start = context.records->len;
+	gsize len = name ? strlen(name) : 0;
+
+	g_string_append_c(context.records, type);
+	falcon_varint_put(context.records, len);
+	g_string_append_len(context.records, name, len);
+
+	return start;
+}
+
+static void falcon_journal_end(gsize start)
+{
+	context.recorded += context.records->len - start;
+	context.changed++;
+	if (context.records->len >= JOURNAL_BATCH)
+		g_cond_broadcast(context.cond);
+}
+
+/* Applies the records of a batch, returns FALSE if they are malformed. */
+static gboolean falcon_journal_apply(falcon_cache_t *cache, const guint8 *pos,
+                                     const guint8 *end)
+{
+	falcon_object_t *object = NULL;
+	gchar *name = NULL;
+	guint64 len = 0;
+	guint64 size = 0;
+	guint64 time = 0;
+	guint64 mode = 0;
+	guint64 stat[4] = { 0, 0, 0, 0 };	/* Device, inode, mtime and ctime */
+	guint8 type = 0;
+
+	while (pos < end) {
+		type = *pos++;
+		if (!falcon_varint_get(&pos, end, &len)
+		    || len > (guint64)(end - pos) || memchr(pos, '\0', len))
+			return FALSE;
+		name = g_strndup((const gchar *)pos, len);
+		pos += len;
+
+		if (type == JOURNAL_ADD || type == JOURNAL_ADD_STAT) {
+			if (!len || !falcon_varint_get(&pos, end, &size)
+			    || !falcon_varint_get(&pos, end, &time)
+			    || !falcon_varint_get(&pos, end, &mode)
+			    || mode > G_MAXUINT32 || pos == end) {
+				g_free(name);
+				return FALSE;
+			}
+			object = falcon_object_new_steal(name);
+			falcon_object_set_size(object, size);
+			falcon_object_set_time(object, time);
+			falcon_object_set_mode(object, mode);
+			falcon_object_set_watch(object, *pos++);
+			if (type == JOURNAL_ADD_STAT
+			    && (!falcon_varint_get(&pos, end, &stat[0])
+			        || !falcon_varint_get(&pos, end, &stat[1])
+			        || !falcon_varint_get(&pos, end, &stat[2])
+			        || !falcon_varint_get(&pos, end, &stat[3]))) {
+				falcon_object_unref(object);
+				return FALSE;
+			}
+			falcon_object_set_inode(object, stat[0], stat[1]);
+			falcon_object_set_mtime(object, stat[2]);
+			falcon_object_set_ctime(object, stat[3]);
+			falcon_cache_add_steal(cache, object);
+		} else if (type == JOURNAL_DELETE && len) {
+			falcon_cache_delete(cache, name);
+			g_free(name);
+		} else if (type == JOURNAL_SET_WATCH && len && pos < end) {
+			falcon_cache_set_watch(cache, name, *pos++);
+			g_free(name);
+		} else if (type == JOURNAL_CLEAR && !len) {
+			falcon_cache_clear(cache);
+			g_free(name);
+		} else {
+			g_free(name);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Replays the journal at path, if there is one, and stores the length of its
+ * valid part in valid, 0 if it has to be started over.
+ */
+static gboolean falcon_journal_replay(falcon_cache_t *cache, const gchar *path,
+                                      gsize *valid)
+{
+	gchar *data = NULL;
+	const guint8 *pos = NULL;
+	const guint8 *end = NULL;
+	gsize len = 0;
+	guint32 length = 0;
+	guint32 crc = 0;
+	guint16 version = 0;
+	guint16 flags = 0;
+	guint batches = 0;
+	GError *error = NULL;
+
+	*valid = 0;
+	if (!g_file_test(path, G_FILE_TEST_EXISTS))
+		return TRUE;
+	if (!g_file_get_contents(path, &data, &len, &error)) {
+		g_critical(_("Failed to read cache journal %s: %s"), path,
+		           error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	if (len >= JOURNAL_HEADER) {
+		memcpy(&version, data + 4, 2);
+		memcpy(&flags, data + 6, 2);
+	}
+	if (len < JOURNAL_HEADER || memcmp(data, JOURNAL_MAGIC, 4) != 0
+	    || GUINT16_FROM_BE(version) != JOURNAL_VERSION
+	    || (GUINT16_FROM_BE(flags) & ~JOURNAL_FLAGS)) {
+		g_warning(_("%s is not a cache journal, starting a new one."), path);
+		g_free(data);
+		return TRUE;
+	}
+
+	pos = (const guint8 *)data + JOURNAL_HEADER;
+	end = (const guint8 *)data + len;
+	while ((gsize)(end - pos) >= JOURNAL_BATCH_HEADER) {
+		memcpy(&length, pos, 4);
+		memcpy(&crc, pos + 4, 4);
+		length = GUINT32_FROM_BE(length);
+		if (length > (gsize)(end - pos) - JOURNAL_BATCH_HEADER
+		    || falcon_crc32c(0, pos + JOURNAL_BATCH_HEADER, length)
+		       != GUINT32_FROM_BE(crc))
+			break;
+		if (!falcon_journal_apply(cache, pos + JOURNAL_BATCH_HEADER,
+		                          pos + JOURNAL_BATCH_HEADER + length)) {
+			g_warning(_("Cache journal %s is corrupted."), path);
+			break;
+		}
+		pos += JOURNAL_BATCH_HEADER + length;
+		batches++;
+	}
+	if (pos != end)
+		g_warning(_("Discarding the last %lu bytes of cache journal %s."),
+		          (gulong)(end - pos), path);
+	g_debug(_("Replayed %u batches from cache journal %s."), batches, path);
+
+	*valid = pos - (const guint8 *)data;
+	g_free(data);
+
+	return TRUE;
+}
+
+/* Writes records as one batch. A failed write stops the journal for good. */
+static void falcon_journal_write(const GString *records)
+{
+	gchar header[JOURNAL_BATCH_HEADER];
+	guint32 value = 0;
+
+	if (context.fd == -1)
+		return;
+
+	value = GUINT32_TO_BE(records->len);
+	memcpy(header, &value, 4);
+	value = GUINT32_TO_BE(falcon_crc32c(0, records->str, records->len));
+	memcpy(header + 4, &value, 4);
+	if (falcon_write_all(context.fd, header, JOURNAL_BATCH_HEADER)
+	    && falcon_write_all(context.fd, records->str, records->len)
+	    && fdatasync(context.fd) == 0) {
+		context.size += JOURNAL_BATCH_HEADER + records->len;
+		return;
+	}
+
+	g_critical(_("Failed to write to cache journal %s: %s"), context.path,
+	           g_strerror(errno));
+	close(context.fd);
+	context.fd = -1;
+}
+
+static void falcon_journal_header(gchar *header)
+{
+	guint16 value = GUINT16_TO_BE(JOURNAL_VERSION);
+
+	memcpy(header, JOURNAL_MAGIC, 4);
+	memcpy(header + 4, &value, 2);
+	value = GUINT16_TO_BE(JOURNAL_FLAGS);
+	memcpy(header + 6, &value, 2);
+}
+
+static void falcon_journal_set_limit(void)
+{
+	context.limit = MAX(JOURNAL_COMPACT, falcon_shard_size(context.name));
+}
+
+/*
+ * Whether the cache file has to be written along with len bytes of records.
+ * The caller must lock the journal.
+ */
+static gboolean falcon_journal_due(gsize len)
+{
+	GTimeVal now;
+
+	if (len && context.size + len > context.limit)
+		return TRUE;
+	if (context.changes && context.changed >= context.changes)
+		return TRUE;
+	if (!context.interval)
+		return FALSE;
+
+	g_get_current_time(&now);
+	if (now.tv_sec - context.checkpoint < (glong)context.interval)
+		return FALSE;
+	if (context.changed)
+		return TRUE;
+	context.stats.skipped++;
+	context.checkpoint = now.tv_sec;
+
+	return FALSE;
+}
+
+/*
+ * Writes the cache file from what was taken right after the journal was last
+ * written, and the queue of the walkers if any. It runs on a thread of its own
+ * so that the writer keeps writing batches meanwhile, and the journal is only
+ * cut once it is done, see falcon_journal_finish().
+ */
+static gpointer falcon_journal_compact(gpointer data)
+{
+	falcon_journal_checkpoint_t *checkpoint = data;
+	GTimer *timer = g_timer_new();
+	guint64 bytes = 0;
+	gboolean ret = FALSE;
+
+	g_message(_("Compacting cache journal %s."), context.path);
+
+	ret = falcon_cache_save_finish(checkpoint->save, &bytes);
+	if (ret && checkpoint->queue)
+		falcon_queue_save(checkpoint->queue, context.name);
+	falcon_queue_free(checkpoint->queue);
+
+	g_mutex_lock(context.lock);
+	if (ret) {
+		context.stats.checkpoints++;
+		context.stats.last_duration = g_timer_elapsed(timer, NULL)
+		                              * G_USEC_PER_SEC;
+		context.stats.last_bytes = bytes;
+		context.stats.last_stall = checkpoint->stall;
+		context.stats.duration += context.stats.last_duration;
+		context.stats.bytes += bytes;
+		context.stats.stall += checkpoint->stall;
+	} else {
+		context.stats.failed++;
+		context.changed += checkpoint->changed;
+	}
+	checkpoint->saved = ret;
+	checkpoint->done = TRUE;
+	g_cond_broadcast(context.cond);
+	g_mutex_unlock(context.lock);
+
+	g_timer_destroy(timer);
+
+	return NULL;
+}
+
+/*
+ * Drops the first covered bytes of the journal, which the cache file now
+ * holds. The batches written after them are copied to a new journal that
+ * replaces this one, so a crash leaves one of the two whole.
+ */
+static void falcon_journal_cut(guint64 covered)
+{
+	gchar header[JOURNAL_HEADER];
+	gchar *tail = NULL;
+	gchar *temp = NULL;
+	gsize len = context.size - covered;
+	gboolean ret = FALSE;
+	int fd = -1;
+
+	if (!len) {
+		ret = ftruncate(context.fd, JOURNAL_HEADER) == 0
+		      && fdatasync(context.fd) == 0;
+	} else {
+		tail = g_malloc(len);
+		fd = g_open(context.path, O_RDONLY, 0);
+		ret = fd != -1 && pread(fd, tail, len, covered) == (gssize)len;
+		if (fd != -1)
+			close(fd);
+		if (ret) {
+			falcon_journal_header(header);
+			fd = falcon_temp_open(context.path, &temp);
+			ret = fd != -1
+			      && falcon_temp_commit(fd, temp, context.path,
+			                            falcon_write_all(fd, header,
+			                                             JOURNAL_HEADER)
+			                            && falcon_write_all(fd, tail, len));
+			g_free(temp);
+		}
+		g_free(tail);
+
+		/* The old journal is gone, go on with the new one. */
+		if (ret) {
+			close(context.fd);
+			context.fd = g_open(context.path, O_WRONLY | O_APPEND, 0);
+			if (context.fd == -1) {
+				g_critical(_("Failed to open cache journal %s: %s"),
+				           context.path, g_strerror(errno));
+				return;
+			}
+		}
+	}
+
+	if (ret) {
+		context.size = JOURNAL_HEADER + len;
+		falcon_journal_set_limit();
+	} else {
+		/* Still correct, the records are replayed again. */
+		g_warning(_("Failed to truncate cache journal %s: %s"), context.path,
+		          g_strerror(errno));
+		context.limit = context.size * 2;
+	}
+}
+
+/* Waits for the checkpoint and cuts what it holds from the journal. */
+static void falcon_journal_finish(GThread *compactor,
+                                  falcon_journal_checkpoint_t *checkpoint)
+{
+	if (compactor)
+		g_thread_join(compactor);
+
+	if (!checkpoint->saved)
+		/* Don't retry on every batch. */
+		context.limit = context.size * 2;
+	else if (context.fd != -1)
+		falcon_journal_cut(checkpoint->covered);
+
+	g_free(checkpoint);
+}
+
+/*
+ * Hands the records over every JOURNAL_INTERVAL seconds, or as soon as
+ * JOURNAL_BATCH of them are waiting or someone waits for them, so concurrent
+ * changes share a single write.
+ */
+static gpointer falcon_journal_run(gpointer data ATTRIBUTE_UNUSED)
+{
+	GString *records = g_string_sized_new(JOURNAL_BATCH);
+	GString *swap = NULL;
+	falcon_journal_checkpoint_t *checkpoint = NULL;
+	falcon_save_t *save = NULL;
+	falcon_queue_t *queue = NULL;
+	falcon_queue_func func = NULL;
+	GThread *compactor = NULL;
+	GError *error = NULL;
+	GTimer *timer = g_timer_new();
+	guint64 recorded = 0;
+	guint64 changed = 0;
+	guint64 stall = 0;
+	gboolean running = TRUE;
+	gboolean due = FALSE;
+	gboolean done = FALSE;
+	GTimeVal deadline;
+	GTimeVal now;
+
+	g_mutex_lock(context.lock);
+	while (running) {
+		g_get_current_time(&deadline);
+		g_time_val_add(&deadline, JOURNAL_INTERVAL * G_USEC_PER_SEC);
+		while (context.running && context.records->len < JOURNAL_BATCH
+		       && !(context.waiting && context.records->len)
+		       && !(checkpoint && checkpoint->done)
+		       && g_cond_timed_wait(context.cond, context.lock, &deadline))
+			;
+
+		running = context.running;
+		done = checkpoint && checkpoint->done;
+		/* One checkpoint at a time. */
+		due = running && !checkpoint
+		      && falcon_journal_due(context.records->len);
+		if (due && context.queue_func) {
+			/* Taken before the state to save, it may only be older. */
+			func = context.queue_func;
+			g_mutex_unlock(context.lock);
+			queue = func();
+			g_mutex_lock(context.lock);
+			running = context.running;
+		}
+		swap = context.records;
+		context.records = records;
+		records = swap;
+		recorded = context.recorded;
+		/*
+		 * The saved state has to match the records written so far, changes
+		 * wait for it to be taken.
+		 */
+		if (running && due) {
+			g_timer_start(timer);
+			save = falcon_cache_save_begin(context.cache, context.name);
+			stall = g_timer_elapsed(timer, NULL) * G_USEC_PER_SEC;
+			changed = context.changed;
+			context.changed = 0;
+			g_get_current_time(&now);
+			context.checkpoint = now.tv_sec;
+		}
+		g_mutex_unlock(context.lock);
+
+		if (records->len)
+			falcon_journal_write(records);
+		g_string_truncate(records, 0);
+		if (done) {
+			falcon_journal_finish(compactor, checkpoint);
+			checkpoint = NULL;
+			compactor = NULL;
+		}
+		if (save) {
+			checkpoint = g_new0(falcon_journal_checkpoint_t, 1);
+			checkpoint->save = save;
+			checkpoint->queue = queue;
+			checkpoint->changed = changed;
+			checkpoint->stall = stall;
+			checkpoint->covered = context.size;
+			compactor = g_thread_create(falcon_journal_compact, checkpoint,
+			                            TRUE, &error);
+			if (!compactor) {
+				g_warning(_("Failed to start the cache journal compactor: %s"),
+				          error->message);
+				g_clear_error(&error);
+				falcon_journal_compact(checkpoint);
+			}
+		} else {
+			falcon_queue_free(queue);
+		}
+		save = NULL;
+		queue = NULL;
+
+		g_mutex_lock(context.lock);
+		context.written = recorded;
+		g_cond_broadcast(context.cond);
+	}
+	g_mutex_unlock(context.lock);
+
+	/* A checkpoint still being written may cut the journal. */
+	if (checkpoint)
+		falcon_journal_finish(compactor, checkpoint);
+
+	g_timer_destroy(timer);
+	g_string_free(records, TRUE);
+
+	return NULL;
+}
+
+gboolean falcon_journal_init(falcon_cache_t *cache, const gchar *name)
+{
+	gchar header[JOURNAL_HEADER];
+	gsize valid = 0;
+	GError *error = NULL;
+	GTimeVal now;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(!context.lock, FALSE);
+	if (!name)
+		return FALSE;
+
+	context.path = g_strconcat(name, ".journal", NULL);
+	if (!falcon_journal_replay(cache, context.path, &valid)) {
+		g_free(context.path);
+		context.path = NULL;
+		return FALSE;
+	}
+
+	context.fd = g_open(context.path, O_WRONLY | O_CREAT | O_APPEND,
+	                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (context.fd == -1) {
+		g_critical(_("Failed to open cache journal %s: %s"), context.path,
+		           g_strerror(errno));
+		g_free(context.path);
+		context.path = NULL;
+		return FALSE;
+	}
+
+	/* Cut what could not be replayed, or start over. */
+	if (ftruncate(context.fd, valid) == -1) {
+		g_critical(_("Failed to truncate cache journal %s: %s"),
+		           context.path, g_strerror(errno));
+		valid = 0;
+	} else if (!valid) {
+		falcon_journal_header(header);
+		if (falcon_write_all(context.fd, header, JOURNAL_HEADER))
+			valid = JOURNAL_HEADER;
+		else
+			g_critical(_("Failed to write to cache journal %s: %s"),
+			           context.path, g_strerror(errno));
+	}
+	if (valid < JOURNAL_HEADER) {
+		close(context.fd);
+		g_free(context.path);
+		context.path = NULL;
+		return FALSE;
+	}
+
+	context.lock = g_mutex_new();
+	context.cond = g_cond_new();
+	context.cache = cache;
+	context.name = g_strdup(name);
+	context.records = g_string_sized_new(JOURNAL_BATCH);
+	context.recorded = 0;
+	context.written = 0;
+	context.waiting = 0;
+	context.running = TRUE;
+	/* What was replayed is not in the cache file yet. */
+	context.changed = valid > JOURNAL_HEADER ? 1 : 0;
+	context.size = valid;
+	falcon_journal_set_limit();
+	g_get_current_time(&now);
+	context.checkpoint = now.tv_sec;
+
+	context.writer = g_thread_create(falcon_journal_run, NULL, TRUE, &error);
+	if (!context.writer) {
+		g_critical(_("Failed to start the cache journal writer: %s"),
+		           error->message);
+		g_error_free(error);
+		context.running = FALSE;
+		falcon_journal_shutdown();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void falcon_journal_shutdown(void)
+{
+	if (!context.lock)
+		return;
+
+	if (context.writer) {
+		g_mutex_lock(context.lock);
+		context.running = FALSE;
+		g_cond_broadcast(context.cond);
+		g_mutex_unlock(context.lock);
+		g_thread_join(context.writer);
+	}
+
+	if (context.fd != -1)
+		close(context.fd);
+	g_string_free(context.records, TRUE);
+	g_free(context.name);
+	g_free(context.path);
+	g_cond_free(context.cond);
+	g_mutex_free(context.lock);
+	memset(&context, 0, sizeof(context));
+}
+
+void falcon_journal_remove(const gchar *name)
+{
+	gchar *path = NULL;
+
+	g_return_if_fail(!context.lock);
+	if (!name)
+		return;
+
+	path = g_strconcat(name, ".journal", NULL);
+	if (g_unlink(path) == -1 && errno != ENOENT)
+		g_warning(_("Failed to delete cache journal %s: %s"), path,
+		          g_strerror(errno));
+	g_free(path);
+}
+
+void falcon_journal_sync(void)
+{
+	guint64 target = 0;
+
+	if (!context.lock)
+		return;
+
+	g_mutex_lock(context.lock);
+	target = context.recorded;
+	context.waiting++;
+	g_cond_broadcast(context.cond);
+	while (context.written < target)
+		g_cond_wait(context.cond, context.lock);
+	context.waiting--;
+	g_mutex_unlock(context.lock);
+}
+
+gboolean falcon_journal_set_checkpoint(guint interval, guint64 changes)
+{
+	if (!context.lock)
+		return FALSE;
+
+	g_mutex_lock(context.lock);
+	context.interval = interval;
+	context.changes = changes;
+	g_mutex_unlock(context.lock);
+
+	return TRUE;
+}
+
+void falcon_journal_set_queue(falcon_queue_func func)
+{
+	if (!context.lock)
+		return;
+
+	g_mutex_lock(context.lock);
+	context.queue_func = func;
+	g_mutex_unlock(context.lock);
+}
+
+gboolean falcon_journal_get_stats(falcon_checkpoint_stats_t *stats)
+{
+	g_return_val_if_fail(stats, FALSE);
+
+	if (!context.lock)
+		return FALSE;
+
+	g_mutex_lock(context.lock);
+	*stats = context.stats;
+	g_mutex_unlock(context.lock);
+
+	return TRUE;
+}
+
+void falcon_journal_lock(void)
+{
+	if (context.lock)
+		g_mutex_lock(context.lock);
+}
+
+void falcon_journal_unlock(void)
+{
+	if (context.lock)
+		g_mutex_unlock(context.lock);
+}
+
+void falcon_journal_add(const falcon_object_t *object)
+{
+	gsize start = 0;
+
+	g_return_if_fail(object);
+	if (!context.records)
+		return;
+
+	start = falcon_journal_begin(JOURNAL_ADD_STAT,
+	                             falcon_object_get_name(object));
+	falcon_varint_put(context.records, falcon_object_get_size(object));
+	falcon_varint_put(context.records, falcon_object_get_time(object));
+	falcon_varint_put(context.records, falcon_object_get_mode(object));
+	g_string_append_c(context.records,
+	                  falcon_object_get_watch(object) ? 1 : 0);
+	falcon_varint_put(context.records, falcon_object_get_dev(object));
+	falcon_varint_put(context.records, falcon_object_get_ino(object));
+	falcon_varint_put(context.records, falcon_object_get_mtime(object));
+	falcon_varint_put(context.records, falcon_object_get_ctime(object));
+	falcon_journal_end(start);
+}
+
+void falcon_journal_delete(const gchar *name)
+{
+	g_return_if_fail(name);
+	if (!context.records)
+		return;
+
+	falcon_journal_end(falcon_journal_begin(JOURNAL_DELETE, name));
+}
+
+void falcon_journal_set_watch(const gchar *name, gboolean watch)
+{
+	gsize start = 0;
+
+	g_return_if_fail(name);
+	if (!context.records)
+		return;
+
+	start = falcon_journal_begin(JOURNAL_SET_WATCH, name);
+	g_string_append_c(context.records, watch ? 1 : 0);
+	falcon_journal_end(start);
+}
+
+void falcon_journal_clear(void)
+{
+	if (!context.records)
+		return;
+
+	falcon_journal_end(falcon_journal_begin(JOURNAL_CLEAR, NULL));
+}
@@ -0,0 +1,80 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "cache.h"
+#include "queue.h"
+
+/*
+ * An append-only log of the changes made to the cache since its file was last
+ * written, kept next to it in name.journal. Records are buffered and written
+ * in batches by a background thread, which also folds the journal into a new
+ * cache file once it grows past the size of the last one, or at the
+ * checkpoints set with falcon_journal_set_checkpoint(). The cache file is
+ * written on another thread, batches keep being written meanwhile.
+ *
+ * Changes must be made with the journal locked and recorded before unlocking,
+ * so the records are in the same order as the changes. When the journal is not
+ * open, the functions do nothing.
+ */
+
+/*
+ * Replays name.journal on top of the cache, loaded from name, and opens it for
+ * the changes to come. Does nothing if name is NULL.
+ */
+gboolean falcon_journal_init(falcon_cache_t *cache, const gchar *name);
+/* Writes what is left and closes the journal. */
+void falcon_journal_shutdown(void);
+/* Deletes the journal of name, after the whole cache has been written to it. */
+void falcon_journal_remove(const gchar *name);
+/* Returns after everything recorded so far is on disk. */
+void falcon_journal_sync(void);
+/*
+ * Also writes the cache file every interval seconds, or once changes records
+ * were made since it was last written, unless there were none. 0 disables
+ * either. Returns FALSE if the journal is not open.
+ */
+gboolean falcon_journal_set_checkpoint(guint interval, guint64 changes);
+/* Returns FALSE if the journal is not open. */
+gboolean falcon_journal_get_stats(falcon_checkpoint_stats_t *stats);
+/*
+ * Sets where the queue written along with each checkpoint comes from. func is
+ * called without the journal locked.
+ */
+void falcon_journal_set_queue(falcon_queue_func func);
+
+void falcon_journal_lock(void);
+void falcon_journal_unlock(void);
+/* The journal must be locked to record. */
+void falcon_journal_add(const falcon_object_t *object);
+void falcon_journal_delete(const gchar *name);
+void falcon_journal_set_watch(const gchar *name, gboolean watch);
+void falcon_journal_clear(void);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+/* Matches are searched through a table of the last position of each hash. */
+#define LZ_HASH_BITS 13
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MAX_LITERALS 32
+#define LZ_MAX_OFFSET (1 << 13)
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH - 1 + 7 + 255)
+
+static guint lz_hash(const guint8 *p)
+{
+	guint32 v = (p[0] << 16) | (p[1] << 8) | p[2];
+
+	return ((v * 2654435761U) >> (32 - LZ_HASH_BITS)) & (LZ_HASH_SIZE - 1);
+}
+
+/* Writes len literals in runs. Returns the new end of out, or NULL if full. */
+static guint8 *lz_literals(const guint8 *in, gsize len, guint8 *out,
+                           const guint8 *end)
+{
+	gsize run = 0;
+
+	while (len) {
+		run = MIN(len, LZ_MAX_LITERALS);
+		if ((gsize)(end - out) < run + 1)
+			return NULL;
+		*out++ = run - 1;
+		memcpy(out, in, run);
+		out += run;
+		in += run;
+		len -= run;
+	}
+
+	return out;
+}
+
+gsize falcon_lz_compress(const guint8 *in, gsize len, guint8 *out,
+                         gsize out_len)
+{
+	guint32 table[LZ_HASH_SIZE];
+	const guint8 *end = out + out_len;
+	guint8 *cur = out;
+	gsize anchor = 0;
+	gsize offset = 0;
+	gsize match = 0;
+	gsize limit = 0;
+	gsize ref = 0;
+	gsize i = 0;
+	guint h = 0;
+
+	g_return_val_if_fail(in || !len, 0);
+	g_return_val_if_fail(out, 0);
+
+	/* Positions are stored plus one, 0 is an empty slot. */
+	memset(table, 0, sizeof(table));
+	while (i + LZ_MIN_MATCH <= len) {
+		h = lz_hash(in + i);
+		ref = table[h];
+		table[h] = i + 1;
+		if (!ref || i - (ref - 1) > LZ_MAX_OFFSET
+		    || memcmp(in + ref - 1, in + i, LZ_MIN_MATCH) != 0) {
+			i++;
+			continue;
+		}
+
+		ref--;
+		limit = MIN(len - i, LZ_MAX_MATCH);
+		match = LZ_MIN_MATCH;
+		while (match < limit && in[ref + match] == in[i + match])
+			match++;
+
+		if (!(cur = lz_literals(in + anchor, i - anchor, cur, end))
+		    || end - cur < 3)
+			return 0;
+		offset = i - ref - 1;
+		if (match - 2 < 7) {
+			*cur++ = ((match - 2) << 5) | (offset >> 8);
+		} else {
+			*cur++ = (7 << 5) | (offset >> 8);
+			*cur++ = match - 2 - 7;
+		}
+		*cur++ = offset & 0xff;
+
+		i += match;
+		anchor = i;
+	}
+
+	if (!(cur = lz_literals(in + anchor, len - anchor, cur, end)))
+		return 0;
+
+	return cur - out;
+}
+
+gsize falcon_lz_decompress(const guint8 *in, gsize len, guint8 *out,
+                           gsize out_len)
+{
+	const guint8 *in_end = in + len;
+	guint8 *cur = out;
+	gsize count = 0;
+	gsize offset = 0;
+	guint ctrl = 0;
+
+	g_return_val_if_fail(in || !len, 0);
+	g_return_val_if_fail(out, 0);
+
+	while (in < in_end) {
+		ctrl = *in++;
+		if (ctrl < LZ_MAX_LITERALS) {
+			count = ctrl + 1;
+			if ((gsize)(in_end - in) < count
+			    || (gsize)(out + out_len - cur) < count)
+				return 0;
+			memcpy(cur, in, count);
+			cur += count;
+			in += count;
+			continue;
+		}
+
+		count = ctrl >> 5;
+		if (count == 7) {
+			if (in == in_end)
+				return 0;
+			count += *in++;
+		}
+		count += 2;
+		if (in == in_end)
+			return 0;
+		offset = ((ctrl & 0x1f) << 8) + *in++ + 1;
+		if (offset > (gsize)(cur - out)
+		    || (gsize)(out + out_len - cur) < count)
+			return 0;
+
+		/* The match may overlap what it produces, copy byte by byte. */
+		for (; count; count--, cur++)
+			*cur = *(cur - offset);
+	}
+
+	return cur - out;
+}
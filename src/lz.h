@@ -0,0 +1,50 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <glib.h>
+
+/*
+ * A small LZ77 codec in the LZF format: a control byte below 32 is followed by
+ * that many literal bytes plus one, any other one holds the length and the high
+ * bits of the offset of a match in the last 8KB. It is fast rather than tight,
+ * the cache file repeats itself enough for that.
+ */
+
+/*
+ * Compresses len bytes of in into out. Returns the compressed length, or 0 if
+ * it would not fit in out_len bytes.
+ */
+gsize falcon_lz_compress(const guint8 *in, gsize len, guint8 *out,
+                         gsize out_len);
+/*
+ * Decompresses len bytes of in into out. Returns the decompressed length, or 0
+ * if in is malformed or doesn't fit in out_len bytes.
+ */
+gsize falcon_lz_decompress(const guint8 *in, gsize len, guint8 *out,
+                           gsize out_len);
+
+#endif
@@ -23,32 +23,59 @@
  */
 
 #include <sys/stat.h>
-#include <unistd.h>
-#include <errno.h>
+#include <string.h>
 #include <glib.h>
 
 #include "object.h"
 
+/* Longest name written to the cache file. */
+#define OBJECT_NAME_MAX G_MAXUINT16
+
 struct falcon_object_st {
 	gchar *name;
 	guint64 size;
 	guint64 time;
+	guint64 dev;
+	guint64 ino;
+	guint64 mtime;				/* In nanoseconds, as ctime */
+	guint64 ctime;
 	guint32 mode;
 	gboolean watch;
+	volatile gint ref_count;
 };
 
 falcon_object_t *falcon_object_new(const gchar *name)
 {
 	falcon_object_t *object = g_new0(falcon_object_t, 1);
 	object->name = g_strdup(name);
+	object->ref_count = 1;
 	return object;
 }
 
-void falcon_object_free(falcon_object_t *object)
+falcon_object_t *falcon_object_new_steal(gchar *name)
+{
+	falcon_object_t *object = g_new0(falcon_object_t, 1);
+	object->name = name;
+	object->ref_count = 1;
+	return object;
+}
+
+falcon_object_t *falcon_object_ref(falcon_object_t *object)
+{
+	g_return_val_if_fail(object, NULL);
+
+	g_atomic_int_inc(&object->ref_count);
+	return object;
+}
+
+void falcon_object_unref(falcon_object_t *object)
 {
 	g_return_if_fail(object);
-	g_free(object->name);
-	g_free(object);
+
+	if (g_atomic_int_dec_and_test(&object->ref_count)) {
+		g_free(object->name);
+		g_free(object);
+	}
 }
 
 falcon_object_t *falcon_object_copy(const falcon_object_t *object)
@@ -61,83 +88,175 @@ falcon_object_t *falcon_object_copy(const falcon_object_t *object)
 	ret->mode = object->mode;
 	ret->size = object->size;
 	ret->time = object->time;
+	ret->dev = object->dev;
+	ret->ino = object->ino;
+	ret->mtime = object->mtime;
+	ret->ctime = object->ctime;
 	ret->watch = object->watch;
 
 	return ret;
 }
 
-void falcon_object_save(trie_node_t *node, void *userdata)
+falcon_object_t *falcon_object_unshare(falcon_object_t *object)
 {
-	const falcon_object_t *object = (const falcon_object_t *)trie_data(node);
-	int fd = GPOINTER_TO_INT(userdata);
-	guint16 len = strlen(object->name);
-	guint16 len_be = GUINT16_TO_BE(len);
-	guint64 size = GUINT64_TO_BE(object->size);
-	guint64 time = GUINT64_TO_BE(object->time);
-	guint32 mode = GUINT32_TO_BE(object->mode);
+	falcon_object_t *ret = NULL;
+
+	g_return_val_if_fail(object, NULL);
 
-	if (write(fd, &len_be, 2) == -1 || write(fd, object->name, len) == -1
-	    || write(fd, &size, 8) == -1 || write(fd, &time, 8) == -1
-	    || write(fd, &mode, 4) == -1 || write(fd, &(object->watch), 1) == -1)
-		g_critical(_("Failed to save object \"%s\": %s"), object->name,
-		           g_strerror(errno));
+	/*
+	 * Nobody else can take a new reference without holding one, so a count of
+	 * one means that the caller owns the object exclusively.
+	 */
+	if (g_atomic_int_get(&object->ref_count) == 1)
+		return object;
+
+	ret = falcon_object_copy(object);
+	falcon_object_unref(object);
+
+	return ret;
 }
 
-gboolean falcon_object_load(falcon_object_t *object, void *userdata)
+gboolean falcon_object_save(const falcon_object_t *object, const gchar *prev,
+                            falcon_stream_t *stream)
 {
-	int fd = GPOINTER_TO_INT(userdata);
-	guint16 len = 0;
+	gsize shared = 0;
+	gsize len = 0;
+	guint8 watch = 0;
 
 	g_return_val_if_fail(object, FALSE);
+	g_return_val_if_fail(stream, FALSE);
 
-	if (read(fd, &len, 2) == -1) {
-		g_critical(_("Failed to read the length of object: %s"),
-		           g_strerror(errno));
+	len = strlen(object->name);
+	if (len > OBJECT_NAME_MAX) {
+		g_critical(_("Failed to save \"%s\", the name is too long."),
+		           object->name);
 		return FALSE;
 	}
-	len = GUINT16_FROM_BE(len);
+	while (prev && prev[shared] && prev[shared] == object->name[shared])
+		shared++;
+	watch = object->watch ? 1 : 0;
+
+	return (falcon_stream_write_varint(stream, shared)
+	        && falcon_stream_write_varint(stream, len - shared)
+	        && falcon_stream_write(stream, object->name + shared, len - shared)
+	        && falcon_stream_write_varint(stream, object->size)
+	        && falcon_stream_write_varint(stream, object->time)
+	        && falcon_stream_write_varint(stream, object->mode)
+	        && falcon_stream_write(stream, &watch, 1)
+	        && falcon_stream_write_varint(stream, object->dev)
+	        && falcon_stream_write_varint(stream, object->ino)
+	        && falcon_stream_write_varint(stream, object->mtime)
+	        && falcon_stream_write_varint(stream, object->ctime));
+}
 
-	object->name = g_new0(gchar, len + 1);
-	if (read(fd, object->name, len) == -1) {
-		g_critical(_("Failed to read object name: %s"), g_strerror(errno));
-		g_free(object->name);
-		return FALSE;
-	}
+/* Version 1 files have the whole name and fixed-width fields. */
+static gboolean falcon_object_load_v1(falcon_object_t *object, GString *name,
+                                      falcon_stream_t *stream)
+{
+	guint8 fields[8 + 8 + 4 + 1];
+	guint16 len = 0;
 
-	if (read(fd, &(object->size), 8) == -1) {
-		g_critical(_("Failed to read object size \"%s\": %s"), object->name,
-		           g_strerror(errno));
-		g_free(object->name);
+	if (!falcon_stream_read(stream, &len, 2))
 		return FALSE;
-	}
-	object->size = GUINT64_FROM_BE(object->size);
+	len = GUINT16_FROM_BE(len);
 
-	if (read(fd, &(object->time), 8) == -1) {
-		g_critical(_("Failed to read object time \"%s\": %s"), object->name,
-		           g_strerror(errno));
-		g_free(object->name);
+	g_string_set_size(name, len);
+	if (!falcon_stream_read(stream, name->str, len)
+	    || !falcon_stream_read(stream, fields, sizeof(fields)))
 		return FALSE;
-	}
+
+	memcpy(&(object->size), fields, 8);
+	memcpy(&(object->time), fields + 8, 8);
+	memcpy(&(object->mode), fields + 16, 4);
+	object->size = GUINT64_FROM_BE(object->size);
 	object->time = GUINT64_FROM_BE(object->time);
+	object->mode = GUINT32_FROM_BE(object->mode);
+	object->watch = fields[20];
 
-	if (read(fd, &(object->mode), 4) == -1) {
-		g_critical(_("Failed to read object mode \"%s\": %s"), object->name,
-		           g_strerror(errno));
-		g_free(object->name);
-		return FALSE;
+	return TRUE;
+}
+
+gboolean falcon_object_load(falcon_object_t *object, GString *name,
+                            gsize *shared, falcon_stream_t *stream)
+{
+	guint64 prefix = 0;
+	guint64 len = 0;
+	guint64 mode = 0;
+	guint8 watch = 0;
+
+	g_return_val_if_fail(object, FALSE);
+	g_return_val_if_fail(name, FALSE);
+	g_return_val_if_fail(shared, FALSE);
+	g_return_val_if_fail(stream, FALSE);
+
+	*shared = 0;
+	if (falcon_stream_version(stream) == 1) {
+		if (!falcon_object_load_v1(object, name, stream))
+			return FALSE;
+	} else {
+		if (!falcon_stream_read_varint(stream, &prefix)
+		    || !falcon_stream_read_varint(stream, &len))
+			return FALSE;
+		if (prefix > name->len || len > OBJECT_NAME_MAX - prefix) {
+			g_critical(_("Invalid object name in the cache file."));
+			return FALSE;
+		}
+
+		/* Only the part that differs from the previous name is stored. */
+		g_string_set_size(name, prefix + len);
+		if (!falcon_stream_read(stream, name->str + prefix, len)
+		    || !falcon_stream_read_varint(stream, &(object->size))
+		    || !falcon_stream_read_varint(stream, &(object->time))
+		    || !falcon_stream_read_varint(stream, &mode)
+		    || !falcon_stream_read(stream, &watch, 1))
+			return FALSE;
+		if (mode > G_MAXUINT32) {
+			g_critical(_("Invalid object mode in the cache file."));
+			return FALSE;
+		}
+		object->mode = mode;
+		object->watch = watch != 0;
+		*shared = prefix;
 	}
-	object->mode = GUINT32_FROM_BE(object->mode);
+	/* Older versions don't have them, they are left unknown. */
+	if (falcon_stream_version(stream) >= 3
+	    && (!falcon_stream_read_varint(stream, &(object->dev))
+	        || !falcon_stream_read_varint(stream, &(object->ino))
+	        || !falcon_stream_read_varint(stream, &(object->mtime))
+	        || !falcon_stream_read_varint(stream, &(object->ctime))))
+		return FALSE;
 
-	if (read(fd, &(object->watch), 1) == -1) {
-		g_critical(_("Failed to read object watch \"%s\": %s"), object->name,
-		           g_strerror(errno));
-		g_free(object->name);
+	if (name->len == 0 || memchr(name->str + *shared, '\0',
+	                             name->len - *shared)) {
+		g_critical(_("Invalid object name in the cache file."));
 		return FALSE;
 	}
 
+	g_free(object->name);
+	object->name = g_strndup(name->str, name->len);
+
 	return TRUE;
 }
 
+/* A field that is 0 on either side isn't known, so it can't tell them apart. */
+static inline gboolean falcon_object_same(guint64 a, guint64 b)
+{
+	return !a || !b || a == b;
+}
+
+/*
+ * Device numbers of NFS, LVM or btrfs may change across reboots, so another
+ * device only tells the objects apart if the nanosecond times don't vouch for
+ * them being the same file.
+ */
+static inline gboolean falcon_object_same_dev(const falcon_object_t *a,
+                                              const falcon_object_t *b)
+{
+	return !a->ino || !b->ino || a->dev == b->dev
+	       || (a->mtime && a->ctime && a->mtime == b->mtime
+	           && a->ctime == b->ctime);
+}
+
 gboolean falcon_object_equal(const falcon_object_t *a,
                              const falcon_object_t *b)
 {
@@ -147,6 +266,10 @@ gboolean falcon_object_equal(const falcon_object_t *a,
 	return (a->mode == b->mode
 	        && a->size == b->size
 	        && a->time == b->time
+	        && falcon_object_same(a->ino, b->ino)
+	        && falcon_object_same_dev(a, b)
+	        && falcon_object_same(a->mtime, b->mtime)
+	        && falcon_object_same(a->ctime, b->ctime)
 	        && g_strcmp0(a->name, b->name) == 0);
 }
 
@@ -164,6 +287,13 @@ gboolean falcon_object_isdir(const falcon_object_t *object)
 	return S_ISDIR(object->mode);
 }
 
+mode_t falcon_object_get_mode(const falcon_object_t *object)
+{
+	g_return_val_if_fail(object, 0);
+
+	return object->mode;
+}
+
 void falcon_object_set_mode(falcon_object_t *object, mode_t mode)
 {
 	g_return_if_fail(object);
@@ -212,3 +342,53 @@ void falcon_object_set_watch(falcon_object_t *object, gboolean watch)
 
 	object->watch = watch;
 }
+
+guint64 falcon_object_get_dev(const falcon_object_t *object)
+{
+	g_return_val_if_fail(object, 0);
+
+	return object->dev;
+}
+
+guint64 falcon_object_get_ino(const falcon_object_t *object)
+{
+	g_return_val_if_fail(object, 0);
+
+	return object->ino;
+}
+
+void falcon_object_set_inode(falcon_object_t *object, guint64 dev, guint64 ino)
+{
+	g_return_if_fail(object);
+
+	object->dev = dev;
+	object->ino = ino;
+}
+
+guint64 falcon_object_get_mtime(const falcon_object_t *object)
+{
+	g_return_val_if_fail(object, 0);
+
+	return object->mtime;
+}
+
+void falcon_object_set_mtime(falcon_object_t *object, guint64 mtime)
+{
+	g_return_if_fail(object);
+
+	object->mtime = mtime;
+}
+
+guint64 falcon_object_get_ctime(const falcon_object_t *object)
+{
+	g_return_val_if_fail(object, 0);
+
+	return object->ctime;
+}
+
+void falcon_object_set_ctime(falcon_object_t *object, guint64 ctime)
+{
+	g_return_if_fail(object);
+
+	object->ctime = ctime;
+}
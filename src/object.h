@@ -31,27 +31,54 @@
 #include "include/falcon.h"
 #include "common.h"
 #include "trie.h"
+#include "stream.h"
 
 /*
- * If name is not NULL, it must be a NULL-terminated string.
+ * If name is not NULL, it must be a NULL-terminated string. The new object has
+ * a reference count of one.
  */
 falcon_object_t *falcon_object_new(const gchar *name);
-void falcon_object_free(falcon_object_t *object);
+/*
+ * Same as falcon_object_new(), but takes the ownership of name instead of
+ * copying it. name must be allocated with g_malloc().
+ */
+falcon_object_t *falcon_object_new_steal(gchar *name);
 falcon_object_t *falcon_object_copy(const falcon_object_t *object);
 /*
- * Saves a single object to a file based on the binary file format.
+ * Returns an object that is safe to modify. If the caller holds the only
+ * reference, the object itself is returned. Otherwise, the reference is dropped
+ * and a private copy is returned.
+ */
+falcon_object_t *falcon_object_unshare(falcon_object_t *object);
+/*
+ * Writes a single object to a cache file stream. Only the part of the name
+ * after what it shares with prev, the name of the object written before or
+ * NULL, is stored.
  */
-void falcon_object_save(trie_node_t *node, void *userdata);
+gboolean falcon_object_save(const falcon_object_t *object, const gchar *prev,
+                            falcon_stream_t *stream);
 /*
- * Loads a single object from a file based on the binary file format.
+ * Reads a single object from a cache file stream. name holds the name of the
+ * object read before, it is updated to the new one, and shared gets the length
+ * of the part they have in common.
  *
  * The object has to be created before calling this function.
  */
-gboolean falcon_object_load(falcon_object_t *object, void *userdata);
+gboolean falcon_object_load(falcon_object_t *object, GString *name,
+                            gsize *shared, falcon_stream_t *stream);
+/* The whole st_mode, falcon_object_isdir() only tells the type. */
+mode_t falcon_object_get_mode(const falcon_object_t *object);
 
+/*
+ * The setters must only be used on objects that are not shared, see
+ * falcon_object_unshare().
+ */
 void falcon_object_set_mode(falcon_object_t *object, mode_t mode);
 void falcon_object_set_size(falcon_object_t *object, guint64 size);
 void falcon_object_set_time(falcon_object_t *object, guint64 time);
 void falcon_object_set_watch(falcon_object_t *object, gboolean watch);
+void falcon_object_set_inode(falcon_object_t *object, guint64 dev, guint64 ino);
+void falcon_object_set_mtime(falcon_object_t *object, guint64 mtime);
+void falcon_object_set_ctime(falcon_object_t *object, guint64 ctime);
 
 #endif
@@ -0,0 +1,366 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "query.h"
+
+/* The states of the matcher have to fit in a bit mask. */
+#define MAX_COMPONENTS 63
+
+typedef struct {
+	gchar *text;
+	GPatternSpec *spec;			/* NULL if it's a literal */
+	gboolean any;				/* "**", matches any number of components */
+} falcon_query_component_t;
+
+typedef struct {
+	gchar *key;
+	guint64 states;
+} falcon_query_child_t;
+
+/*
+ * A directory being visited. The node pointer is only valid while the cache
+ * generation stays the same, the path is used to find it again.
+ */
+typedef struct {
+	gchar *path;
+	trie_node_t *node;
+	guint64 states;
+	GArray *children;			/* NULL until the children are listed */
+	guint next;
+} falcon_query_frame_t;
+
+struct falcon_query_st {
+	falcon_cache_t *cache;
+	guint generation;
+	falcon_query_component_t *components;
+	guint count;
+	GPtrArray *frames;
+};
+
+/*
+ * The matcher is an NFA, state i means the first i components have been
+ * matched. "**" can match nothing, so it also enables the state after it.
+ */
+static guint64 falcon_query_closure(const falcon_query_t *query,
+                                    guint64 states)
+{
+	guint i;
+
+	for (i = 0; i < query->count; i++)
+		if ((states & ((guint64)1 << i)) && query->components[i].any)
+			states |= (guint64)1 << (i + 1);
+
+	return states;
+}
+
+static guint64 falcon_query_step(const falcon_query_t *query, guint64 states,
+                                 const gchar *key)
+{
+	const falcon_query_component_t *component = NULL;
+	guint64 next = 0;
+	guint i;
+
+	for (i = 0; i < query->count; i++) {
+		if (!(states & ((guint64)1 << i)))
+			continue;
+
+		component = &query->components[i];
+		if (component->any)
+			next |= (guint64)1 << i;
+		else if (component->spec ? g_pattern_match_string(component->spec, key)
+		         : strcmp(component->text, key) == 0)
+			next |= (guint64)1 << (i + 1);
+	}
+
+	return falcon_query_closure(query, next);
+}
+
+static gboolean falcon_query_accepts(const falcon_query_t *query,
+                                     guint64 states)
+{
+	return (states & ((guint64)1 << query->count)) != 0;
+}
+
+/* Checks if some more components are expected below. */
+static gboolean falcon_query_descends(const falcon_query_t *query,
+                                      guint64 states)
+{
+	return (states & (((guint64)1 << query->count) - 1)) != 0;
+}
+
+/* Checks if all the expected components are literals. */
+static gboolean falcon_query_literal(const falcon_query_t *query,
+                                     guint64 states)
+{
+	guint i;
+
+	for (i = 0; i < query->count; i++)
+		if ((states & ((guint64)1 << i)) && (query->components[i].spec
+		                                     || query->components[i].any))
+			return FALSE;
+
+	return TRUE;
+}
+
+static gchar *falcon_query_join(const gchar *path, const gchar *key)
+{
+	if (!*path)
+		return g_strdup(key);
+	if (g_str_has_suffix(path, G_DIR_SEPARATOR_S))
+		return g_strconcat(path, key, NULL);
+	return g_strconcat(path, G_DIR_SEPARATOR_S, key, NULL);
+}
+
+static gint falcon_query_child_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(((const falcon_query_child_t *)a)->key,
+	              ((const falcon_query_child_t *)b)->key);
+}
+
+static void falcon_query_add_child(const falcon_query_t *query, GArray *children,
+                                   guint64 states, const gchar *key)
+{
+	falcon_query_child_t child;
+
+	child.states = falcon_query_step(query, states, key);
+	if (!child.states)
+		return;
+
+	child.key = g_strdup(key);
+	g_array_append_val(children, child);
+}
+
+/*
+ * Lists the children of the frame that can still match. Only the children with
+ * the expected names are looked up if those are all literals.
+ */
+static void falcon_query_list(const falcon_query_t *query,
+                              falcon_query_frame_t *frame)
+{
+	trie_node_t *child = NULL;
+	guint i;
+
+	frame->children = g_array_new(FALSE, FALSE, sizeof(falcon_query_child_t));
+	if (!falcon_query_descends(query, frame->states))
+		return;
+
+	if (falcon_query_literal(query, frame->states)) {
+		for (i = 0; i < query->count; i++) {
+			if (!(frame->states & ((guint64)1 << i)))
+				continue;
+			child = trie_find_child(frame->node, query->components[i].text);
+			if (child)
+				falcon_query_add_child(query, frame->children, frame->states,
+				                       trie_key(child));
+		}
+	} else {
+		for (child = trie_child(frame->node); child;
+		     child = trie_next(child))
+			falcon_query_add_child(query, frame->children, frame->states,
+			                       trie_key(child));
+	}
+
+	/* Visit the children in a stable order, and only once each. */
+	g_array_sort(frame->children, falcon_query_child_compare);
+	for (i = 1; i < frame->children->len; i++) {
+		if (strcmp(g_array_index(frame->children, falcon_query_child_t,
+		                         i - 1).key,
+		           g_array_index(frame->children, falcon_query_child_t,
+		                         i).key) == 0) {
+			g_free(g_array_index(frame->children, falcon_query_child_t, i).key);
+			g_array_remove_index(frame->children, i--);
+		}
+	}
+}
+
+static void falcon_query_push(falcon_query_t *query, gchar *path,
+                              trie_node_t *node, guint64 states)
+{
+	falcon_query_frame_t *frame = g_new0(falcon_query_frame_t, 1);
+
+	frame->path = path;
+	frame->node = node;
+	frame->states = states;
+	g_ptr_array_add(query->frames, frame);
+}
+
+static void falcon_query_frame_free(falcon_query_frame_t *frame)
+{
+	guint i;
+
+	if (frame->children) {
+		for (i = 0; i < frame->children->len; i++)
+			g_free(g_array_index(frame->children, falcon_query_child_t, i).key);
+		g_array_free(frame->children, TRUE);
+	}
+	g_free(frame->path);
+	g_free(frame);
+}
+
+static void falcon_query_pop(falcon_query_t *query)
+{
+	falcon_query_frame_free(g_ptr_array_index(query->frames,
+	                                          query->frames->len - 1));
+	g_ptr_array_remove_index(query->frames, query->frames->len - 1);
+}
+
+/* Makes sure the node of the frame is valid, returns FALSE if it's gone. */
+static gboolean falcon_query_resolve(falcon_query_t *query,
+                                     falcon_query_frame_t *frame)
+{
+	trie_node_t *root = falcon_cache_root(query->cache);
+
+	if (!frame->node)
+		frame->node = *frame->path ? trie_find(root, frame->path) : root;
+
+	return frame->node != NULL;
+}
+
+falcon_query_t *falcon_cache_query_new(falcon_cache_t *cache,
+                                       const gchar *pattern)
+{
+	falcon_query_t *query = NULL;
+	gchar **tokens = NULL;
+	guint count = 0;
+	guint i;
+
+	g_return_val_if_fail(cache, NULL);
+	g_return_val_if_fail(pattern, NULL);
+
+	query = g_new0(falcon_query_t, 1);
+	query->cache = cache;
+	query->components = g_new0(falcon_query_component_t, MAX_COMPONENTS);
+
+	/* The file system root is a component of its own in the trie. */
+	if (g_str_has_prefix(pattern, G_DIR_SEPARATOR_S))
+		query->components[count++].text = g_strdup(G_DIR_SEPARATOR_S);
+
+	tokens = g_strsplit(pattern, G_DIR_SEPARATOR_S, -1);
+	for (i = 0; tokens[i]; i++) {
+		if (!*tokens[i])
+			continue;
+		if (count == MAX_COMPONENTS) {
+			g_warning(_("Pattern \"%s\" has more than %d components."),
+			          pattern, MAX_COMPONENTS);
+			g_strfreev(tokens);
+			query->count = count;
+			falcon_query_free(query);
+			return NULL;
+		}
+
+		query->components[count].text = g_strdup(tokens[i]);
+		if (strcmp(tokens[i], "**") == 0)
+			query->components[count].any = TRUE;
+		else if (strpbrk(tokens[i], "*?"))
+			query->components[count].spec = g_pattern_spec_new(tokens[i]);
+		count++;
+	}
+	g_strfreev(tokens);
+	query->count = count;
+	query->frames = g_ptr_array_new();
+
+	falcon_cache_lock(cache);
+	query->generation = falcon_cache_generation(cache);
+	falcon_query_push(query, g_strdup(""), falcon_cache_root(cache),
+	                  falcon_query_closure(query, 1));
+	falcon_cache_unlock(cache);
+
+	return query;
+}
+
+falcon_object_t *falcon_query_next(falcon_query_t *query)
+{
+	falcon_query_frame_t *frame = NULL;
+	falcon_query_child_t *child = NULL;
+	falcon_object_t *object = NULL;
+	trie_node_t *node = NULL;
+	gchar *path = NULL;
+	guint i;
+
+	g_return_val_if_fail(query, NULL);
+
+	falcon_cache_lock(query->cache);
+
+	/* Nodes may have been freed since the last call. */
+	if (query->generation != falcon_cache_generation(query->cache)) {
+		query->generation = falcon_cache_generation(query->cache);
+		for (i = 0; i < query->frames->len; i++)
+			((falcon_query_frame_t *)g_ptr_array_index(query->frames, i))->node
+				= NULL;
+	}
+
+	while (!object && query->frames->len) {
+		frame = g_ptr_array_index(query->frames, query->frames->len - 1);
+		if (!falcon_query_resolve(query, frame)) {
+			falcon_query_pop(query);
+			continue;
+		}
+		if (!frame->children)
+			falcon_query_list(query, frame);
+		if (frame->next == frame->children->len) {
+			falcon_query_pop(query);
+			continue;
+		}
+
+		child = &g_array_index(frame->children, falcon_query_child_t,
+		                       frame->next++);
+		if (!(node = trie_find_child(frame->node, child->key)))
+			continue;
+
+		if (falcon_query_accepts(query, child->states) && trie_data(node))
+			object = falcon_object_ref(trie_data(node));
+
+		if (trie_child(node) && falcon_query_descends(query, child->states)) {
+			path = falcon_query_join(frame->path, child->key);
+			falcon_query_push(query, path, node, child->states);
+		}
+	}
+
+	falcon_cache_unlock(query->cache);
+
+	return object;
+}
+
+void falcon_query_free(falcon_query_t *query)
+{
+	guint i;
+
+	g_return_if_fail(query);
+
+	if (query->frames) {
+		while (query->frames->len)
+			falcon_query_pop(query);
+		g_ptr_array_free(query->frames, TRUE);
+	}
+	for (i = 0; i < query->count; i++) {
+		g_free(query->components[i].text);
+		if (query->components[i].spec)
+			g_pattern_spec_free(query->components[i].spec);
+	}
+	g_free(query->components);
+	g_free(query);
+}
@@ -0,0 +1,213 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "queue.h"
+#include "crc32c.h"
+#include "object.h"
+
+/*
+ * Queue file format:
+ *
+ * 4 bytes magic "FLCQ", 2 bytes version and 2 bytes flags (none yet), both
+ * big-endian, then for each object 1 byte flags, QUEUE_FAILED and QUEUE_WATCH,
+ * varint name length and the name, and 4 bytes big-endian CRC-32C of all the
+ * above.
+ */
+#define QUEUE_MAGIC "FLCQ"
+#define QUEUE_VERSION 1
+#define QUEUE_HEADER 8
+
+#define QUEUE_FAILED (1 << 0)
+#define QUEUE_WATCH (1 << 1)
+
+static void falcon_queue_put_objects(GString *data, const GPtrArray *objects,
+                                     guint8 flags)
+{
+	const falcon_object_t *object = NULL;
+	const gchar *name = NULL;
+	guint i;
+
+	for (i = 0; i < objects->len; i++) {
+		object = g_ptr_array_index(objects, i);
+		name = falcon_object_get_name(object);
+		g_string_append_c(data, flags | (falcon_object_get_watch(object)
+		                                 ? QUEUE_WATCH : 0));
+		falcon_varint_put(data, strlen(name));
+		g_string_append(data, name);
+	}
+}
+
+falcon_queue_t *falcon_queue_new(void)
+{
+	falcon_queue_t *queue = g_new0(falcon_queue_t, 1);
+
+	queue->pending = g_ptr_array_new();
+	queue->failed = g_ptr_array_new();
+
+	return queue;
+}
+
+void falcon_queue_add(falcon_queue_t *queue, falcon_object_t *object,
+                      gboolean failed)
+{
+	g_return_if_fail(queue);
+	g_return_if_fail(object);
+
+	g_ptr_array_add(failed ? queue->failed : queue->pending,
+	                falcon_object_ref(object));
+}
+
+void falcon_queue_free(falcon_queue_t *queue)
+{
+	guint i;
+
+	if (!queue)
+		return;
+
+	for (i = 0; i < queue->pending->len; i++)
+		falcon_object_unref(g_ptr_array_index(queue->pending, i));
+	for (i = 0; i < queue->failed->len; i++)
+		falcon_object_unref(g_ptr_array_index(queue->failed, i));
+	g_ptr_array_free(queue->pending, TRUE);
+	g_ptr_array_free(queue->failed, TRUE);
+	g_free(queue);
+}
+
+gboolean falcon_queue_save(const falcon_queue_t *queue, const gchar *name)
+{
+	GString *data = NULL;
+	gchar *path = NULL;
+	gchar *temp = NULL;
+	guint32 value = 0;
+	gboolean ret = FALSE;
+	int fd = -1;
+
+	g_return_val_if_fail(queue, FALSE);
+	if (!name)
+		return FALSE;
+
+	path = g_strconcat(name, ".queue", NULL);
+	if (!queue->pending->len && !queue->failed->len) {
+		ret = g_unlink(path) == 0 || errno == ENOENT;
+		if (!ret)
+			g_warning(_("Failed to delete crawl queue %s: %s"), path,
+			          g_strerror(errno));
+		g_free(path);
+		return ret;
+	}
+
+	data = g_string_new(QUEUE_MAGIC);
+	g_string_append_c(data, (QUEUE_VERSION >> 8) & 0xff);
+	g_string_append_c(data, QUEUE_VERSION & 0xff);
+	g_string_append_c(data, 0);
+	g_string_append_c(data, 0);
+	falcon_queue_put_objects(data, queue->pending, 0);
+	falcon_queue_put_objects(data, queue->failed, QUEUE_FAILED);
+	value = GUINT32_TO_BE(falcon_crc32c(0, data->str, data->len));
+	g_string_append_len(data, (const gchar *)&value, 4);
+
+	fd = falcon_temp_open(path, &temp);
+	ret = fd != -1
+	      && falcon_temp_commit(fd, temp, path,
+	                            falcon_write_all(fd, data->str, data->len));
+	if (!ret)
+		g_critical(_("Failed to write crawl queue %s: %s"), path,
+		           g_strerror(errno));
+	g_free(temp);
+	g_free(path);
+	g_string_free(data, TRUE);
+
+	return ret;
+}
+
+falcon_queue_t *falcon_queue_load(const gchar *name)
+{
+	falcon_queue_t *queue = NULL;
+	falcon_object_t *object = NULL;
+	gchar *path = NULL;
+	gchar *data = NULL;
+	const guint8 *pos = NULL;
+	const guint8 *end = NULL;
+	guint64 length = 0;
+	guint32 value = 0;
+	guint8 flags = 0;
+	gsize len = 0;
+	GError *error = NULL;
+
+	if (!name)
+		return NULL;
+
+	path = g_strconcat(name, ".queue", NULL);
+	if (!g_file_get_contents(path, &data, &len, &error)) {
+		if (error->code != G_FILE_ERROR_NOENT)
+			g_warning(_("Failed to read crawl queue %s: %s"), path,
+			          error->message);
+		g_error_free(error);
+		g_free(path);
+		return NULL;
+	}
+
+	if (len >= QUEUE_HEADER + 4) {
+		memcpy(&value, data + len - 4, 4);
+		end = (const guint8 *)data + len - 4;
+	}
+	if (!end || memcmp(data, QUEUE_MAGIC, 4) != 0
+	    || GUINT32_FROM_BE(value) != falcon_crc32c(0, data, len - 4)
+	    || ((guint8)data[4] << 8 | (guint8)data[5]) != QUEUE_VERSION) {
+		g_warning(_("Crawl queue %s is corrupted, ignoring it."), path);
+		g_free(data);
+		g_free(path);
+		return NULL;
+	}
+
+	queue = falcon_queue_new();
+	pos = (const guint8 *)data + QUEUE_HEADER;
+	while (pos < end) {
+		flags = *pos++;
+		if (!falcon_varint_get(&pos, end, &length)
+		    || (guint64)(end - pos) < length || !length
+		    || memchr(pos, '\0', length))
+			break;
+		object = falcon_object_new_steal(g_strndup((const gchar *)pos,
+		                                           length));
+		falcon_object_set_watch(object, (flags & QUEUE_WATCH) != 0);
+		g_ptr_array_add(flags & QUEUE_FAILED ? queue->failed
+		                : queue->pending, object);
+		pos += length;
+	}
+	if (pos != end) {
+		g_warning(_("Crawl queue %s is corrupted, ignoring it."), path);
+		falcon_queue_free(queue);
+		queue = NULL;
+	}
+	g_free(data);
+	g_free(path);
+
+	return queue;
+}
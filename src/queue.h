@@ -0,0 +1,63 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <glib.h>
+
+#include "common.h"
+
+/*
+ * The objects the walkers still have to go through, kept next to the cache file
+ * in name.queue so an interrupted crawl carries on where it stopped. Only the
+ * names and the watchability flags are kept.
+ *
+ * The file may be older than the cache file and its journal, never newer. The
+ * directories that were walked since are then walked again, which finds
+ * everything found since as well.
+ */
+typedef struct {
+	GPtrArray *pending;			/* Objects still to be walked */
+	GPtrArray *failed;			/* Objects the walkers failed on */
+} falcon_queue_t;
+
+/* Gets the objects to keep, for the checkpoints of the journal. */
+typedef falcon_queue_t *(*falcon_queue_func)(void);
+
+falcon_queue_t *falcon_queue_new(void);
+/* Takes a new reference to object. */
+void falcon_queue_add(falcon_queue_t *queue, falcon_object_t *object,
+                      gboolean failed);
+void falcon_queue_free(falcon_queue_t *queue);
+
+/*
+ * Writes the queue of the cache file name, or removes it if there is nothing
+ * in it.
+ */
+gboolean falcon_queue_save(const falcon_queue_t *queue, const gchar *name);
+/* Reads the queue of the cache file name, NULL if there is none. */
+falcon_queue_t *falcon_queue_load(const gchar *name);
+
+#endif
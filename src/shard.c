@@ -0,0 +1,698 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "shard.h"
+#include "crc32c.h"
+#include "image.h"
+#include "snapshot.h"
+#include "summary.h"
+
+/*
+ * Manifest format, integers are big-endian:
+ *
+ * 4 bytes magic "FLCM", 2 bytes version, 2 bytes format of the shards, 4 bytes
+ * number of shards, then for each shard:
+ *   4 bytes number N of its file, name.N
+ *   8 bytes number of objects
+ *   8 bytes digest
+ *   2 bytes length of the name of its topmost object, followed by the name,
+ *   empty for the objects above the shards
+ * and 4 bytes CRC-32C of all the above.
+ *
+ * The shard files are written first, under numbers no file of the previous
+ * manifest uses, so the manifest is replaced in one rename.
+ */
+#define MANIFEST_MAGIC "FLCM"
+#define MANIFEST_VERSION 1
+#define MANIFEST_HEADER 12
+#define MANIFEST_SHARD 22
+/* Shards are read and written by as many threads as there are walkers. */
+#define SHARD_THREADS MAX_WALKERS
+
+#define FNV_OFFSET G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define FNV_PRIME G_GUINT64_CONSTANT(0x100000001b3)
+
+typedef struct {
+	gchar *path;				/* Topmost object, empty above the shards */
+	guint32 file;
+	guint64 count;
+	guint64 digest;
+	falcon_snapshot_t *snapshot;	/* To be written, NULL if the file is good */
+	falcon_cache_t *part;		/* Read from the file */
+	gboolean ret;
+} falcon_shard_t;
+
+struct falcon_save_st {
+	falcon_cache_t *cache;
+	gchar *name;
+	falcon_format_t format;
+	falcon_snapshot_t *snapshot;	/* Of the whole cache, for a single file */
+	GPtrArray *shards;			/* NULL for a single file */
+	GPtrArray *old;				/* Shards of the manifest at name, if any */
+	GHashTable *current;		/* Old shards still good, by path */
+	GHashTable *local_changes;	/* Taken from the cache */
+};
+
+static void falcon_shard_free(falcon_shard_t *shard)
+{
+	if (shard->snapshot)
+		falcon_snapshot_free(shard->snapshot);
+	if (shard->part)
+		falcon_cache_free(shard->part);
+	g_free(shard->path);
+	g_free(shard);
+}
+
+static void falcon_shard_free_all(GPtrArray *shards)
+{
+	guint i;
+
+	for (i = 0; i < shards->len; i++)
+		falcon_shard_free(g_ptr_array_index(shards, i));
+	g_ptr_array_free(shards, TRUE);
+}
+
+static gchar *falcon_shard_file(const gchar *name, guint32 file)
+{
+	return g_strdup_printf("%s.%u", name, file);
+}
+
+static gboolean falcon_shard_exists(const gchar *name, guint32 file)
+{
+	gchar *path = falcon_shard_file(name, file);
+	gboolean ret = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+
+	g_free(path);
+
+	return ret;
+}
+
+static guint64 falcon_shard_stat(const gchar *path)
+{
+	struct stat buf;
+
+	return g_stat(path, &buf) == 0 ? (guint64)buf.st_size : 0;
+}
+
+static void falcon_shard_remove(const gchar *name, guint32 file)
+{
+	gchar *path = falcon_shard_file(name, file);
+
+	if (g_unlink(path) == -1 && errno != ENOENT)
+		g_warning(_("Failed to delete cache shard %s: %s"), path,
+		          g_strerror(errno));
+	g_free(path);
+}
+
+static void falcon_shard_put(GString *data, guint64 value, guint bytes)
+{
+	while (bytes--)
+		g_string_append_c(data, (value >> (bytes * 8)) & 0xff);
+}
+
+static guint64 falcon_shard_get(const guint8 **pos, guint bytes)
+{
+	guint64 value = 0;
+
+	while (bytes--)
+		value = (value << 8) | *(*pos)++;
+
+	return value;
+}
+
+/* Gets the shards listed in the manifest name, NULL if it can't be read. */
+static GPtrArray *falcon_shard_read(const gchar *name, falcon_format_t *format)
+{
+	GPtrArray *shards = NULL;
+	falcon_shard_t *shard = NULL;
+	gchar *data = NULL;
+	const guint8 *pos = NULL;
+	const guint8 *end = NULL;
+	gsize len = 0;
+	guint length = 0;
+	guint count = 0;
+	guint i;
+	GError *error = NULL;
+
+	if (!g_file_get_contents(name, &data, &len, &error)) {
+		g_critical(_("Failed to read cache manifest %s: %s"), name,
+		           error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	if (len >= MANIFEST_HEADER + 4) {
+		end = (const guint8 *)data + len - 4;
+		pos = end;
+	}
+	if (!end || memcmp(data, MANIFEST_MAGIC, 4) != 0
+	    || falcon_shard_get(&pos, 4) != falcon_crc32c(0, data, len - 4)) {
+		g_critical(_("Cache manifest %s is corrupted."), name);
+		g_free(data);
+		return NULL;
+	}
+
+	pos = (const guint8 *)data + 4;
+	if (falcon_shard_get(&pos, 2) != MANIFEST_VERSION) {
+		g_critical(_("Cache manifest %s has an unknown version."), name);
+		g_free(data);
+		return NULL;
+	}
+	*format = falcon_shard_get(&pos, 2);
+	count = falcon_shard_get(&pos, 4);
+
+	shards = g_ptr_array_new();
+	for (i = 0; i < count && end - pos >= MANIFEST_SHARD; i++) {
+		shard = g_new0(falcon_shard_t, 1);
+		shard->file = falcon_shard_get(&pos, 4);
+		shard->count = falcon_shard_get(&pos, 8);
+		shard->digest = falcon_shard_get(&pos, 8);
+		length = falcon_shard_get(&pos, 2);
+		if ((gsize)(end - pos) < length || memchr(pos, '\0', length)) {
+			g_free(shard);
+			break;
+		}
+		shard->path = g_strndup((const gchar *)pos, length);
+		pos += length;
+		g_ptr_array_add(shards, shard);
+	}
+	g_free(data);
+
+	if (i != count || pos != end) {
+		g_critical(_("Cache manifest %s is corrupted."), name);
+		falcon_shard_free_all(shards);
+		return NULL;
+	}
+
+	return shards;
+}
+
+/* Writes the manifest of the shards through a temporary file. */
+static gboolean falcon_shard_write(const falcon_save_t *save)
+{
+	falcon_shard_t *shard = NULL;
+	GString *data = NULL;
+	gchar *temp = NULL;
+	gboolean ret = FALSE;
+	guint i;
+	int fd = -1;
+
+	data = g_string_new(MANIFEST_MAGIC);
+	falcon_shard_put(data, MANIFEST_VERSION, 2);
+	falcon_shard_put(data, save->format, 2);
+	falcon_shard_put(data, save->shards->len, 4);
+	for (i = 0; i < save->shards->len; i++) {
+		shard = g_ptr_array_index(save->shards, i);
+		falcon_shard_put(data, shard->file, 4);
+		falcon_shard_put(data, shard->count, 8);
+		falcon_shard_put(data, shard->digest, 8);
+		falcon_shard_put(data, strlen(shard->path), 2);
+		g_string_append(data, shard->path);
+	}
+	falcon_shard_put(data, falcon_crc32c(0, data->str, data->len), 4);
+
+	fd = falcon_temp_open(save->name, &temp);
+	ret = fd != -1
+	      && falcon_temp_commit(fd, temp, save->name,
+	                            falcon_write_all(fd, data->str, data->len));
+	if (!ret)
+		g_critical(_("Failed to write cache manifest %s: %s"), save->name,
+		           g_strerror(errno));
+	g_free(temp);
+	g_string_free(data, TRUE);
+
+	return ret;
+}
+
+static gint falcon_shard_compare_count(gconstpointer a, gconstpointer b)
+{
+	const falcon_shard_t *x = *(falcon_shard_t * const *)a;
+	const falcon_shard_t *y = *(falcon_shard_t * const *)b;
+
+	return x->count < y->count ? 1 : (x->count > y->count ? -1 : 0);
+}
+
+/*
+ * Calls func on the shards on SHARD_THREADS threads, or on this one if they
+ * can't be started. The biggest shards go first, so no thread is left with
+ * one at the end.
+ */
+static void falcon_shard_run(GPtrArray *shards, GFunc func, gpointer userdata)
+{
+	GThreadPool *pool = NULL;
+	GError *error = NULL;
+	guint i;
+
+	if (!shards->len)
+		return;
+
+	g_ptr_array_sort(shards, falcon_shard_compare_count);
+	if (shards->len > 1) {
+		pool = g_thread_pool_new(func, userdata, SHARD_THREADS, TRUE, &error);
+		if (!pool) {
+			g_warning(_("Failed to start the shard threads: %s"),
+			          error->message);
+			g_error_free(error);
+		}
+	}
+
+	for (i = 0; i < shards->len; i++) {
+		if (pool)
+			g_thread_pool_push(pool, g_ptr_array_index(shards, i), NULL);
+		else
+			func(g_ptr_array_index(shards, i), userdata);
+	}
+	if (pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+static void falcon_shard_load_one(gpointer data, gpointer userdata)
+{
+	falcon_shard_t *shard = (falcon_shard_t *)data;
+	const gchar *name = (const gchar *)userdata;
+	gchar *file = falcon_shard_file(name, shard->file);
+
+	shard->part = falcon_cache_new();
+	shard->ret = falcon_cache_load(shard->part, file);
+	/* Page in a mapped shard here, not with the cache locked. */
+	falcon_cache_lock(shard->part);
+	falcon_cache_root(shard->part);
+	falcon_cache_unlock(shard->part);
+	g_free(file);
+}
+
+gboolean falcon_shard_probe(const gchar *name)
+{
+	gchar magic[4];
+	gboolean ret = FALSE;
+	int fd = 0;
+
+	g_return_val_if_fail(name, FALSE);
+
+	fd = g_open(name, O_RDONLY, 0);
+	if (fd == -1)
+		return FALSE;
+	ret = read(fd, magic, 4) == 4 && memcmp(magic, MANIFEST_MAGIC, 4) == 0;
+	close(fd);
+
+	return ret;
+}
+
+gboolean falcon_shard_load(falcon_cache_t *cache, const gchar *name)
+{
+	GPtrArray *shards = NULL;
+	GPtrArray *subtrees = NULL;
+	falcon_shard_t *shard = NULL;
+	falcon_format_t format = FORMAT_IMAGE;
+	gchar *file = NULL;
+	gboolean ret = TRUE;
+	guint i;
+
+	g_return_val_if_fail(cache, FALSE);
+	g_return_val_if_fail(name, FALSE);
+
+	if (!(shards = falcon_shard_read(name, &format)))
+		return FALSE;
+
+	/* The shards hang below the objects above them, those come first. */
+	subtrees = g_ptr_array_sized_new(shards->len);
+	for (i = 0; i < shards->len; i++) {
+		shard = g_ptr_array_index(shards, i);
+		if (*shard->path) {
+			g_ptr_array_add(subtrees, shard);
+			continue;
+		}
+		file = falcon_shard_file(name, shard->file);
+		if (!falcon_cache_load(cache, file))
+			ret = FALSE;
+		g_free(file);
+	}
+
+	falcon_shard_run(subtrees, falcon_shard_load_one, (gpointer)name);
+	for (i = 0; i < subtrees->len; i++) {
+		shard = g_ptr_array_index(subtrees, i);
+		falcon_cache_graft(cache, shard->part, shard->path);
+		if (!shard->ret)
+			ret = FALSE;
+	}
+	g_debug(_("Loaded %u cache shards from %s."), shards->len, name);
+
+	g_ptr_array_free(subtrees, TRUE);
+	falcon_shard_free_all(shards);
+
+	return ret;
+}
+
+guint64 falcon_shard_size(const gchar *name)
+{
+	GPtrArray *shards = NULL;
+	falcon_format_t format = FORMAT_IMAGE;
+	gchar *file = NULL;
+	guint64 size = 0;
+	guint i;
+
+	g_return_val_if_fail(name, 0);
+
+	size = falcon_shard_stat(name);
+	if (!size || !falcon_shard_probe(name)
+	    || !(shards = falcon_shard_read(name, &format)))
+		return size;
+
+	for (i = 0; i < shards->len; i++) {
+		file = falcon_shard_file(name,
+		                         ((falcon_shard_t *)g_ptr_array_index(shards, i))->file);
+		size += falcon_shard_stat(file);
+		g_free(file);
+	}
+	falcon_shard_free_all(shards);
+
+	return size;
+}
+
+/*
+ * Hashes what the file keeps of an object above the shards, including what the
+ * summary digests leave out.
+ */
+static guint64 falcon_shard_hash(const falcon_object_t *object)
+{
+	const gchar *name = falcon_object_get_name(object);
+	guint64 h = FNV_OFFSET;
+
+	for (; *name; name++) {
+		h ^= (guchar)*name;
+		h *= FNV_PRIME;
+	}
+	h = (h ^ falcon_object_get_size(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_time(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_mode(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_dev(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_ino(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_mtime(object)) * FNV_PRIME;
+	h = (h ^ falcon_object_get_ctime(object)) * FNV_PRIME;
+	h = (h ^ (falcon_object_get_watch(object) ? 1 : 0)) * FNV_PRIME;
+
+	return h ^ (h >> 29);
+}
+
+/* Whether a is b or one of its ancestors. */
+static gboolean falcon_shard_within(const gchar *a, const gchar *b)
+{
+	gsize len = strlen(a);
+
+	return strncmp(a, b, len) == 0
+	       && (b[len] == '\0' || b[len] == G_DIR_SEPARATOR
+	           || (len && a[len - 1] == G_DIR_SEPARATOR));
+}
+
+/* Whether something the digests don't cover changed in the subtree of path. */
+static gboolean falcon_shard_local_changed(const falcon_save_t *save,
+                                           const gchar *path)
+{
+	GHashTableIter iter;
+	gpointer name = NULL;
+
+	if (!save->local_changes)
+		return FALSE;
+
+	g_hash_table_iter_init(&iter, save->local_changes);
+	while (g_hash_table_iter_next(&iter, &name, NULL))
+		if (falcon_shard_within(name, path) || falcon_shard_within(path, name))
+			return TRUE;
+
+	return FALSE;
+}
+
+/*
+ * Adds a shard, whose file is kept if nothing changed since it was written.
+ * objects is taken over, it is only needed if the shard has to be written.
+ * The digest of the top shard covers what the others miss already.
+ */
+static void falcon_shard_add(falcon_save_t *save, const gchar *path,
+                             guint64 count, guint64 digest,
+                             trie_node_t *node, GPtrArray *objects)
+{
+	falcon_shard_t *shard = g_new0(falcon_shard_t, 1);
+	const falcon_shard_t *old = NULL;
+	guint i;
+
+	shard->path = g_strdup(path);
+	shard->count = count;
+	shard->digest = digest;
+	if (save->current)
+		old = g_hash_table_lookup(save->current, path);
+	if (old && old->count == count && old->digest == digest
+	    && (objects || !falcon_shard_local_changed(save, path))) {
+		shard->file = old->file;
+		for (i = 0; objects && i < objects->len; i++)
+			falcon_object_unref(g_ptr_array_index(objects, i));
+		if (objects)
+			g_ptr_array_free(objects, TRUE);
+	} else if (objects) {
+		shard->snapshot = falcon_snapshot_wrap(objects);
+	} else {
+		shard->snapshot = falcon_snapshot_node(node);
+	}
+	g_ptr_array_add(save->shards, shard);
+}
+
+/*
+ * Makes a shard of each directory depth levels below the topmost objects, and
+ * collects the objects above them in top. The caller must lock the cache.
+ */
+static void falcon_shard_collect(falcon_save_t *save, trie_node_t *node,
+                                 guint depth, GPtrArray *top)
+{
+	trie_node_t *child = NULL;
+	falcon_object_t *data = NULL;
+	falcon_summary_t summary;
+
+	for (child = trie_child(node); child; child = trie_next(child)) {
+		if (!(data = trie_data(child))) {
+			falcon_shard_collect(save, child, depth, top);
+		} else if (depth > 1 || !falcon_object_isdir(data)) {
+			g_ptr_array_add(top, falcon_object_ref(data));
+			falcon_shard_collect(save, child, depth > 1 ? depth - 1 : 1, top);
+		} else {
+			falcon_summary_get(child, &summary);
+			falcon_shard_add(save, falcon_object_get_name(data),
+			                 summary.files + summary.dirs + 1,
+			                 falcon_summary_digest(child), child, NULL);
+		}
+	}
+}
+
+falcon_save_t *falcon_shard_begin(falcon_cache_t *cache, const gchar *name,
+                                  falcon_format_t format, guint depth)
+{
+	falcon_save_t *save = NULL;
+	falcon_shard_t *shard = NULL;
+	falcon_format_t old_format = FORMAT_IMAGE;
+	trie_node_t *root = NULL;
+	GPtrArray *top = NULL;
+	guint64 digest = 0;
+	guint i;
+
+	g_return_val_if_fail(cache, NULL);
+	g_return_val_if_fail(name, NULL);
+
+	save = g_new0(falcon_save_t, 1);
+	save->cache = cache;
+	save->name = g_strdup(name);
+	save->format = format;
+	if (falcon_shard_probe(name))
+		save->old = falcon_shard_read(name, &old_format);
+
+	/* Shards in another format, or whose file is gone, are written again. */
+	if (depth && save->old && old_format == format) {
+		save->current = g_hash_table_new(g_str_hash, g_str_equal);
+		for (i = 0; i < save->old->len; i++) {
+			shard = g_ptr_array_index(save->old, i);
+			if (falcon_shard_exists(name, shard->file))
+				g_hash_table_insert(save->current, shard->path, shard);
+		}
+	}
+
+	falcon_cache_lock(cache);
+	root = falcon_cache_root(cache);
+	if (!depth) {
+		save->snapshot = falcon_snapshot_node(root);
+		falcon_cache_unlock(cache);
+		return save;
+	}
+
+	save->local_changes = falcon_cache_take_local_changes(cache);
+	save->shards = g_ptr_array_new();
+	top = g_ptr_array_new();
+	falcon_shard_collect(save, root, depth, top);
+	if (top->len) {
+		for (i = 0; i < top->len; i++)
+			digest += falcon_shard_hash(g_ptr_array_index(top, i));
+		falcon_shard_add(save, "", top->len, digest, NULL, top);
+	} else {
+		g_ptr_array_free(top, TRUE);
+	}
+	falcon_cache_unlock(cache);
+
+	return save;
+}
+
+static void falcon_shard_save_one(gpointer data, gpointer userdata)
+{
+	falcon_shard_t *shard = (falcon_shard_t *)data;
+	const falcon_save_t *save = (const falcon_save_t *)userdata;
+	gchar *file = falcon_shard_file(save->name, shard->file);
+
+	if (save->format == FORMAT_IMAGE)
+		shard->ret = falcon_image_save(shard->snapshot, file);
+	else
+		shard->ret = falcon_snapshot_save(shard->snapshot, file,
+		                                  save->format == FORMAT_COMPRESSED);
+	g_free(file);
+}
+
+/* Gives the shards to write numbers no file of either manifest uses. */
+static void falcon_shard_number(falcon_save_t *save, GPtrArray *dirty)
+{
+	GHashTable *used = g_hash_table_new(g_direct_hash, g_direct_equal);
+	falcon_shard_t *shard = NULL;
+	guint32 file = 0;
+	guint i;
+
+	for (i = 0; save->old && i < save->old->len; i++) {
+		shard = g_ptr_array_index(save->old, i);
+		g_hash_table_insert(used, GUINT_TO_POINTER(shard->file + 1), shard);
+	}
+	for (i = 0; i < save->shards->len; i++) {
+		shard = g_ptr_array_index(save->shards, i);
+		if (!shard->snapshot)
+			continue;
+		while (g_hash_table_lookup(used, GUINT_TO_POINTER(file + 1)))
+			file++;
+		shard->file = file++;
+		g_ptr_array_add(dirty, shard);
+	}
+	g_hash_table_destroy(used);
+}
+
+/* Removes the files of the old manifest that the new one doesn't use. */
+static void falcon_shard_clean(const falcon_save_t *save)
+{
+	GHashTable *used = g_hash_table_new(g_direct_hash, g_direct_equal);
+	falcon_shard_t *shard = NULL;
+	guint i;
+
+	for (i = 0; save->shards && i < save->shards->len; i++) {
+		shard = g_ptr_array_index(save->shards, i);
+		g_hash_table_insert(used, GUINT_TO_POINTER(shard->file + 1), shard);
+	}
+	for (i = 0; i < save->old->len; i++) {
+		shard = g_ptr_array_index(save->old, i);
+		if (!g_hash_table_lookup(used, GUINT_TO_POINTER(shard->file + 1)))
+			falcon_shard_remove(save->name, shard->file);
+	}
+	g_hash_table_destroy(used);
+}
+
+gboolean falcon_shard_finish(falcon_save_t *save, guint64 *bytes)
+{
+	GPtrArray *dirty = NULL;
+	falcon_shard_t *shard = NULL;
+	gchar *file = NULL;
+	gboolean ret = TRUE;
+	guint64 written = 0;
+	guint i;
+
+	g_return_val_if_fail(save, FALSE);
+
+	if (!save->shards) {
+		if (save->format == FORMAT_IMAGE)
+			ret = falcon_image_save(save->snapshot, save->name);
+		else
+			ret = falcon_snapshot_save(save->snapshot, save->name,
+			                           save->format == FORMAT_COMPRESSED);
+		if (ret)
+			written = falcon_shard_stat(save->name);
+	} else {
+		dirty = g_ptr_array_new();
+		falcon_shard_number(save, dirty);
+		falcon_shard_run(dirty, falcon_shard_save_one, save);
+		for (i = 0; i < dirty->len; i++) {
+			shard = g_ptr_array_index(dirty, i);
+			if (!shard->ret)
+				ret = FALSE;
+		}
+		g_debug(_("Wrote %u of %u cache shards to %s."), dirty->len,
+		        save->shards->len, save->name);
+
+		ret = ret && falcon_shard_write(save);
+		for (i = 0; ret && i < dirty->len; i++) {
+			file = falcon_shard_file(save->name,
+			                         ((falcon_shard_t *)g_ptr_array_index(dirty, i))->file);
+			written += falcon_shard_stat(file);
+			g_free(file);
+		}
+		if (ret)
+			written += falcon_shard_stat(save->name);
+		/* The old manifest still holds, drop what it doesn't know. */
+		for (i = 0; !ret && i < dirty->len; i++) {
+			shard = g_ptr_array_index(dirty, i);
+			falcon_shard_remove(save->name, shard->file);
+		}
+		g_ptr_array_free(dirty, TRUE);
+	}
+
+	if (ret && save->old)
+		falcon_shard_clean(save);
+	if (save->local_changes) {
+		if (ret)
+			g_hash_table_destroy(save->local_changes);
+		else
+			falcon_cache_return_local_changes(save->cache,
+			                                  save->local_changes);
+	}
+
+	if (save->snapshot)
+		falcon_snapshot_free(save->snapshot);
+	if (save->shards)
+		falcon_shard_free_all(save->shards);
+	if (save->current)
+		g_hash_table_destroy(save->current);
+	if (save->old)
+		falcon_shard_free_all(save->old);
+	g_free(save->name);
+	g_free(save);
+
+	if (bytes)
+		*bytes = written;
+
+	return ret;
+}
@@ -0,0 +1,55 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * A cache saved in shards is a manifest at name listing one file per
+ * directory at the shard depth below the topmost objects, each in a cache file
+ * format of its own, and one more file for the objects above them. The files
+ * are read and written on as many threads as there are walkers. A shard whose
+ * digest hasn't changed since the manifest was written keeps its file.
+ */
+
+/* Returns TRUE if name starts like a manifest. */
+gboolean falcon_shard_probe(const gchar *name);
+/* Reads the shards listed in the manifest name into cache. */
+gboolean falcon_shard_load(falcon_cache_t *cache, const gchar *name);
+/* Returns the size of the cache file name, with its shards if it has any. */
+guint64 falcon_shard_size(const gchar *name);
+/*
+ * See falcon_cache_save_begin(). If depth is 0, the whole cache goes into a
+ * single file at name, and the shards of a manifest there are removed.
+ */
+falcon_save_t *falcon_shard_begin(falcon_cache_t *cache, const gchar *name,
+                                  falcon_format_t format, guint depth);
+gboolean falcon_shard_finish(falcon_save_t *save, guint64 *bytes);
+
+#endif
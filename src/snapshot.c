@@ -0,0 +1,212 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+
+#include "snapshot.h"
+#include "stream.h"
+#include "traverse.h"
+
+/* References are taken by as many threads as there are walkers. */
+#define SNAPSHOT_THREADS MAX_WALKERS
+
+/*
+ * Cached objects are never modified, so holding references to them is enough
+ * to keep a consistent view. Each capturing thread fills its own part.
+ */
+struct falcon_snapshot_st {
+	GPtrArray **parts;
+	guint count;
+	guint64 length;
+};
+
+static void falcon_snapshot_take(trie_node_t *node, guint worker,
+                                 gpointer userdata)
+{
+	falcon_snapshot_t *snapshot = (falcon_snapshot_t *)userdata;
+	falcon_object_t *data = trie_data(node);
+
+	if (data)
+		g_ptr_array_add(snapshot->parts[worker], falcon_object_ref(data));
+}
+
+falcon_snapshot_t *falcon_cache_snapshot(falcon_cache_t *cache,
+                                         const gchar *name)
+{
+	falcon_snapshot_t *snapshot = NULL;
+	trie_node_t *node = NULL;
+
+	g_return_val_if_fail(cache, NULL);
+
+	falcon_cache_lock(cache);
+	node = falcon_cache_root(cache);
+	if (name)
+		node = trie_find(node, name);
+	snapshot = falcon_snapshot_node(node);
+	falcon_cache_unlock(cache);
+
+	return snapshot;
+}
+
+falcon_snapshot_t *falcon_snapshot_node(trie_node_t *node)
+{
+	falcon_snapshot_t *snapshot = NULL;
+	guint i;
+
+	snapshot = g_new0(falcon_snapshot_t, 1);
+	snapshot->count = SNAPSHOT_THREADS;
+	snapshot->parts = g_new0(GPtrArray *, snapshot->count);
+	for (i = 0; i < snapshot->count; i++)
+		snapshot->parts[i] = g_ptr_array_new();
+
+	if (node) {
+		falcon_snapshot_take(node, 0, snapshot);
+		falcon_traverse(node, snapshot->count, falcon_snapshot_take, snapshot);
+	}
+
+	for (i = 0; i < snapshot->count; i++)
+		snapshot->length += snapshot->parts[i]->len;
+
+	return snapshot;
+}
+
+falcon_snapshot_t *falcon_snapshot_wrap(GPtrArray *objects)
+{
+	falcon_snapshot_t *snapshot = NULL;
+
+	g_return_val_if_fail(objects, NULL);
+
+	snapshot = g_new0(falcon_snapshot_t, 1);
+	snapshot->count = 1;
+	snapshot->parts = g_new0(GPtrArray *, 1);
+	snapshot->parts[0] = objects;
+	snapshot->length = objects->len;
+
+	return snapshot;
+}
+
+void falcon_snapshot_free(falcon_snapshot_t *snapshot)
+{
+	guint i;
+	guint j;
+
+	g_return_if_fail(snapshot);
+
+	for (i = 0; i < snapshot->count; i++) {
+		for (j = 0; j < snapshot->parts[i]->len; j++)
+			falcon_object_unref(g_ptr_array_index(snapshot->parts[i], j));
+		g_ptr_array_free(snapshot->parts[i], TRUE);
+	}
+	g_free(snapshot->parts);
+	g_free(snapshot);
+}
+
+guint64 falcon_snapshot_length(const falcon_snapshot_t *snapshot)
+{
+	g_return_val_if_fail(snapshot, 0);
+
+	return snapshot->length;
+}
+
+void falcon_snapshot_foreach(const falcon_snapshot_t *snapshot, GFunc func,
+                             gpointer userdata)
+{
+	guint i;
+	guint j;
+
+	g_return_if_fail(snapshot);
+	g_return_if_fail(func);
+
+	for (i = 0; i < snapshot->count; i++)
+		for (j = 0; j < snapshot->parts[i]->len; j++)
+			func(g_ptr_array_index(snapshot->parts[i], j), userdata);
+}
+
+static gint falcon_snapshot_compare(gconstpointer a, gconstpointer b)
+{
+	return falcon_path_compare(
+		falcon_object_get_name(*(falcon_object_t * const *)a),
+		falcon_object_get_name(*(falcon_object_t * const *)b));
+}
+
+GPtrArray *falcon_snapshot_sorted(const falcon_snapshot_t *snapshot)
+{
+	GPtrArray *objects = NULL;
+	guint i;
+	guint j;
+
+	g_return_val_if_fail(snapshot, NULL);
+
+	objects = g_ptr_array_sized_new(snapshot->length);
+	for (i = 0; i < snapshot->count; i++)
+		for (j = 0; j < snapshot->parts[i]->len; j++)
+			g_ptr_array_add(objects, g_ptr_array_index(snapshot->parts[i], j));
+	g_ptr_array_sort(objects, falcon_snapshot_compare);
+
+	return objects;
+}
+
+gboolean falcon_snapshot_save(const falcon_snapshot_t *snapshot,
+                              const gchar *name, gboolean compress)
+{
+	falcon_stream_t *stream = NULL;
+	falcon_object_t *object = NULL;
+	GPtrArray *objects = NULL;
+	const gchar *prev = NULL;
+	gchar *temp = NULL;
+	gboolean ret = TRUE;
+	guint i;
+
+	g_return_val_if_fail(snapshot, FALSE);
+	if (!name)
+		return FALSE;
+
+	/* A crash while writing must not cost the previous file. */
+	temp = g_strconcat(name, ".tmp", NULL);
+	stream = falcon_stream_create(temp, snapshot->length, compress);
+	if (!stream) {
+		g_free(temp);
+		return FALSE;
+	}
+
+	/* In trie order neighbours share most of their names. */
+	objects = falcon_snapshot_sorted(snapshot);
+	for (i = 0; ret && i < objects->len; i++) {
+		object = g_ptr_array_index(objects, i);
+		ret = falcon_object_save(object, prev, stream);
+		prev = falcon_object_get_name(object);
+	}
+	g_ptr_array_free(objects, TRUE);
+
+	/* Closing the stream syncs it. */
+	ret = falcon_stream_close(stream) && ret;
+	if (!falcon_temp_commit(-1, temp, name, ret) && ret) {
+		g_critical(_("Failed to rename %s to %s: %s"), temp, name,
+		           g_strerror(errno));
+		ret = FALSE;
+	}
+	g_free(temp);
+
+	return ret;
+}
@@ -0,0 +1,60 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * Takes a snapshot of the subtree of name, or of the whole cache if name is
+ * NULL. The cache is only locked while the references are taken, which still
+ * takes time linear in the size of the subtree. Returns an empty snapshot if
+ * name is not in the cache.
+ */
+falcon_snapshot_t *falcon_cache_snapshot(falcon_cache_t *cache,
+                                         const gchar *name);
+/*
+ * Same as falcon_cache_snapshot() for the subtree of node, which may be NULL.
+ * The caller must lock the cache.
+ */
+falcon_snapshot_t *falcon_snapshot_node(trie_node_t *node);
+/* Makes a snapshot of objects, taking over the array and its references. */
+falcon_snapshot_t *falcon_snapshot_wrap(GPtrArray *objects);
+/*
+ * Gets the objects in trie order, see falcon_path_compare(). The array holds no
+ * references, it is only valid as long as the snapshot.
+ */
+GPtrArray *falcon_snapshot_sorted(const falcon_snapshot_t *snapshot);
+/*
+ * Writes the snapshot in the streamed cache file format, with the blocks
+ * compressed if compress is TRUE.
+ */
+gboolean falcon_snapshot_save(const falcon_snapshot_t *snapshot,
+                              const gchar *name, gboolean compress);
+
+#endif
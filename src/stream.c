@@ -0,0 +1,450 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "common.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "stream.h"
+
+#define STREAM_MAGIC "FLCN"
+#define STREAM_VERSION 3
+/* The blocks may be compressed. */
+#define STREAM_COMPRESSED (1 << 0)
+#define STREAM_FLAGS STREAM_COMPRESSED
+/* Magic, version, flags, count and the CRC-32C of all of them. */
+#define STREAM_HEADER 20
+/* Length and CRC-32C of the payload. */
+#define STREAM_BLOCK_HEADER 8
+#define STREAM_BLOCK (256 * 1024)
+/*
+ * Set in the length of a compressed block, whose payload is the uncompressed
+ * length followed by the compressed data.
+ */
+#define STREAM_BLOCK_PACKED (1U << 31)
+
+struct falcon_stream_st {
+	gchar *name;
+	int fd;
+	gboolean writing;
+	gboolean failed;
+	guint16 version;
+	guint8 *buffer;				/* Block header and payload */
+	guint8 *packed;				/* Same, compressed */
+	gsize length;				/* Payload in the buffer */
+	gsize offset;				/* Payload consumed by the reader */
+};
+
+static gboolean falcon_stream_write_all(falcon_stream_t *stream,
+                                        const guint8 *data, gsize len)
+{
+	if (falcon_write_all(stream->fd, data, len))
+		return TRUE;
+
+	g_critical(_("Failed to write to file %s: %s"), stream->name,
+	           g_strerror(errno));
+	stream->failed = TRUE;
+
+	return FALSE;
+}
+
+/* Returns the number of bytes read, less than len only at the end. */
+static gssize falcon_stream_read_all(falcon_stream_t *stream, guint8 *data,
+                                     gsize len)
+{
+	gsize done = 0;
+	ssize_t got = 0;
+
+	while (done < len) {
+		got = read(stream->fd, data + done, len - done);
+		if (got == -1) {
+			if (errno == EINTR)
+				continue;
+			g_critical(_("Failed to read cache file %s: %s"), stream->name,
+			           g_strerror(errno));
+			stream->failed = TRUE;
+			return -1;
+		}
+		if (got == 0)
+			break;
+		done += got;
+	}
+
+	return done;
+}
+
+/* Reports a malformed file, message takes the file name. */
+static void falcon_stream_fail(falcon_stream_t *stream, const gchar *message)
+{
+	g_critical(message, stream->name);
+	stream->failed = TRUE;
+}
+
+static falcon_stream_t *falcon_stream_new(const gchar *name, int fd,
+                                          gboolean writing)
+{
+	falcon_stream_t *stream = g_new0(falcon_stream_t, 1);
+
+	stream->name = g_strdup(name);
+	stream->fd = fd;
+	stream->writing = writing;
+	stream->version = STREAM_VERSION;
+	stream->buffer = g_malloc(STREAM_BLOCK_HEADER + STREAM_BLOCK);
+
+	return stream;
+}
+
+static void falcon_stream_free(falcon_stream_t *stream)
+{
+	if (stream->fd != -1)
+		close(stream->fd);
+	g_free(stream->packed);
+	g_free(stream->buffer);
+	g_free(stream->name);
+	g_free(stream);
+}
+
+/* Writes the buffered payload as a block, an empty one ends the file. */
+static gboolean falcon_stream_flush(falcon_stream_t *stream)
+{
+	guint8 *block = stream->buffer;
+	guint32 stored = stream->length;
+	guint32 len = 0;
+	guint32 crc = 0;
+	gsize packed = 0;
+
+	/* A block is only stored compressed if that makes it smaller. */
+	if (stream->packed && stream->length > 5)
+		packed = falcon_lz_compress(stream->buffer + STREAM_BLOCK_HEADER,
+		                            stream->length,
+		                            stream->packed + STREAM_BLOCK_HEADER + 4,
+		                            stream->length - 5);
+	if (packed) {
+		len = GUINT32_TO_BE(stream->length);
+		memcpy(stream->packed + STREAM_BLOCK_HEADER, &len, 4);
+		block = stream->packed;
+		stored = packed + 4;
+	}
+
+	len = GUINT32_TO_BE(stored | (packed ? STREAM_BLOCK_PACKED : 0));
+	crc = GUINT32_TO_BE(falcon_crc32c(0, block + STREAM_BLOCK_HEADER, stored));
+	memcpy(block, &len, 4);
+	memcpy(block + 4, &crc, 4);
+	if (!falcon_stream_write_all(stream, block, STREAM_BLOCK_HEADER + stored))
+		return FALSE;
+	stream->length = 0;
+
+	return TRUE;
+}
+
+/* Reads the next block. At the end of the file the payload is empty. */
+static gboolean falcon_stream_fill(falcon_stream_t *stream)
+{
+	guint8 *block = stream->buffer;
+	gboolean packed = FALSE;
+	guint32 len = 0;
+	guint32 raw = 0;
+	guint32 crc = 0;
+	gssize got = 0;
+
+	got = falcon_stream_read_all(stream, stream->buffer, STREAM_BLOCK_HEADER);
+	if (got == -1)
+		return FALSE;
+	if (got != STREAM_BLOCK_HEADER) {
+		falcon_stream_fail(stream, _("Cache file %s is truncated."));
+		return FALSE;
+	}
+	memcpy(&len, stream->buffer, 4);
+	memcpy(&crc, stream->buffer + 4, 4);
+	len = GUINT32_FROM_BE(len);
+	crc = GUINT32_FROM_BE(crc);
+	packed = (len & STREAM_BLOCK_PACKED) != 0;
+	len &= ~STREAM_BLOCK_PACKED;
+	if (len > STREAM_BLOCK
+	    || (packed && (!stream->packed || len <= 4))) {
+		falcon_stream_fail(stream, _("Cache file %s is corrupted."));
+		return FALSE;
+	}
+	if (packed)
+		block = stream->packed;
+
+	got = falcon_stream_read_all(stream, block + STREAM_BLOCK_HEADER, len);
+	if (got == -1)
+		return FALSE;
+	if ((gsize)got != len) {
+		falcon_stream_fail(stream, _("Cache file %s is truncated."));
+		return FALSE;
+	}
+	if (falcon_crc32c(0, block + STREAM_BLOCK_HEADER, len) != crc) {
+		falcon_stream_fail(stream, _("Cache file %s is corrupted."));
+		return FALSE;
+	}
+
+	if (packed) {
+		memcpy(&raw, block + STREAM_BLOCK_HEADER, 4);
+		raw = GUINT32_FROM_BE(raw);
+		if (raw == 0 || raw > STREAM_BLOCK
+		    || falcon_lz_decompress(block + STREAM_BLOCK_HEADER + 4, len - 4,
+		                            stream->buffer + STREAM_BLOCK_HEADER,
+		                            raw) != raw) {
+			falcon_stream_fail(stream, _("Cache file %s is corrupted."));
+			return FALSE;
+		}
+		len = raw;
+	}
+
+	stream->length = len;
+	stream->offset = 0;
+
+	return TRUE;
+}
+
+falcon_stream_t *falcon_stream_create(const gchar *name, guint64 count,
+                                      gboolean compress)
+{
+	falcon_stream_t *stream = NULL;
+	guint8 header[STREAM_HEADER];
+	guint16 version = GUINT16_TO_BE(STREAM_VERSION);
+	guint16 flags = GUINT16_TO_BE(compress ? STREAM_COMPRESSED : 0);
+	guint32 crc = 0;
+	int fd = 0;
+
+	g_return_val_if_fail(name, NULL);
+
+	fd = g_open(name, O_WRONLY | O_TRUNC | O_CREAT,
+	            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1) {
+		g_critical(_("Failed to open cache file %s: %s"), name,
+		           g_strerror(errno));
+		return NULL;
+	}
+	stream = falcon_stream_new(name, fd, TRUE);
+	if (compress)
+		stream->packed = g_malloc(STREAM_BLOCK_HEADER + STREAM_BLOCK);
+
+	count = GUINT64_TO_BE(count);
+	memcpy(header, STREAM_MAGIC, 4);
+	memcpy(header + 4, &version, 2);
+	memcpy(header + 6, &flags, 2);
+	memcpy(header + 8, &count, 8);
+	crc = GUINT32_TO_BE(falcon_crc32c(0, header, 16));
+	memcpy(header + 16, &crc, 4);
+	if (!falcon_stream_write_all(stream, header, STREAM_HEADER)) {
+		falcon_stream_free(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+falcon_stream_t *falcon_stream_open(const gchar *name, guint64 *count)
+{
+	falcon_stream_t *stream = NULL;
+	guint8 header[STREAM_HEADER];
+	guint16 version = 0;
+	guint16 flags = 0;
+	guint32 crc = 0;
+	gssize got = 0;
+	int fd = 0;
+
+	g_return_val_if_fail(name, NULL);
+	g_return_val_if_fail(count, NULL);
+
+	fd = g_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		g_critical(_("Failed to read cache file %s: %s"), name,
+		           g_strerror(errno));
+		return NULL;
+	}
+	stream = falcon_stream_new(name, fd, FALSE);
+
+	got = falcon_stream_read_all(stream, header, STREAM_HEADER);
+	if (got == STREAM_HEADER && memcmp(header, STREAM_MAGIC, 4) == 0) {
+		memcpy(&version, header + 4, 2);
+		memcpy(&flags, header + 6, 2);
+		memcpy(count, header + 8, 8);
+		memcpy(&crc, header + 16, 4);
+		version = GUINT16_FROM_BE(version);
+		flags = GUINT16_FROM_BE(flags);
+		*count = GUINT64_FROM_BE(*count);
+		crc = GUINT32_FROM_BE(crc);
+
+		if (falcon_crc32c(0, header, 16) != crc) {
+			falcon_stream_fail(stream, _("Cache file %s is corrupted."));
+		} else if (!version || version > STREAM_VERSION
+		           || (flags & ~STREAM_FLAGS)) {
+			g_critical(_("Cache file %s has an unsupported version %u."),
+			           name, version);
+		} else {
+			stream->version = version;
+			if (flags & STREAM_COMPRESSED)
+				stream->packed = g_malloc(STREAM_BLOCK_HEADER + STREAM_BLOCK);
+			return stream;
+		}
+	} else if (got != -1) {
+		g_critical(_("%s is not a cache file."), name);
+	}
+
+	falcon_stream_free(stream);
+
+	return NULL;
+}
+
+guint16 falcon_stream_version(const falcon_stream_t *stream)
+{
+	g_return_val_if_fail(stream, 0);
+
+	return stream->version;
+}
+
+gboolean falcon_stream_write(falcon_stream_t *stream, gconstpointer data,
+                             gsize len)
+{
+	const guint8 *cur = (const guint8 *)data;
+	gsize part = 0;
+
+	g_return_val_if_fail(stream, FALSE);
+	g_return_val_if_fail(stream->writing, FALSE);
+
+	while (!stream->failed && len) {
+		part = MIN(len, STREAM_BLOCK - stream->length);
+		memcpy(stream->buffer + STREAM_BLOCK_HEADER + stream->length, cur,
+		       part);
+		stream->length += part;
+		cur += part;
+		len -= part;
+		if (stream->length == STREAM_BLOCK)
+			falcon_stream_flush(stream);
+	}
+
+	return !stream->failed;
+}
+
+gboolean falcon_stream_read(falcon_stream_t *stream, gpointer data, gsize len)
+{
+	guint8 *cur = (guint8 *)data;
+	gsize part = 0;
+
+	g_return_val_if_fail(stream, FALSE);
+	g_return_val_if_fail(!stream->writing, FALSE);
+
+	while (!stream->failed && len) {
+		if (stream->offset == stream->length) {
+			if (!falcon_stream_fill(stream))
+				break;
+			if (!stream->length) {
+				falcon_stream_fail(stream, _("Cache file %s is truncated."));
+				break;
+			}
+		}
+		part = MIN(len, stream->length - stream->offset);
+		memcpy(cur, stream->buffer + STREAM_BLOCK_HEADER + stream->offset,
+		       part);
+		stream->offset += part;
+		cur += part;
+		len -= part;
+	}
+
+	return !stream->failed;
+}
+
+gboolean falcon_stream_write_varint(falcon_stream_t *stream, guint64 value)
+{
+	guint8 bytes[VARINT_MAX];
+
+	return falcon_stream_write(stream, bytes,
+	                           falcon_varint_encode(bytes, value));
+}
+
+gboolean falcon_stream_read_varint(falcon_stream_t *stream, guint64 *value)
+{
+	guint8 byte = 0;
+	guint shift = 0;
+
+	g_return_val_if_fail(stream, FALSE);
+	g_return_val_if_fail(value, FALSE);
+
+	*value = 0;
+	do {
+		/* Most of them are a byte or two, don't go through a copy. */
+		if (!stream->failed && stream->offset < stream->length)
+			byte = stream->buffer[STREAM_BLOCK_HEADER + stream->offset++];
+		else if (!falcon_stream_read(stream, &byte, 1))
+			return FALSE;
+
+		if (shift == 63 ? byte > 1 : shift > 63) {
+			falcon_stream_fail(stream, _("Cache file %s is corrupted."));
+			return FALSE;
+		}
+		*value |= (guint64)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return TRUE;
+}
+
+gboolean falcon_stream_close(falcon_stream_t *stream)
+{
+	gboolean ret = FALSE;
+	guint8 extra = 0;
+
+	g_return_val_if_fail(stream, FALSE);
+
+	if (stream->failed) {
+		/* Already reported. */
+	} else if (stream->writing) {
+		/* The last partial block, then the empty one. */
+		if ((!stream->length || falcon_stream_flush(stream))
+		    && falcon_stream_flush(stream)) {
+			/* Make it durable before the caller renames it into place. */
+			ret = fsync(stream->fd) == 0;
+			if (close(stream->fd) == -1)
+				ret = FALSE;
+			if (!ret)
+				g_critical(_("Failed to write to file %s: %s"), stream->name,
+				           g_strerror(errno));
+			stream->fd = -1;
+		}
+	} else if (stream->offset != stream->length) {
+		falcon_stream_fail(stream,
+		                   _("Cache file %s has more data than objects."));
+	} else if (falcon_stream_fill(stream)) {
+		if (stream->length)
+			falcon_stream_fail(stream,
+		                   _("Cache file %s has more data than objects."));
+		else if (falcon_stream_read_all(stream, &extra, 1) == 1)
+			falcon_stream_fail(stream, _("Cache file %s has trailing data."));
+		else
+			ret = !stream->failed;
+	}
+
+	falcon_stream_free(stream);
+
+	return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <glib.h>
+
+/*
+ * Buffered reading and writing of cache files. A file starts with a header
+ * holding the magic, the format version, flags and the number of objects,
+ * followed by blocks of up to STREAM_BLOCK bytes, each with its length and
+ * CRC-32C, and ends with an empty block. Objects may span blocks. If the file
+ * is compressed, each block is on its own, see lz.h.
+ *
+ * Every failure is reported once; after that all calls on the stream fail.
+ */
+typedef struct falcon_stream_st falcon_stream_t;
+
+/* Creates or truncates name for writing count objects. */
+falcon_stream_t *falcon_stream_create(const gchar *name, guint64 count,
+                                      gboolean compress);
+/* Opens name for reading and stores the number of objects in count. */
+falcon_stream_t *falcon_stream_open(const gchar *name, guint64 *count);
+/* The format version of the file, the layout of the objects depends on it. */
+guint16 falcon_stream_version(const falcon_stream_t *stream);
+gboolean falcon_stream_write(falcon_stream_t *stream, gconstpointer data,
+                             gsize len);
+/* Reads exactly len bytes, a file ending earlier is an error. */
+gboolean falcon_stream_read(falcon_stream_t *stream, gpointer data, gsize len);
+/* Unsigned integers in 7 bits groups, low ones first, so small ones are short. */
+gboolean falcon_stream_write_varint(falcon_stream_t *stream, guint64 value);
+gboolean falcon_stream_read_varint(falcon_stream_t *stream, guint64 *value);
+/*
+ * Finishes and frees the stream. A written file gets its last blocks, a read
+ * one must end right after the data. Returns FALSE if anything failed.
+ */
+gboolean falcon_stream_close(falcon_stream_t *stream);
+
+#endif
@@ -0,0 +1,452 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "summary.h"
+
+#define FNV_OFFSET G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define FNV_PRIME G_GUINT64_CONSTANT(0x100000001b3)
+
+static falcon_summary_t *falcon_summary_ensure(trie_node_t *node)
+{
+	falcon_summary_t *summary = trie_aux(node);
+
+	if (!summary) {
+		summary = g_new0(falcon_summary_t, 1);
+		trie_set_aux(node, summary);
+	}
+
+	return summary;
+}
+
+static inline guint64 falcon_summary_mix(guint64 h)
+{
+	h ^= h >> 30;
+	h *= G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+	h ^= h >> 27;
+	h *= G_GUINT64_CONSTANT(0x94d049bb133111eb);
+	h ^= h >> 31;
+	return h;
+}
+
+/*
+ * The hash a node contributes to the digest of its parent. It covers the key,
+ * the attributes of object and the digest of the node's own children. object is
+ * passed separately so that the contribution of an old object can be computed
+ * after it has been replaced. An empty node contributes nothing.
+ *
+ * The device, inode and status change time are left out, they only mean
+ * something on the host that took them. The nanosecond modification time is
+ * left out while it isn't known, as falcon_object_equal() ignores it then.
+ */
+static guint64 falcon_summary_hash(const trie_node_t *node,
+                                   const falcon_object_t *object)
+{
+	const falcon_summary_t *summary = trie_aux(node);
+	const gchar *key = trie_key(node);
+	guint64 digest = summary ? summary->digest : 0;
+	guint64 h = FNV_OFFSET;
+
+	if (!object && digest == 0)
+		return 0;
+
+	for (; key && *key; key++) {
+		h ^= (guchar)*key;
+		h *= FNV_PRIME;
+	}
+
+	if (object) {
+		h = falcon_summary_mix(h ^ falcon_object_get_size(object));
+		h = falcon_summary_mix(h ^ falcon_object_get_time(object));
+		h = falcon_summary_mix(h ^ falcon_object_get_mode(object));
+		if (falcon_object_get_mtime(object))
+			h = falcon_summary_mix(h ^ falcon_object_get_mtime(object));
+	}
+
+	return falcon_summary_mix(h + digest);
+}
+
+/*
+ * The digest of a node is the sum of the hashes of its children, so a change
+ * is applied by swapping the old hash for the new one on each level up.
+ */
+static void falcon_summary_update_digest(trie_node_t *node, guint64 old,
+                                         guint64 new)
+{
+	trie_node_t *parent = NULL;
+	falcon_summary_t *summary = NULL;
+	guint64 old_parent = 0;
+
+	for (parent = trie_parent(node); parent && old != new;
+	     parent = trie_parent(parent)) {
+		summary = falcon_summary_ensure(parent);
+		old_parent = falcon_summary_hash(parent, trie_data(parent));
+		summary->digest += new - old;
+		old = old_parent;
+		new = falcon_summary_hash(parent, trie_data(parent));
+	}
+}
+
+/* Newest time of the node itself and all its descendants. */
+static guint64 falcon_summary_node_time(const trie_node_t *node)
+{
+	const falcon_object_t *object = trie_data(node);
+	const falcon_summary_t *summary = trie_aux(node);
+	guint64 time = 0;
+
+	if (object)
+		time = falcon_object_get_time(object);
+	if (summary && summary->time > time)
+		time = summary->time;
+
+	return time;
+}
+
+/*
+ * The maximum can't be decremented in place. Recompute it from the children,
+ * skipping exclude, and go up as long as the value keeps changing.
+ */
+static void falcon_summary_update_time(trie_node_t *parent,
+                                       const trie_node_t *exclude)
+{
+	trie_node_t *child = NULL;
+	falcon_summary_t *summary = NULL;
+	guint64 time = 0;
+
+	for (; parent; parent = trie_parent(parent)) {
+		if (!(summary = trie_aux(parent)))
+			return;
+
+		time = 0;
+		for (child = trie_child(parent); child; child = trie_next(child)) {
+			if (child != exclude)
+				time = MAX(time, falcon_summary_node_time(child));
+		}
+		exclude = NULL;
+
+		if (time == summary->time)
+			return;
+		summary->time = time;
+	}
+}
+
+void falcon_summary_add(trie_node_t *node, const falcon_object_t *object)
+{
+	trie_node_t *parent = NULL;
+	falcon_summary_t *summary = NULL;
+	gboolean isdir = FALSE;
+	guint64 size = 0;
+	guint64 time = 0;
+
+	g_return_if_fail(node);
+	g_return_if_fail(object);
+
+	isdir = falcon_object_isdir(object);
+	size = isdir ? 0 : falcon_object_get_size(object);
+	time = falcon_object_get_time(object);
+
+	for (parent = trie_parent(node); parent; parent = trie_parent(parent)) {
+		summary = falcon_summary_ensure(parent);
+		if (isdir)
+			summary->dirs++;
+		else
+			summary->files++;
+		summary->size += size;
+		if (time > summary->time)
+			summary->time = time;
+	}
+
+	falcon_summary_update_digest(node, falcon_summary_hash(node, NULL),
+	                             falcon_summary_hash(node, object));
+}
+
+/* Sums up the children of node, whose own totals must be right. */
+static void falcon_summary_total(trie_node_t *node)
+{
+	trie_node_t *child = NULL;
+	falcon_summary_t *summary = NULL;
+	const falcon_summary_t *totals = NULL;
+	const falcon_object_t *object = NULL;
+
+	if (!trie_child(node))
+		return;
+
+	summary = falcon_summary_ensure(node);
+	memset(summary, 0, sizeof(falcon_summary_t));
+	for (child = trie_child(node); child; child = trie_next(child)) {
+		if ((object = trie_data(child))) {
+			if (falcon_object_isdir(object)) {
+				summary->dirs++;
+			} else {
+				summary->files++;
+				summary->size += falcon_object_get_size(object);
+			}
+			summary->time = MAX(summary->time, falcon_object_get_time(object));
+		}
+		if ((totals = trie_aux(child))) {
+			summary->files += totals->files;
+			summary->dirs += totals->dirs;
+			summary->size += totals->size;
+			summary->time = MAX(summary->time, totals->time);
+		}
+		summary->digest += falcon_summary_hash(child, object);
+	}
+}
+
+void falcon_summary_build(trie_node_t *node)
+{
+	trie_iter_t iter;
+	trie_node_t *next = NULL;
+
+	g_return_if_fail(node);
+
+	/* Children come before their parent, their totals are final by then. */
+	trie_iter_init(&iter, node, TRIE_POST_ORDER);
+	while ((next = trie_iter_next(&iter)))
+		falcon_summary_total(next);
+	falcon_summary_total(node);
+}
+
+void falcon_summary_replace(trie_node_t *node, const falcon_object_t *old,
+                            const falcon_object_t *object)
+{
+	trie_node_t *parent = NULL;
+	falcon_summary_t *summary = NULL;
+	gboolean old_isdir = FALSE;
+	gboolean isdir = FALSE;
+	guint64 old_size = 0;
+	guint64 size = 0;
+	guint64 old_time = 0;
+	guint64 time = 0;
+
+	g_return_if_fail(node);
+	g_return_if_fail(object);
+
+	if (!old) {
+		falcon_summary_add(node, object);
+		return;
+	}
+
+	old_isdir = falcon_object_isdir(old);
+	isdir = falcon_object_isdir(object);
+	old_size = old_isdir ? 0 : falcon_object_get_size(old);
+	size = isdir ? 0 : falcon_object_get_size(object);
+	old_time = falcon_object_get_time(old);
+	time = falcon_object_get_time(object);
+
+	falcon_summary_update_digest(node, falcon_summary_hash(node, old),
+	                             falcon_summary_hash(node, object));
+
+	if (old_isdir == isdir && old_size == size && old_time == time)
+		return;
+
+	for (parent = trie_parent(node); parent; parent = trie_parent(parent)) {
+		summary = falcon_summary_ensure(parent);
+		if (old_isdir != isdir) {
+			if (isdir) {
+				summary->files--;
+				summary->dirs++;
+			} else {
+				summary->dirs--;
+				summary->files++;
+			}
+		}
+		summary->size = summary->size - old_size + size;
+		if (time > summary->time)
+			summary->time = time;
+	}
+
+	if (time < old_time)
+		falcon_summary_update_time(trie_parent(node), NULL);
+}
+
+/* Gets the totals of node itself and all its descendants. */
+static void falcon_summary_subtree(const trie_node_t *node,
+                                   falcon_summary_t *totals)
+{
+	const falcon_object_t *object = NULL;
+
+	falcon_summary_get(node, totals);
+	if ((object = trie_data(node))) {
+		if (falcon_object_isdir(object)) {
+			totals->dirs++;
+		} else {
+			totals->files++;
+			totals->size += falcon_object_get_size(object);
+		}
+		totals->time = MAX(totals->time, falcon_object_get_time(object));
+	}
+}
+
+void falcon_summary_graft(trie_node_t *node)
+{
+	trie_node_t *parent = NULL;
+	falcon_summary_t *summary = NULL;
+	falcon_summary_t added;
+
+	g_return_if_fail(node);
+
+	falcon_summary_subtree(node, &added);
+	for (parent = trie_parent(node); parent; parent = trie_parent(parent)) {
+		summary = falcon_summary_ensure(parent);
+		summary->files += added.files;
+		summary->dirs += added.dirs;
+		summary->size += added.size;
+		summary->time = MAX(summary->time, added.time);
+	}
+
+	/* The node was empty before, it added nothing to the digests. */
+	falcon_summary_update_digest(node, 0,
+	                             falcon_summary_hash(node, trie_data(node)));
+}
+
+void falcon_summary_remove(trie_node_t *node)
+{
+	trie_node_t *parent = NULL;
+	falcon_summary_t *summary = NULL;
+	falcon_summary_t removed;
+
+	g_return_if_fail(node);
+
+	falcon_summary_update_digest(node, falcon_summary_hash(node, trie_data(node)),
+	                             0);
+
+	falcon_summary_subtree(node, &removed);
+	for (parent = trie_parent(node); parent; parent = trie_parent(parent)) {
+		if (!(summary = trie_aux(parent)))
+			continue;
+		summary->files -= removed.files;
+		summary->dirs -= removed.dirs;
+		summary->size -= removed.size;
+	}
+
+	/* Only the removal of the newest entry changes the maximum. */
+	parent = trie_parent(node);
+	summary = trie_aux(parent);
+	if (summary && removed.time >= summary->time)
+		falcon_summary_update_time(parent, node);
+}
+
+void falcon_summary_get(const trie_node_t *node, falcon_summary_t *summary)
+{
+	const falcon_summary_t *totals = trie_aux(node);
+
+	g_return_if_fail(summary);
+
+	if (totals)
+		*summary = *totals;
+	else
+		memset(summary, 0, sizeof(falcon_summary_t));
+}
+
+guint64 falcon_summary_digest(const trie_node_t *node)
+{
+	g_return_val_if_fail(node, 0);
+
+	return falcon_summary_hash(node, trie_data(node));
+}
+
+void falcon_summary_free(void *summary)
+{
+	g_free(summary);
+}
+
+/* Reports node and all its descendants as existing on one side only. */
+static void falcon_summary_diff_one(const trie_node_t *node, gboolean left,
+                                    falcon_diff_func func, gpointer userdata)
+{
+	trie_iter_t iter;
+	const trie_node_t *child = node;
+	falcon_object_t *object = NULL;
+
+	trie_iter_init(&iter, (trie_node_t *)node, TRIE_PRE_ORDER);
+	do {
+		if ((object = trie_data(child)))
+			func(left ? object : NULL, left ? NULL : object, userdata);
+	} while ((child = trie_iter_next(&iter)));
+}
+
+void falcon_summary_diff(const trie_node_t *a, const trie_node_t *b,
+                         falcon_diff_func func, gpointer userdata)
+{
+	GHashTable *children = NULL;
+	GHashTable *matched = NULL;
+	const trie_node_t *child = NULL;
+	const trie_node_t *other = NULL;
+	const falcon_summary_t *summary_a = NULL;
+	const falcon_summary_t *summary_b = NULL;
+	falcon_object_t *object_a = NULL;
+	falcon_object_t *object_b = NULL;
+
+	g_return_if_fail(func);
+
+	if (!a || !b) {
+		if (a)
+			falcon_summary_diff_one(a, TRUE, func, userdata);
+		if (b)
+			falcon_summary_diff_one(b, FALSE, func, userdata);
+		return;
+	}
+
+	object_a = trie_data(a);
+	object_b = trie_data(b);
+	if ((object_a || object_b)
+	    && (!object_a || !object_b || !falcon_object_equal(object_a, object_b)))
+		func(object_a, object_b, userdata);
+
+	summary_a = trie_aux(a);
+	summary_b = trie_aux(b);
+	if ((summary_a ? summary_a->digest : 0) == (summary_b ? summary_b->digest : 0))
+		return;
+
+	/* Only the children with different hashes are worth descending into. */
+	children = g_hash_table_new(g_str_hash, g_str_equal);
+	matched = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (child = trie_child(b); child; child = trie_next(child))
+		g_hash_table_insert(children, (gpointer)trie_key(child),
+		                    (gpointer)child);
+
+	for (child = trie_child(a); child; child = trie_next(child)) {
+		other = g_hash_table_lookup(children, trie_key(child));
+		if (!other) {
+			falcon_summary_diff_one(child, TRUE, func, userdata);
+			continue;
+		}
+
+		g_hash_table_insert(matched, (gpointer)other, (gpointer)other);
+		if (falcon_summary_hash(child, trie_data(child))
+		    != falcon_summary_hash(other, trie_data(other)))
+			falcon_summary_diff(child, other, func, userdata);
+	}
+
+	for (child = trie_child(b); child; child = trie_next(child)) {
+		if (!g_hash_table_lookup(matched, child))
+			falcon_summary_diff_one(child, FALSE, func, userdata);
+	}
+
+	g_hash_table_unref(matched);
+	g_hash_table_unref(children);
+}
@@ -0,0 +1,89 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _SUMMARY_H_
+#define _SUMMARY_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "object.h"
+#include "trie.h"
+
+/*
+ * Rolled-up totals of the cache. Each trie node that has children carries a
+ * falcon_summary_t of all its descendants in its auxiliary pointer. The totals
+ * are updated on the way up from a changed node, so a query never has to walk
+ * the subtree.
+ *
+ * The digest is a Merkle-style hash of the subtree: the sum of the hashes of
+ * the children, where the hash of a child covers its key, size, time, mode,
+ * nanosecond modification time and its own digest. Two subtrees with the same
+ * digest are identical, so a comparison only has to descend where the digests
+ * differ. The device, inode and status change time are left out so that the
+ * digest can be compared between hosts.
+ *
+ * The caller must hold the cache lock.
+ */
+
+/* Accounts for an object that has just been stored at node. */
+void falcon_summary_add(trie_node_t *node, const falcon_object_t *object);
+/*
+ * Accounts for the object at node being replaced by a new one. The node must
+ * already hold the new object.
+ */
+void falcon_summary_replace(trie_node_t *node, const falcon_object_t *old,
+                            const falcon_object_t *object);
+/*
+ * Computes the totals of node and all its descendants in one pass, for a
+ * subtree filled without falcon_summary_add().
+ */
+void falcon_summary_build(trie_node_t *node);
+/*
+ * Accounts for node having been given an object and descendants at once, whose
+ * own totals must be right, see trie_graft(). The node must have been empty.
+ */
+void falcon_summary_graft(trie_node_t *node);
+/*
+ * Accounts for node and all its descendants being removed. This has to be
+ * called before the node is deleted from the trie.
+ */
+void falcon_summary_remove(trie_node_t *node);
+/* Gets the totals of the descendants of node. */
+void falcon_summary_get(const trie_node_t *node, falcon_summary_t *summary);
+/*
+ * What node adds to the digest of its parent, covering its object and all its
+ * descendants. The watchability flags are not part of it.
+ */
+guint64 falcon_summary_digest(const trie_node_t *node);
+void falcon_summary_free(void *summary);
+/*
+ * Compares the subtrees of a and b, which must be the nodes of the same path in
+ * two tries, and calls func for each object that differs. Either node may be
+ * NULL.
+ */
+void falcon_summary_diff(const trie_node_t *a, const trie_node_t *b,
+                         falcon_diff_func func, gpointer userdata);
+
+#endif
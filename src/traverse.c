@@ -0,0 +1,394 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+
+#include "common.h"
+#include "summary.h"
+#include "traverse.h"
+
+/* Subtrees smaller than this are not worth a task of their own. */
+#define MIN_GRAIN 1024
+#define TASKS_PER_THREAD 8
+
+typedef struct {
+	GMutex *lock;
+	GQueue tasks;				/* The owner works at the tail, thieves at the head */
+} falcon_deque_t;
+
+/*
+ * Shared with the helpers, which may only get a thread after the traversal is
+ * over, so it lives until the last of them lets it go.
+ */
+typedef struct {
+	trie_node_t *root;
+	falcon_traverse_func func;
+	gpointer userdata;
+	guint64 grain;
+	guint threads;
+	falcon_deque_t *deques;
+	volatile gint pending;		/* Tasks pushed and not finished yet */
+	volatile gint queued;		/* Tasks pushed and not taken yet */
+	volatile gint ref_count;
+	GMutex *lock;				/* Idle workers wait on cond with it */
+	GCond *cond;
+} falcon_traverse_t;
+
+typedef struct {
+	falcon_traverse_t *traverse;
+	guint id;
+} falcon_worker_t;
+
+/*
+ * A node whose children were cut into tasks. It is visited by the thread that
+ * finishes the last of them, so that it still comes after its descendants.
+ */
+typedef struct falcon_join_st {
+	trie_node_t *node;
+	struct falcon_join_st *parent;
+	volatile gint remaining;	/* Tasks and nested joins not finished yet */
+} falcon_join_t;
+
+/* A run of siblings, each to be visited with its whole subtree. */
+typedef struct {
+	trie_node_t *first;
+	guint count;
+	falcon_join_t *join;		/* The parent of the siblings */
+} falcon_task_t;
+
+/* Helper threads, kept across traversals. */
+static GThreadPool *helpers = NULL;
+static GMutex *helpers_lock = NULL;
+
+static guint64 falcon_traverse_size(const trie_node_t *node)
+{
+	falcon_summary_t summary;
+
+	falcon_summary_get(node, &summary);
+	return summary.files + summary.dirs;
+}
+
+static void falcon_traverse_push(falcon_traverse_t *traverse, guint id,
+                                 falcon_join_t *join, trie_node_t *first,
+                                 guint count)
+{
+	falcon_deque_t *deque = &traverse->deques[id];
+	falcon_task_t *task = g_new(falcon_task_t, 1);
+
+	task->first = first;
+	task->count = count;
+	task->join = join;
+	g_atomic_int_inc(&join->remaining);
+
+	/* Counted first, so that a thief never takes it below zero. */
+	g_atomic_int_inc(&traverse->pending);
+	g_atomic_int_inc(&traverse->queued);
+	g_mutex_lock(deque->lock);
+	g_queue_push_tail(&deque->tasks, task);
+	g_mutex_unlock(deque->lock);
+
+	g_mutex_lock(traverse->lock);
+	g_cond_signal(traverse->cond);
+	g_mutex_unlock(traverse->lock);
+}
+
+static falcon_task_t *falcon_traverse_pop(falcon_traverse_t *traverse,
+                                          guint id)
+{
+	falcon_deque_t *deque = NULL;
+	falcon_task_t *task = NULL;
+	guint i;
+
+	deque = &traverse->deques[id];
+	g_mutex_lock(deque->lock);
+	task = g_queue_pop_tail(&deque->tasks);
+	g_mutex_unlock(deque->lock);
+
+	/* Steal the oldest task of another thread, it's likely the biggest. */
+	for (i = 1; !task && i < traverse->threads; i++) {
+		deque = &traverse->deques[(id + i) % traverse->threads];
+		g_mutex_lock(deque->lock);
+		task = g_queue_pop_head(&deque->tasks);
+		g_mutex_unlock(deque->lock);
+	}
+	if (task)
+		g_atomic_int_add(&traverse->queued, -1);
+
+	return task;
+}
+
+/* Calls func on node and its descendants in post-order on this thread. */
+static void falcon_traverse_subtree(falcon_traverse_t *traverse, guint id,
+                                    trie_node_t *node)
+{
+	trie_iter_t iter;
+	trie_node_t *cur = NULL;
+	trie_node_t *next = NULL;
+
+	trie_iter_init(&iter, node, TRIE_POST_ORDER);
+	next = trie_iter_next(&iter);
+	while ((cur = next)) {
+		next = trie_iter_next(&iter);
+		traverse->func(cur, id, traverse->userdata);
+	}
+
+	if (node != traverse->root)
+		traverse->func(node, id, traverse->userdata);
+}
+
+/*
+ * Drops a reference on join. The last one visits its node and drops the
+ * reference the node held on the join above it.
+ */
+static void falcon_traverse_release(falcon_traverse_t *traverse, guint id,
+                                    falcon_join_t *join)
+{
+	falcon_join_t *parent = NULL;
+
+	while (join && g_atomic_int_dec_and_test(&join->remaining)) {
+		if (join->node != traverse->root)
+			traverse->func(join->node, id, traverse->userdata);
+		parent = join->parent;
+		g_free(join);
+		join = parent;
+	}
+}
+
+/*
+ * Visits node and its descendants. The children of a big node are cut into
+ * runs of about grain nodes each, which become tasks other threads can steal,
+ * and the node itself is left to whichever thread finishes them last.
+ */
+static void falcon_traverse_node(falcon_traverse_t *traverse, guint id,
+                                 trie_node_t *node, falcon_join_t *parent)
+{
+	falcon_join_t *join = NULL;
+	trie_node_t *child = NULL;
+	trie_node_t *first = NULL;
+	guint64 size = 0;
+	guint count = 0;
+
+	if (falcon_traverse_size(node) < traverse->grain) {
+		falcon_traverse_subtree(traverse, id, node);
+		return;
+	}
+
+	/* Held until all the runs are pushed, so they can't finish it early. */
+	join = g_new(falcon_join_t, 1);
+	join->node = node;
+	join->parent = parent;
+	join->remaining = 1;
+	if (parent)
+		g_atomic_int_inc(&parent->remaining);
+
+	/* Read the links before the children can be taken by another thread. */
+	child = trie_child(node);
+	while (child) {
+		if (!first)
+			first = child;
+		size += falcon_traverse_size(child) + 1;
+		count++;
+		child = trie_next(child);
+		if (size >= traverse->grain || !child) {
+			falcon_traverse_push(traverse, id, join, first, count);
+			first = NULL;
+			size = 0;
+			count = 0;
+		}
+	}
+
+	falcon_traverse_release(traverse, id, join);
+}
+
+static void falcon_traverse_task(falcon_traverse_t *traverse, guint id,
+                                 falcon_task_t *task)
+{
+	trie_node_t *node = task->first;
+	trie_node_t *next = NULL;
+	guint i;
+
+	for (i = 0; i < task->count; i++, node = next) {
+		next = trie_next(node);
+		falcon_traverse_node(traverse, id, node, task->join);
+	}
+
+	falcon_traverse_release(traverse, id, task->join);
+}
+
+static void falcon_traverse_unref(falcon_traverse_t *traverse)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&traverse->ref_count))
+		return;
+
+	for (i = 0; i < traverse->threads; i++)
+		g_mutex_free(traverse->deques[i].lock);
+	g_cond_free(traverse->cond);
+	g_mutex_free(traverse->lock);
+	g_free(traverse->deques);
+	g_free(traverse);
+}
+
+/* Runs tasks until all of them are finished, waiting while there are none. */
+static void falcon_traverse_worker(falcon_traverse_t *traverse, guint id)
+{
+	falcon_task_t *task = NULL;
+
+	while (g_atomic_int_get(&traverse->pending) > 0) {
+		if ((task = falcon_traverse_pop(traverse, id))) {
+			falcon_traverse_task(traverse, id, task);
+			g_free(task);
+			if (g_atomic_int_dec_and_test(&traverse->pending)) {
+				g_mutex_lock(traverse->lock);
+				g_cond_broadcast(traverse->cond);
+				g_mutex_unlock(traverse->lock);
+			}
+			continue;
+		}
+
+		/* A push or the last task finishing wakes us up. */
+		g_mutex_lock(traverse->lock);
+		while (g_atomic_int_get(&traverse->queued) == 0
+		       && g_atomic_int_get(&traverse->pending) > 0)
+			g_cond_wait(traverse->cond, traverse->lock);
+		g_mutex_unlock(traverse->lock);
+	}
+}
+
+static void falcon_traverse_helper(gpointer data,
+                                   gpointer userdata ATTRIBUTE_UNUSED)
+{
+	falcon_worker_t *worker = (falcon_worker_t *)data;
+
+	falcon_traverse_worker(worker->traverse, worker->id);
+	falcon_traverse_unref(worker->traverse);
+	g_free(worker);
+}
+
+static gpointer falcon_traverse_init(gpointer data ATTRIBUTE_UNUSED)
+{
+	GError *error = NULL;
+
+	helpers_lock = g_mutex_new();
+	helpers = g_thread_pool_new(falcon_traverse_helper, NULL, 1, TRUE,
+	                            &error);
+	if (!helpers) {
+		g_warning(_("Failed to start a traversal thread: %s"),
+		          error->message);
+		g_error_free(error);
+	}
+
+	return NULL;
+}
+
+/* Makes sure there are count helper threads, returns FALSE if there are none. */
+static gboolean falcon_traverse_helpers(guint count)
+{
+	static GOnce once = G_ONCE_INIT;
+	GError *error = NULL;
+
+	g_once(&once, falcon_traverse_init, NULL);
+	if (!helpers)
+		return FALSE;
+
+	g_mutex_lock(helpers_lock);
+	if ((guint)g_thread_pool_get_max_threads(helpers) < count)
+		g_thread_pool_set_max_threads(helpers, count, &error);
+	if (error) {
+		g_warning(_("Failed to start a traversal thread: %s"),
+		          error->message);
+		g_clear_error(&error);
+	}
+	g_mutex_unlock(helpers_lock);
+
+	return TRUE;
+}
+
+void falcon_traverse(trie_node_t *root, guint threads,
+                     falcon_traverse_func func, gpointer userdata)
+{
+	falcon_traverse_t *traverse = NULL;
+	falcon_traverse_t single;
+	falcon_worker_t *worker = NULL;
+	GError *error = NULL;
+	guint64 total = 0;
+	guint64 grain = 0;
+	guint i;
+
+	g_return_if_fail(func);
+
+	if (!root)
+		return;
+
+	threads = MAX(threads, 1);
+	total = falcon_traverse_size(root);
+	grain = MAX(total / (threads * TASKS_PER_THREAD), MIN_GRAIN);
+
+	if (threads == 1 || total < 2 * grain
+	    || !falcon_traverse_helpers(threads - 1)) {
+		single.root = root;
+		single.func = func;
+		single.userdata = userdata;
+		falcon_traverse_subtree(&single, 0, root);
+		return;
+	}
+
+	traverse = g_new0(falcon_traverse_t, 1);
+	traverse->root = root;
+	traverse->func = func;
+	traverse->userdata = userdata;
+	traverse->threads = threads;
+	traverse->grain = grain;
+	traverse->ref_count = 1;
+	traverse->lock = g_mutex_new();
+	traverse->cond = g_cond_new();
+	traverse->deques = g_new0(falcon_deque_t, threads);
+	for (i = 0; i < threads; i++) {
+		traverse->deques[i].lock = g_mutex_new();
+		g_queue_init(&traverse->deques[i].tasks);
+	}
+
+	falcon_traverse_node(traverse, 0, root, NULL);
+
+	/* The calling thread is worker 0, the others help out. */
+	for (i = 1; i < threads; i++) {
+		worker = g_new(falcon_worker_t, 1);
+		worker->traverse = traverse;
+		worker->id = i;
+		g_atomic_int_inc(&traverse->ref_count);
+		g_thread_pool_push(helpers, worker, &error);
+		if (error) {
+			g_warning(_("Failed to start a traversal thread: %s"),
+			          error->message);
+			g_clear_error(&error);
+			g_atomic_int_add(&traverse->ref_count, -1);
+			g_free(worker);
+		}
+	}
+	falcon_traverse_worker(traverse, 0);
+
+	/* The tasks are done, helpers still on their way out drop the rest. */
+	falcon_traverse_unref(traverse);
+}
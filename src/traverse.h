@@ -0,0 +1,52 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _TRAVERSE_H_
+#define _TRAVERSE_H_
+
+#include <glib.h>
+
+#include "trie.h"
+
+/* worker identifies the calling thread, from 0 to threads - 1. */
+typedef void (*falcon_traverse_func)(trie_node_t *node, guint worker,
+                                     gpointer userdata);
+
+/*
+ * Calls func on every descendant of root, using up to threads threads
+ * including the calling one. The subtrees are handed out as tasks, sized by the
+ * summaries of the nodes, and idle threads steal tasks from busy ones. The
+ * helper threads are started on first use and kept for later calls.
+ *
+ * Children come before their parent, also when they were handed out as tasks:
+ * such a parent is visited by the thread that finishes the last of them. So
+ * func may free the node it is given. Nodes that are not descendants of one
+ * another may be visited at the same time, so func must not write anything
+ * they share, such as the totals of their common ancestors. The caller has to
+ * keep the tree from changing in any other way meanwhile.
+ */
+void falcon_traverse(trie_node_t *root, guint threads,
+                     falcon_traverse_func func, gpointer userdata);
+
+#endif
@@ -27,6 +27,12 @@
 
 #include "trie.h"
 
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
 struct trie_node {
 	trie_node_t *parent;
 	trie_node_t *child;
@@ -34,26 +40,21 @@ struct trie_node {
 	trie_node_t *next;
 	char *delim;
 	size_t len;					/* Length of the delimiter or the key */
-	char *key;
+	char *key;					/* Stored right after the node */
 	void *data;
+	void *aux;
 };
 
 static trie_node_t *new_node(const char *token, size_t len)
 {
 	trie_node_t *node = NULL;
-	char *key = NULL;
-
-	if (token && len > 0) {
-		key = calloc(1, len + 1);
-		if (!key)
-			return NULL;
-		memcpy(key, token, len);
-	}
 
-	node = calloc(1, sizeof(trie_node_t));
-	if (node) {
-		node->key = key;
+	/* One allocation for the node and its key. */
+	node = calloc(1, sizeof(trie_node_t) + (len > 0 ? len + 1 : 0));
+	if (node && len > 0) {
+		node->key = (char *)(node + 1);
 		node->len = len;
+		memcpy(node->key, token, len);
 	}
 
 	return node;
@@ -71,7 +72,7 @@ static trie_node_t *find_child(trie_node_t *node, const char *key, size_t len)
 
 	cur = node;
 	while (cur) {
-		if (memcmp(cur->key, key, cur->len > len ? cur->len : len) == 0)
+		if (cur->len == len && memcmp(cur->key, key, len) == 0)
 			break;
 		cur = cur->next;
 	}
@@ -79,6 +80,16 @@ static trie_node_t *find_child(trie_node_t *node, const char *key, size_t len)
 	return cur;
 }
 
+/* Makes node the first child of parent. */
+static void link_child(trie_node_t *parent, trie_node_t *node)
+{
+	node->next = parent->child;
+	node->parent = parent;
+	parent->child = node;
+	if (node->next)
+		node->next->prev = node;
+}
+
 /* If create is 1, create nodes on the way of searching. */
 static trie_node_t *find_and_create(trie_node_t *root, const char *key,
                                     int create)
@@ -110,11 +121,7 @@ static trie_node_t *find_and_create(trie_node_t *root, const char *key,
 			if (!cur)
 				return NULL;
 
-			cur->next = parent->child;
-			cur->parent = parent;
-			parent->child = cur;
-			if (cur->next)
-				cur->next->prev = cur;
+			link_child(parent, cur);
 		}
 		parent = cur;
 
@@ -132,13 +139,15 @@ static trie_node_t *find_and_create(trie_node_t *root, const char *key,
 	return cur;
 }
 
-static void foreach(trie_node_t *node, trie_func func, void *udata)
+/* Goes down to the first leaf under node, inclusive. */
+static trie_node_t *first_leaf(trie_node_t *node)
 {
-	for (; node; node = node->next) {
-		foreach(node->child, func, udata);
-		if (node->data)
-			func(node, udata);
+	while (node->child) {
+		PREFETCH(node->next);
+		node = node->child;
 	}
+
+	return node;
 }
 
 trie_node_t *trie_new(const char *delim, size_t len)
@@ -164,24 +173,28 @@ trie_node_t *trie_new(const char *delim, size_t len)
 
 void trie_free(trie_node_t *root, trie_free_func func)
 {
+	trie_free_full(root, func, NULL);
+}
+
+void trie_free_full(trie_node_t *root, trie_free_func func,
+                    trie_free_func aux_func)
+{
+	trie_iter_t iter;
 	trie_node_t *cur = NULL;
 	trie_node_t *next = NULL;
 
 	if (!root)
 		return;
 
-	cur = root->child;
-	while (cur) {
-		next = cur->next;
-		trie_free(cur, func);
-		cur = next;
+	trie_iter_init(&iter, root, TRIE_POST_ORDER);
+	next = trie_iter_next(&iter);
+	while ((cur = next)) {
+		/* Move on before the node goes away. */
+		next = trie_iter_next(&iter);
+		trie_free_node(cur, func, aux_func);
 	}
 
-	if (func && root->data)
-		func(root->data);
-	free(root->key);
-	free(root->delim);
-	free(root);
+	trie_free_node(root, func, aux_func);
 }
 
 int trie_add(trie_node_t *root, const char *key, void *data)
@@ -195,34 +208,222 @@ int trie_add(trie_node_t *root, const char *key, void *data)
 	return 0;
 }
 
+trie_node_t *trie_insert(trie_node_t *root, const char *key)
+{
+	return find_and_create(root, key, 1);
+}
+
 int trie_delete(trie_node_t *root, const char *key, trie_free_func func)
 {
 	trie_node_t *node = find_and_create(root, key, 0);
 	if (!node)
 		return -1;
 
+	trie_delete_node(node, func, NULL);
+
+	return 0;
+}
+
+void trie_delete_node(trie_node_t *node, trie_free_func func,
+                      trie_free_func aux_func)
+{
+	if (!node)
+		return;
+
+	trie_unlink(node);
+	trie_free_full(node, func, aux_func);
+}
+
+void trie_unlink(trie_node_t *node)
+{
+	if (!node)
+		return;
+
 	if (node->parent && node->parent->child == node)
 		node->parent->child = node->next;
 	if (node->prev)
 		node->prev->next = node->next;
 	if (node->next)
 		node->next->prev = node->prev;
-	trie_free(node, func);
+	node->parent = NULL;
+	node->prev = NULL;
+	node->next = NULL;
+}
+
+int trie_graft(trie_node_t *node, trie_node_t *from)
+{
+	trie_node_t *child = NULL;
+
+	if (!node || !from || node == from || node->child || node->data
+	    || node->aux)
+		return -1;
+
+	node->child = from->child;
+	node->data = from->data;
+	node->aux = from->aux;
+	for (child = node->child; child; child = child->next)
+		child->parent = node;
+	from->child = NULL;
+	from->data = NULL;
+	from->aux = NULL;
 
 	return 0;
 }
 
+void trie_free_node(trie_node_t *node, trie_free_func func,
+                    trie_free_func aux_func)
+{
+	if (!node)
+		return;
+
+	if (func && node->data)
+		func(node->data);
+	if (aux_func && node->aux)
+		aux_func(node->aux);
+	/* Only the root owns the delimiter. */
+	if (!node->key)
+		free(node->delim);
+	free(node);
+}
+
 trie_node_t *trie_find(trie_node_t *root, const char *key)
 {
 	return find_and_create(root, key, 0);
 }
 
+trie_node_t *trie_find_child(const trie_node_t *node, const char *key)
+{
+	if (!node || !key)
+		return NULL;
+
+	return find_child(node->child, key, strlen(key));
+}
+
+trie_node_t *trie_insert_child(trie_node_t *node, const char *key)
+{
+	if (!key)
+		return NULL;
+
+	return trie_insert_child_len(node, key, strlen(key));
+}
+
+trie_node_t *trie_insert_child_len(trie_node_t *node, const char *key,
+                                   size_t len)
+{
+	trie_node_t *cur = NULL;
+
+	if (!node || !key || len == 0)
+		return NULL;
+
+	cur = find_child(node->child, key, len);
+	if (!cur && (cur = new_node(key, len)))
+		link_child(node, cur);
+
+	return cur;
+}
+
+trie_node_t *trie_append_child_len(trie_node_t *node, const char *key,
+                                   size_t len)
+{
+	trie_node_t *cur = NULL;
+
+	if (!node || !key || len == 0)
+		return NULL;
+
+	/* New children are linked first, the last one added is the first. */
+	cur = node->child;
+	if (cur && cur->len == len && memcmp(cur->key, key, len) == 0)
+		return cur;
+
+	if ((cur = new_node(key, len)))
+		link_child(node, cur);
+
+	return cur;
+}
+
+trie_node_t *trie_find_child_len(const trie_node_t *node, const char *key,
+                                 size_t len)
+{
+	if (!node || !key)
+		return NULL;
+
+	return find_child(node->child, key, len);
+}
+
 void trie_foreach(trie_node_t *root, trie_func func, void *udata)
 {
+	trie_iter_t iter;
+	trie_node_t *node = NULL;
+
 	if (!root || !func)
 		return;
 
-	foreach(root->child, func, udata);
+	trie_iter_init(&iter, root, TRIE_POST_ORDER);
+	while ((node = trie_iter_next(&iter)))
+		if (node->data)
+			func(node, udata);
+}
+
+void trie_iter_init(trie_iter_t *iter, trie_node_t *root, trie_order_t order)
+{
+	if (!iter)
+		return;
+
+	iter->root = root;
+	iter->node = NULL;
+	iter->order = order;
+	iter->started = 0;
+	iter->skip = 0;
+}
+
+/*
+ * The parent pointers lead back up the tree, so no stack is needed. The
+ * iterator only remembers the node returned last.
+ */
+trie_node_t *trie_iter_next(trie_iter_t *iter)
+{
+	trie_node_t *node = NULL;
+
+	if (!iter || !iter->root)
+		return NULL;
+
+	if (!iter->started) {
+		iter->started = 1;
+		node = iter->root->child;
+		if (node && iter->order == TRIE_POST_ORDER)
+			node = first_leaf(node);
+	} else if (!(node = iter->node)) {
+		return NULL;
+	} else if (iter->order == TRIE_POST_ORDER) {
+		if (node->next)
+			node = first_leaf(node->next);
+		else if ((node = node->parent) == iter->root)
+			node = NULL;
+	} else if (node->child && !iter->skip) {
+		node = node->child;
+	} else {
+		while (node != iter->root && !node->next)
+			node = node->parent;
+		node = node == iter->root ? NULL : node->next;
+	}
+
+	if (node && iter->order == TRIE_PRE_ORDER) {
+		PREFETCH(node->child);
+		PREFETCH(node->next);
+	}
+
+	iter->node = node;
+	iter->skip = 0;
+
+	return node;
+}
+
+void trie_iter_skip(trie_iter_t *iter)
+{
+	if (!iter)
+		return;
+
+	iter->skip = 1;
 }
 
 const char *trie_key(const trie_node_t *node)
@@ -249,6 +450,22 @@ void trie_set_data(trie_node_t *node, void *data)
 	node->data = data;
 }
 
+void *trie_aux(const trie_node_t *node)
+{
+	if (!node)
+		return NULL;
+
+	return node->aux;
+}
+
+void trie_set_aux(trie_node_t *node, void *aux)
+{
+	if (!node)
+		return;
+
+	node->aux = aux;
+}
+
 trie_node_t *trie_parent(const trie_node_t *node)
 {
 	if (!node)
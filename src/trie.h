@@ -27,7 +27,8 @@
  * thread-safe!
  *
  * The data of each node is stored in the "data" field, and the key is in the
- * "key" field.
+ * "key" field. Each node can also carry an auxiliary pointer for bookkeeping
+ * that is not part of the data, e.g. totals of the subtree.
  */
 
 #ifndef _TRIE_H_
@@ -39,6 +40,9 @@ typedef void (*trie_func)(trie_node_t *node, void *udata);
 
 trie_node_t *trie_new(const char *delim, size_t len);
 void trie_free(trie_node_t *root, trie_free_func func);
+/* Same as trie_free(), aux_func is called on the auxiliary pointers. */
+void trie_free_full(trie_node_t *root, trie_free_func func,
+                    trie_free_func aux_func);
 
 /*
  * Adds a node with key to the tree. If the node already exists, it updates the
@@ -47,20 +51,99 @@ void trie_free(trie_node_t *root, trie_free_func func);
  * 0 is returned on success, otherwise -1 is returned.
  */
 int trie_add(trie_node_t *root, const char *key, void *data);
+/*
+ * Finds the node with key, creating it and the nodes on the way if necessary.
+ * The data of the node is left untouched.
+ *
+ * NULL is returned on failure.
+ */
+trie_node_t *trie_insert(trie_node_t *root, const char *key);
 
+/* Same as trie_insert(), key is a single component under node. */
+trie_node_t *trie_insert_child(trie_node_t *node, const char *key);
+/* Same as trie_insert_child(), key doesn't have to be NULL-terminated. */
+trie_node_t *trie_insert_child_len(trie_node_t *node, const char *key,
+                                   size_t len);
+/*
+ * Same as trie_insert_child_len(), for building a trie from sorted keys. All
+ * the children of node must have been added in increasing order, and key must
+ * not be smaller than any of them, so only the child added last is compared.
+ */
+trie_node_t *trie_append_child_len(trie_node_t *node, const char *key,
+                                   size_t len);
 /*
  * Deletes a node with key from the tree.
  *
  * 0 is returned on success, otherwise -1 is returned.
  */
 int trie_delete(trie_node_t *root, const char *key, trie_free_func func);
+/* Unlinks the node from the tree and frees it with all its descendants. */
+void trie_delete_node(trie_node_t *node, trie_free_func func,
+                      trie_free_func aux_func);
+/* Unlinks the node from its parent and siblings, keeping its descendants. */
+void trie_unlink(trie_node_t *node);
+/*
+ * Moves the data, the auxiliary pointer and the children of from to node,
+ * which must have none of them, leaving from empty. The two nodes may be in
+ * different tries.
+ *
+ * 0 is returned on success, otherwise -1 is returned.
+ */
+int trie_graft(trie_node_t *node, trie_node_t *from);
+/*
+ * Frees a single node, leaving its children alone. For callers that free a
+ * detached subtree in their own order.
+ */
+void trie_free_node(trie_node_t *node, trie_free_func func,
+                    trie_free_func aux_func);
 trie_node_t *trie_find(trie_node_t *root, const char *key);
+/* Finds the child of node with the given key, which is a single component. */
+trie_node_t *trie_find_child(const trie_node_t *node, const char *key);
+/* Same as trie_find_child(), key doesn't have to be NULL-terminated. */
+trie_node_t *trie_find_child_len(const trie_node_t *node, const char *key,
+                                 size_t len);
 /* Applies func to each node. Traverses the tree in depth-first pattern. */
 void trie_foreach(trie_node_t *root, trie_func func, void *udata);
 
+/*
+ * Iterates over the descendants of a node without recursion. In pre-order a
+ * node comes before its descendants, in post-order after them. The iterator
+ * reads the links of the node it returned last, so to free nodes in post-order
+ * the caller must fetch the next node before freeing the current one, as
+ * trie_free_full() does.
+ *
+ * The iterator state lives on the caller's stack:
+ *
+ *   trie_iter_t iter;
+ *   trie_node_t *node;
+ *
+ *   trie_iter_init(&iter, root, TRIE_PRE_ORDER);
+ *   while ((node = trie_iter_next(&iter)))
+ *       ...
+ */
+typedef enum {
+	TRIE_PRE_ORDER,
+	TRIE_POST_ORDER
+} trie_order_t;
+
+typedef struct {
+	trie_node_t *root;
+	trie_node_t *node;
+	trie_order_t order;
+	int started;
+	int skip;
+} trie_iter_t;
+
+void trie_iter_init(trie_iter_t *iter, trie_node_t *root, trie_order_t order);
+trie_node_t *trie_iter_next(trie_iter_t *iter);
+/* In pre-order, don't descend into the node returned last. */
+void trie_iter_skip(trie_iter_t *iter);
+
 const char *trie_key(const trie_node_t *node);
 void *trie_data(const trie_node_t *node);
 void trie_set_data(trie_node_t *node, void *data);
+void *trie_aux(const trie_node_t *node);
+void trie_set_aux(trie_node_t *node, void *aux);
 trie_node_t *trie_parent(const trie_node_t *node);
 trie_node_t *trie_child(const trie_node_t *node);
 trie_node_t *trie_prev(const trie_node_t *node);
@@ -0,0 +1,454 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "trigram.h"
+
+/* Dead ids are purged once there are more of them than live ones. */
+#define TRIGRAM_MIN_REBUILD 1024
+
+/*
+ * A posting list holds the ids of the objects containing a trigram, in
+ * increasing order, as varint encoded deltas. Ids are never reused, so new ids
+ * are always appended at the end.
+ */
+typedef struct {
+	GByteArray *data;
+	guint32 last;
+	guint32 count;
+} falcon_posting_t;
+
+struct falcon_trigram_st {
+	GHashTable *postings;		/* Trigram to posting list */
+	GHashTable *ids;			/* Object name to id */
+	GPtrArray *objects;			/* Id to object, NULL if removed */
+	guint live;
+};
+
+static const gchar *falcon_trigram_basename(const falcon_object_t *object)
+{
+	const gchar *name = falcon_object_get_name(object);
+	const gchar *base = strrchr(name, G_DIR_SEPARATOR);
+
+	return base ? base + 1 : name;
+}
+
+static gpointer falcon_trigram_key(const gchar *s)
+{
+	return GUINT_TO_POINTER(((guint)(guchar)s[0] << 16)
+	                        | ((guint)(guchar)s[1] << 8) | (guchar)s[2]);
+}
+
+static void falcon_posting_free(gpointer data)
+{
+	falcon_posting_t *posting = (falcon_posting_t *)data;
+
+	g_byte_array_free(posting->data, TRUE);
+	g_free(posting);
+}
+
+static void falcon_posting_append(falcon_posting_t *posting, guint32 id)
+{
+	guint32 delta = id - posting->last;
+	guint8 byte = 0;
+
+	/* A name may contain the same trigram more than once. */
+	if (posting->count && posting->last == id)
+		return;
+	if (!posting->count)
+		delta = id;
+
+	do {
+		byte = delta & 0x7F;
+		delta >>= 7;
+		if (delta)
+			byte |= 0x80;
+		g_byte_array_append(posting->data, &byte, 1);
+	} while (delta);
+
+	posting->last = id;
+	posting->count++;
+}
+
+/* Decodes the id at *offset and advances it. */
+static guint32 falcon_posting_next(const falcon_posting_t *posting,
+                                   guint *offset, guint32 prev)
+{
+	guint32 delta = 0;
+	guint shift = 0;
+	guint8 byte = 0;
+
+	do {
+		byte = posting->data->data[(*offset)++];
+		delta |= (guint32)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return prev + delta;
+}
+
+static void falcon_trigram_insert(falcon_trigram_t *index, guint32 id,
+                                  const gchar *base)
+{
+	falcon_posting_t *posting = NULL;
+	gpointer key = NULL;
+	gsize len = strlen(base);
+	gsize i;
+
+	for (i = 0; i + 3 <= len; i++) {
+		key = falcon_trigram_key(base + i);
+		posting = g_hash_table_lookup(index->postings, key);
+		if (!posting) {
+			posting = g_new0(falcon_posting_t, 1);
+			posting->data = g_byte_array_new();
+			g_hash_table_insert(index->postings, key, posting);
+		}
+		falcon_posting_append(posting, id);
+	}
+}
+
+/* Renumbers the live objects, dropping the removed ids from the lists. */
+static void falcon_trigram_rebuild(falcon_trigram_t *index)
+{
+	GPtrArray *objects = index->objects;
+	falcon_object_t *object = NULL;
+	guint i;
+
+	g_hash_table_remove_all(index->postings);
+	g_hash_table_remove_all(index->ids);
+	index->objects = g_ptr_array_sized_new(index->live);
+	for (i = 0; i < objects->len; i++) {
+		if (!(object = g_ptr_array_index(objects, i)))
+			continue;
+		g_hash_table_insert(index->ids,
+		                    (gpointer)falcon_object_get_name(object),
+		                    GUINT_TO_POINTER(index->objects->len));
+		falcon_trigram_insert(index, index->objects->len,
+		                      falcon_trigram_basename(object));
+		g_ptr_array_add(index->objects, object);
+	}
+	g_ptr_array_free(objects, TRUE);
+}
+
+falcon_trigram_t *falcon_trigram_new(void)
+{
+	falcon_trigram_t *index = g_new0(falcon_trigram_t, 1);
+
+	index->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                        NULL, falcon_posting_free);
+	index->ids = g_hash_table_new(g_str_hash, g_str_equal);
+	index->objects = g_ptr_array_new();
+
+	return index;
+}
+
+void falcon_trigram_free(falcon_trigram_t *index)
+{
+	falcon_object_t *object = NULL;
+	guint i;
+
+	g_return_if_fail(index);
+
+	for (i = 0; i < index->objects->len; i++)
+		if ((object = g_ptr_array_index(index->objects, i)))
+			falcon_object_unref(object);
+	g_ptr_array_free(index->objects, TRUE);
+	g_hash_table_destroy(index->ids);
+	g_hash_table_destroy(index->postings);
+	g_free(index);
+}
+
+void falcon_trigram_add(falcon_trigram_t *index, falcon_object_t *object)
+{
+	guint32 id = 0;
+
+	g_return_if_fail(index);
+	g_return_if_fail(object);
+
+	id = index->objects->len;
+	g_ptr_array_add(index->objects, falcon_object_ref(object));
+	g_hash_table_insert(index->ids, (gpointer)falcon_object_get_name(object),
+	                    GUINT_TO_POINTER(id));
+	falcon_trigram_insert(index, id, falcon_trigram_basename(object));
+	index->live++;
+}
+
+void falcon_trigram_remove(falcon_trigram_t *index,
+                           const falcon_object_t *object)
+{
+	gpointer id = NULL;
+	guint dead = 0;
+
+	g_return_if_fail(index);
+	g_return_if_fail(object);
+
+	if (!g_hash_table_lookup_extended(index->ids,
+	                                  falcon_object_get_name(object), NULL,
+	                                  &id))
+		return;
+
+	/* The id stays in the posting lists until the next rebuild. */
+	g_hash_table_remove(index->ids, falcon_object_get_name(object));
+	falcon_object_unref(g_ptr_array_index(index->objects,
+	                                      GPOINTER_TO_UINT(id)));
+	g_ptr_array_index(index->objects, GPOINTER_TO_UINT(id)) = NULL;
+	index->live--;
+
+	dead = index->objects->len - index->live;
+	if (dead > TRIGRAM_MIN_REBUILD && dead > index->live)
+		falcon_trigram_rebuild(index);
+}
+
+void falcon_trigram_replace(falcon_trigram_t *index,
+                            const falcon_object_t *old,
+                            falcon_object_t *object)
+{
+	gpointer id = NULL;
+
+	g_return_if_fail(index);
+	g_return_if_fail(old);
+	g_return_if_fail(object);
+
+	if (!g_hash_table_lookup_extended(index->ids, falcon_object_get_name(old),
+	                                  NULL, &id)) {
+		falcon_trigram_add(index, object);
+		return;
+	}
+
+	/* The key points into the old name, replace it as well. */
+	g_hash_table_replace(index->ids, (gpointer)falcon_object_get_name(object),
+	                     id);
+	falcon_object_unref(g_ptr_array_index(index->objects,
+	                                      GPOINTER_TO_UINT(id)));
+	g_ptr_array_index(index->objects, GPOINTER_TO_UINT(id)) =
+		falcon_object_ref(object);
+}
+
+static gint falcon_posting_compare(gconstpointer a, gconstpointer b)
+{
+	const falcon_posting_t *posting_a = *(falcon_posting_t * const *)a;
+	const falcon_posting_t *posting_b = *(falcon_posting_t * const *)b;
+
+	if (posting_a->count < posting_b->count)
+		return -1;
+	return posting_a->count > posting_b->count;
+}
+
+static gint falcon_id_compare(gconstpointer a, gconstpointer b)
+{
+	guint32 id_a = *(const guint32 *)a;
+	guint32 id_b = *(const guint32 *)b;
+
+	if (id_a < id_b)
+		return -1;
+	return id_a > id_b;
+}
+
+/*
+ * Gets the posting lists of the distinct trigrams of pattern that are in the
+ * index. Returns the number of distinct trigrams, including the missing ones.
+ */
+static guint falcon_trigram_lookup(falcon_trigram_t *index,
+                                   const gchar *pattern, GPtrArray *lists)
+{
+	GArray *keys = g_array_new(FALSE, FALSE, sizeof(gpointer));
+	falcon_posting_t *posting = NULL;
+	gpointer key = NULL;
+	gsize len = strlen(pattern);
+	guint distinct = 0;
+	gsize i;
+	guint j;
+
+	for (i = 0; i + 3 <= len; i++) {
+		key = falcon_trigram_key(pattern + i);
+		for (j = 0; j < keys->len; j++)
+			if (g_array_index(keys, gpointer, j) == key)
+				break;
+		if (j < keys->len)
+			continue;
+
+		g_array_append_val(keys, key);
+		if ((posting = g_hash_table_lookup(index->postings, key)))
+			g_ptr_array_add(lists, posting);
+	}
+
+	distinct = keys->len;
+	g_array_free(keys, TRUE);
+
+	return distinct;
+}
+
+/* Keeps the candidates that are also in posting. Both are sorted. */
+static void falcon_trigram_intersect(GArray *candidates,
+                                     const falcon_posting_t *posting)
+{
+	guint offset = 0;
+	guint32 id = 0;
+	guint32 i = 0;
+	guint kept = 0;
+	guint n = 0;
+
+	if (posting->count)
+		id = falcon_posting_next(posting, &offset, 0);
+	for (i = 0; i < candidates->len; i++) {
+		while (n < posting->count && id < g_array_index(candidates, guint32, i))
+			if (++n < posting->count)
+				id = falcon_posting_next(posting, &offset, id);
+		if (n == posting->count)
+			break;
+		if (id == g_array_index(candidates, guint32, i))
+			g_array_index(candidates, guint32, kept++) = id;
+	}
+	g_array_set_size(candidates, kept);
+}
+
+static void falcon_trigram_decode(GArray *ids, const falcon_posting_t *posting)
+{
+	guint offset = 0;
+	guint32 id = 0;
+	guint i;
+
+	for (i = 0; i < posting->count; i++) {
+		id = falcon_posting_next(posting, &offset, id);
+		g_array_append_val(ids, id);
+	}
+}
+
+/*
+ * Checks if pattern matches a substring of text with at most max_errors edits,
+ * computing the edit distance column by column over text.
+ */
+static gboolean falcon_trigram_approx(const gchar *text, const gchar *pattern,
+                                      guint max_errors)
+{
+	gsize m = strlen(pattern);
+	guint *column = NULL;
+	guint diagonal = 0;
+	guint above = 0;
+	gboolean ret = FALSE;
+	gsize i;
+
+	if (m <= max_errors)
+		return TRUE;
+
+	column = g_new(guint, m + 1);
+	for (i = 0; i <= m; i++)
+		column[i] = i;
+
+	for (; *text && !ret; text++) {
+		/* A match may start anywhere in the text. */
+		diagonal = 0;
+		for (i = 1; i <= m; i++) {
+			above = column[i];
+			column[i] = MIN(MIN(column[i] + 1, column[i - 1] + 1),
+			                diagonal + (pattern[i - 1] == *text ? 0 : 1));
+			diagonal = above;
+		}
+		ret = column[m] <= max_errors;
+	}
+
+	g_free(column);
+
+	return ret;
+}
+
+static gboolean falcon_trigram_match(const falcon_object_t *object,
+                                     const gchar *pattern, guint max_errors)
+{
+	const gchar *base = falcon_trigram_basename(object);
+
+	if (!max_errors)
+		return strstr(base, pattern) != NULL;
+	return falcon_trigram_approx(base, pattern, max_errors);
+}
+
+void falcon_trigram_search(falcon_trigram_t *index, const gchar *pattern,
+                           guint max_errors, GPtrArray *result)
+{
+	GPtrArray *lists = NULL;
+	GArray *candidates = NULL;
+	falcon_object_t *object = NULL;
+	guint distinct = 0;
+	guint threshold = 0;
+	guint count = 0;
+	guint i;
+
+	g_return_if_fail(index);
+	g_return_if_fail(pattern);
+	g_return_if_fail(result);
+
+	lists = g_ptr_array_new();
+	candidates = g_array_new(FALSE, FALSE, sizeof(guint32));
+	distinct = falcon_trigram_lookup(index, pattern, lists);
+
+	/*
+	 * Each edit destroys at most three trigrams of the pattern, so a match
+	 * shares at least the remaining ones with the name.
+	 */
+	if (distinct > 3 * max_errors)
+		threshold = distinct - 3 * max_errors;
+
+	if (!threshold) {
+		/* Nothing to filter on, check every object. */
+		for (i = 0; i < index->objects->len; i++)
+			g_array_append_val(candidates, i);
+	} else if (!max_errors) {
+		if (lists->len == distinct) {
+			g_ptr_array_sort(lists, falcon_posting_compare);
+			falcon_trigram_decode(candidates, g_ptr_array_index(lists, 0));
+			for (i = 1; i < lists->len && candidates->len; i++)
+				falcon_trigram_intersect(candidates,
+				                         g_ptr_array_index(lists, i));
+		}
+	} else if (lists->len >= threshold) {
+		/* Keep the ids that appear in at least threshold lists. */
+		GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+		for (i = 0; i < lists->len; i++)
+			falcon_trigram_decode(ids, g_ptr_array_index(lists, i));
+		g_array_sort(ids, falcon_id_compare);
+		for (i = 0; i < ids->len; i++) {
+			if (i && g_array_index(ids, guint32, i)
+			    == g_array_index(ids, guint32, i - 1))
+				count++;
+			else
+				count = 1;
+			if (count == threshold)
+				g_array_append_val(candidates, g_array_index(ids, guint32, i));
+		}
+		g_array_free(ids, TRUE);
+	}
+
+	for (i = 0; i < candidates->len; i++) {
+		object = g_ptr_array_index(index->objects,
+		                           g_array_index(candidates, guint32, i));
+		if (object && falcon_trigram_match(object, pattern, max_errors))
+			g_ptr_array_add(result, falcon_object_ref(object));
+	}
+
+	g_array_free(candidates, TRUE);
+	g_ptr_array_free(lists, TRUE);
+}
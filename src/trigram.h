@@ -0,0 +1,59 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _TRIGRAM_H_
+#define _TRIGRAM_H_
+
+#include <glib.h>
+
+#include "common.h"
+#include "object.h"
+
+/*
+ * Inverted index from the trigrams of the base names to the objects. Every path
+ * component is the base name of some object, so this covers all of them. The
+ * index holds a reference to each indexed object. It is not thread-safe, the
+ * cache lock protects it.
+ */
+typedef struct falcon_trigram_st falcon_trigram_t;
+
+falcon_trigram_t *falcon_trigram_new(void);
+void falcon_trigram_free(falcon_trigram_t *index);
+
+void falcon_trigram_add(falcon_trigram_t *index, falcon_object_t *object);
+void falcon_trigram_remove(falcon_trigram_t *index,
+                           const falcon_object_t *object);
+/* Replaces an object with a new one with the same name. */
+void falcon_trigram_replace(falcon_trigram_t *index,
+                            const falcon_object_t *old,
+                            falcon_object_t *object);
+/*
+ * Appends a reference to each object whose base name contains pattern to
+ * result. If max_errors is not 0, up to max_errors insertions, deletions or
+ * substitutions are allowed.
+ */
+void falcon_trigram_search(falcon_trigram_t *index, const gchar *pattern,
+                           guint max_errors, GPtrArray *result);
+
+#endif
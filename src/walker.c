@@ -22,8 +22,12 @@
  * THE SOFTWARE.
  */
 
+#define _GNU_SOURCE				/* For statx() */
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 
@@ -40,7 +44,74 @@ static void falcon_walker_check_exist(gpointer data, gpointer userdata ATTRIBUTE
 	g_debug(_("Checking \"%s\" for existence."), falcon_object_get_name(object));
 
 	if (!g_file_test(falcon_object_get_name(object), G_FILE_TEST_EXISTS))
-		falcon_task_add(falcon_object_copy(object));
+		falcon_task_add(object);
+}
+
+/* Checks a child of a directory that didn't change, files only if asked to. */
+static void falcon_walker_check_child(gpointer data, gpointer userdata)
+{
+	falcon_object_t *object = (falcon_object_t *)data;
+	gboolean verify = GPOINTER_TO_INT(userdata);
+
+	if (verify || falcon_object_isdir(object))
+		falcon_task_add(object);
+}
+
+#ifdef STATX_INO
+/* Set once statx() turned out not to be usable, e.g. on an older kernel. */
+static volatile gint falcon_walker_nostatx = 0;
+#endif
+
+/*
+ * Same as g_stat(), but only asks for what the cache keeps where statx() is
+ * available, the rest of info is left alone. The inode and the times the file
+ * system didn't return are set to 0, so that they aren't compared.
+ */
+static int falcon_walker_stat(const gchar *name, struct stat *info)
+{
+#ifdef STATX_INO
+	struct statx buf;
+
+	if (!g_atomic_int_get(&falcon_walker_nostatx)) {
+		if (statx(AT_FDCWD, name, AT_STATX_SYNC_AS_STAT,
+		          STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO
+		          | STATX_MTIME | STATX_CTIME, &buf) == 0) {
+			info->st_mode = buf.stx_mode;
+			info->st_size = buf.stx_size;
+			info->st_dev = 0;
+			info->st_ino = 0;
+			if (buf.stx_mask & STATX_INO) {
+				info->st_dev = makedev(buf.stx_dev_major, buf.stx_dev_minor);
+				info->st_ino = buf.stx_ino;
+			}
+			info->st_mtim.tv_sec = 0;
+			info->st_mtim.tv_nsec = 0;
+			if (buf.stx_mask & STATX_MTIME) {
+				info->st_mtim.tv_sec = buf.stx_mtime.tv_sec;
+				info->st_mtim.tv_nsec = buf.stx_mtime.tv_nsec;
+			}
+			info->st_ctim.tv_sec = 0;
+			info->st_ctim.tv_nsec = 0;
+			if (buf.stx_mask & STATX_CTIME) {
+				info->st_ctim.tv_sec = buf.stx_ctime.tv_sec;
+				info->st_ctim.tv_nsec = buf.stx_ctime.tv_nsec;
+			}
+			return 0;
+		}
+		/* Seccomp filters may deny it with EPERM rather than ENOSYS. */
+		if (errno != ENOSYS && errno != EPERM && errno != EINVAL)
+			return -1;
+		g_debug(_("statx() is not available, using stat()."));
+		g_atomic_int_set(&falcon_walker_nostatx, 1);
+	}
+#endif
+	return g_stat(name, info);
+}
+
+/* Nanoseconds since the epoch. */
+static guint64 falcon_walker_nsec(const struct timespec *ts)
+{
+	return (guint64)ts->tv_sec * G_GUINT64_CONSTANT(1000000000) + ts->tv_nsec;
 }
 
 static void falcon_walker_walk_dir(const falcon_object_t *parent,
@@ -77,15 +148,14 @@ static void falcon_walker_walk_dir(const falcon_object_t *parent,
 		}
 		path = g_build_path(G_DIR_SEPARATOR_S, parent_name, name,
 		                    (const gchar *)NULL);
-		object = falcon_object_new(path);
+		object = falcon_object_new_steal(path);
 		if (cached)
 			falcon_object_set_watch(object, falcon_object_get_watch(cached));
 		else
 			falcon_object_set_watch(object, falcon_object_get_watch(parent));
 
-		falcon_task_add(object);
+		falcon_task_add_steal(object);
 
-		g_free(path);
 		g_free(name);
 		path = NULL;
 	}
@@ -94,11 +164,15 @@ static void falcon_walker_walk_dir(const falcon_object_t *parent,
 }
 
 static gboolean falcon_walker_runeach(falcon_object_t *object,
-                                      falcon_cache_t *cache)
+                                      falcon_cache_t *cache,
+                                      falcon_cursor_t *cursor,
+                                      falcon_start_t start)
 {
 	falcon_object_t *cached = NULL;
+	const gchar *key = NULL;
 	falcon_event_code_t event = EVENT_NONE;
 	gchar *name = NULL;
+	gpointer verify = NULL;
 	GError *error = NULL;
 	gboolean skip = FALSE;
 	struct stat info;
@@ -109,8 +183,6 @@ static gboolean falcon_walker_runeach(falcon_object_t *object,
 	if (!(falcon_object_get_name(object)))
 		g_warning(_("Object has no path associated with it, skipping..."));
 
-	cached = falcon_cache_get(cache, falcon_object_get_name(object));
-
 	name = g_filename_to_utf8(falcon_object_get_name(object), -1,
 	                          NULL, NULL, &error);
 	if (!name) {
@@ -120,19 +192,31 @@ static gboolean falcon_walker_runeach(falcon_object_t *object,
 		return FALSE;
 	}
 
-	if (g_stat(name, &info) != 0) {
+	if (falcon_walker_stat(name, &info) != 0) {
 		g_warning(_("Failed to obtain information for object %s, skipping..."),
 		          falcon_object_get_name(object));
 		return FALSE;
 	}
 	g_free(name);
 
+	/* Objects of a batch mostly share the directory, so use the cursor. */
+	key = falcon_cursor_seek(cursor, falcon_object_get_name(object));
+	if (key)
+		cached = falcon_cursor_get(cursor, key);
+	else
+		cached = falcon_cache_get(cache, falcon_object_get_name(object));
+
+	/* The task may share the object with the cache, e.g. on startup. */
+	object = falcon_object_unshare(object);
 	falcon_object_set_mode(object, info.st_mode);
 	falcon_object_set_size(object, info.st_size);
 	if (difftime(info.st_mtime, info.st_ctime) < 0.0)
 		falcon_object_set_time(object, info.st_ctime);
 	else
 		falcon_object_set_time(object, info.st_mtime);
+	falcon_object_set_inode(object, info.st_dev, info.st_ino);
+	falcon_object_set_mtime(object, falcon_walker_nsec(&info.st_mtim));
+	falcon_object_set_ctime(object, falcon_walker_nsec(&info.st_ctim));
 
 	skip = falcon_filter(object);
 	if (skip)
@@ -143,12 +227,15 @@ static gboolean falcon_walker_runeach(falcon_object_t *object,
 	    || !g_file_test(falcon_object_get_name(object), G_FILE_TEST_EXISTS)) {
 		if (cached) {
 			if (falcon_object_isdir(cached))
-				falcon_handler(cached, EVENT_DIR_DELETED, cache);
+				falcon_handler_cursor(cached, EVENT_DIR_DELETED, cache,
+				                      cursor);
 			else
-				falcon_handler(cached, EVENT_FILE_DELETED, cache);
+				falcon_handler_cursor(cached, EVENT_FILE_DELETED, cache,
+				                      cursor);
+			falcon_object_unref(cached);
 		}
 
-		falcon_object_free(object);
+		falcon_object_unref(object);
 		return TRUE;
 	}
 
@@ -159,9 +246,30 @@ static gboolean falcon_walker_runeach(falcon_object_t *object,
 		else if (!falcon_object_equal(object, cached))
 			event = EVENT_DIR_CHANGED;
 
-		falcon_cache_foreach_child(cache, falcon_object_get_name(object),
-		                           falcon_walker_check_exist, NULL);
-		falcon_walker_walk_dir(object, cached);
+		if (start != START_COLD && cached && event == EVENT_NONE
+		    && !falcon_task_resumed(falcon_object_get_name(object))) {
+			/*
+			 * Nothing was added or removed since it was cached, but there
+			 * may be changes further down.
+			 */
+			verify = GINT_TO_POINTER(start == START_VERIFY);
+			if (key)
+				falcon_cursor_foreach_child(cursor, key,
+				                            falcon_walker_check_child, verify);
+			else
+				falcon_cache_foreach_child(cache,
+				                           falcon_object_get_name(object),
+				                           falcon_walker_check_child, verify);
+		} else {
+			if (key)
+				falcon_cursor_foreach_child(cursor, key,
+				                            falcon_walker_check_exist, NULL);
+			else
+				falcon_cache_foreach_child(cache,
+				                           falcon_object_get_name(object),
+				                           falcon_walker_check_exist, NULL);
+			falcon_walker_walk_dir(object, cached);
+		}
 		if (falcon_object_get_watch(object))
 			falcon_watcher_add(object);
 	} else if (g_file_test(falcon_object_get_name(object),
@@ -174,9 +282,16 @@ static gboolean falcon_walker_runeach(falcon_object_t *object,
 	}
 
 	if (event != EVENT_NONE)
-		falcon_handler(object, event, cache);
+		falcon_handler_cursor(object, event, cache, cursor);
+	else if (cached && falcon_object_get_ino(object)
+	         && (!falcon_object_get_ino(cached)
+	             || falcon_object_get_dev(cached)
+	                != falcon_object_get_dev(object)))
+		falcon_handler_refresh(object, cache, cursor);
 
-	falcon_object_free(object);
+	if (cached)
+		falcon_object_unref(cached);
+	falcon_object_unref(object);
 
 	return TRUE;
 }
@@ -186,6 +301,8 @@ void falcon_walker_run(gpointer data, gpointer userdata)
 	GQueue *objects = (GQueue *)data;
 	falcon_object_t *object = NULL;
 	falcon_cache_t *cache = (falcon_cache_t *)userdata;
+	falcon_cursor_t *cursor = NULL;
+	falcon_start_t start = START_COLD;
 	GError *error = NULL;
 
 	g_return_if_fail(objects);
@@ -197,18 +314,25 @@ void falcon_walker_run(gpointer data, gpointer userdata)
 		g_set_error(&error, FALCON_WALKER_ERROR, FALCON_ERROR_CRITICAL,
 		            _("Cache not provided. Walker thread returning."));
 
+		falcon_walker_return(objects, error);
 		g_queue_free(objects);
-		falcon_walker_return(error);
 		g_error_free(error);
 		return;
 	}
 
+	start = falcon_start_mode();
+	cursor = falcon_cache_cursor_new(cache, NULL);
 	while (!g_queue_is_empty(objects)) {
+		if (falcon_task_stopping()) {
+			falcon_task_requeue(objects);
+			break;
+		}
 		object = g_queue_pop_head(objects);
-		if (!falcon_walker_runeach(object, cache))
+		if (!falcon_walker_runeach(object, cache, cursor, start))
 			falcon_failed_add(object);
 	}
+	falcon_cursor_free(cursor);
 
+	falcon_walker_return(objects, NULL);
 	g_queue_free(objects);
-	falcon_walker_return(NULL);
 }
@@ -39,7 +39,9 @@
  * looks at the content of a given path and compares it with the one in the
  * cache. If the path is a directory, it will read the list of files under this
  * directory and insert them into a queue for other threads to handle. It does
- * not recursively go down into the sub-directories.
+ * not recursively go down into the sub-directories. During a warm start, a
+ * directory that didn't change is not read, its cached subdirectories are
+ * queued instead, see falcon_set_start().
  *
  * The walker assumes that all the paths passed to it exist. If not found, an
  * EVENT_*_DELETED signal will be emmitted.
@@ -69,11 +69,10 @@ static void falcon_watcher_event(GFileMonitor *monitor ATTRIBUTE_UNUSED,
 		g_return_if_fail(path);
 		g_object_unref(relative_base);
 	}
-	object = falcon_object_new(path);
+	object = falcon_object_new_steal(path);
 	falcon_object_set_watch(object, TRUE);
-	g_free(path);
 
-	falcon_task_add(object);
+	falcon_task_add_steal(object);
 }
 
 void falcon_watcher_init(falcon_cache_t *cache)
@@ -22,18 +22,45 @@
  * THE SOFTWARE.
  */
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <errno.h>
 #include <locale.h>
 #include <glib.h>
-#include <glib/gstdio.h>
 
 #include "object.h"
+#include "stream.h"
+#include "image.h"
+
+static void print_object(gpointer data, gpointer userdata ATTRIBUTE_UNUSED)
+{
+	falcon_object_t *object = (falcon_object_t *)data;
+
+	g_debug(_("\"%s\": dir=%s, size=%ld, time=%ld, watch=%s"),
+	        falcon_object_get_name(object),
+	        falcon_object_isdir(object) ? "yes" : "no",
+	        falcon_object_get_size(object),
+	        falcon_object_get_time(object),
+	        falcon_object_get_watch(object) ? "yes" : "no");
+
+	falcon_object_unref(object);
+}
+
+static gboolean image_load(const gchar *name)
+{
+	falcon_image_t *image = falcon_image_open(name);
+
+	if (!image)
+		return FALSE;
+
+	falcon_image_fault(image, NULL, IMAGE_SUBTREE, print_object, NULL);
+	falcon_image_free(image);
+
+	return TRUE;
+}
 
 gboolean cache_load(const gchar *name)
 {
-	int fd = 0;
+	falcon_stream_t *stream = NULL;
+	GString *path = NULL;
+	gsize shared = 0;
 	guint64 count = 0;
 	guint64 i;
 	falcon_object_t *object = NULL;
@@ -41,44 +68,31 @@ gboolean cache_load(const gchar *name)
 
 	if (!name)
 		return FALSE;
+	if (falcon_image_probe(name))
+		return image_load(name);
 
-	fd = g_open(name, O_RDONLY, 0);
-	if (fd == -1) {
-		g_critical(_("Failed to read cache file %s: %s"), name,
-		           g_strerror(errno));
-		return FALSE;
-	}
-
-	if (read(fd, &count, 8) == -1) {
-		g_critical(_("Failed to read cache file %s: %s"), name,
-		           g_strerror(errno));
-		close(fd);
+	stream = falcon_stream_open(name, &count);
+	if (!stream)
 		return FALSE;
-	}
-	count = GUINT64_FROM_BE(count);
 
 	g_debug(_("Loaded %lu cache keys."), count);
 
+	path = g_string_new(NULL);
 	for (i = 1; i <= count; i++) {
 		object = falcon_object_new(NULL);
-		if (!falcon_object_load(object, GINT_TO_POINTER(fd))) {
+		if (!falcon_object_load(object, path, &shared, stream)) {
 			g_critical(_("Failed to load object %lu"), i);
-			falcon_object_free(object);
+			falcon_object_unref(object);
 			ret = FALSE;
 			break;
 		}
 
-		g_debug(_("\"%s\": dir=%s, size=%ld, time=%ld, watch=%s"),
-		        falcon_object_get_name(object),
-		        falcon_object_isdir(object) ? "yes" : "no",
-		        falcon_object_get_size(object),
-		        falcon_object_get_time(object),
-		        falcon_object_get_watch(object) ? "yes" : "no");
-
-		falcon_object_free(object);
+		print_object(object, NULL);
 	}
 
-	close(fd);
+	g_string_free(path, TRUE);
+	if (!falcon_stream_close(stream))
+		ret = FALSE;
 
 	return ret;
 }
@@ -0,0 +1,113 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Crawls a directory into an empty cache and reports the number of heap
+ * allocations per crawled entry. glib ignores g_mem_set_vtable() since 2.46,
+ * so malloc() itself is wrapped, which also counts the allocations glib makes
+ * on the cache's behalf. Run it with G_SLICE=always-malloc so that list and
+ * hash table nodes are counted as well.
+ *
+ * Usage: crawl_bench DIRECTORY
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "include/falcon.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *mem, size_t size);
+
+static volatile gint counting = 0;
+static volatile gint allocations = 0;
+static volatile gint entries = 0;
+
+void *malloc(size_t size)
+{
+	if (g_atomic_int_get(&counting))
+		g_atomic_int_inc(&allocations);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (g_atomic_int_get(&counting))
+		g_atomic_int_inc(&allocations);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *mem, size_t size)
+{
+	if (!mem && g_atomic_int_get(&counting))
+		g_atomic_int_inc(&allocations);
+	return __libc_realloc(mem, size);
+}
+
+static gboolean count_handler(falcon_object_t *object __attribute__((unused)),
+                              falcon_event_code_t event __attribute__((unused)),
+                              gpointer userdata __attribute__((unused)))
+{
+	g_atomic_int_inc(&entries);
+	return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+	GTimer *timer = NULL;
+	gint total = 0;
+	gint crawled = 0;
+
+	if (argc < 2) {
+		printf("Usage: %s DIRECTORY\n", argv[0]);
+		return 1;
+	}
+
+	g_thread_init(NULL);
+
+	falcon_init(NULL);
+	falcon_handler_register(EVENT_DIR_CREATED | EVENT_FILE_CREATED,
+	                        count_handler, NULL);
+
+	timer = g_timer_new();
+	g_atomic_int_set(&counting, 1);
+	falcon_add(argv[1], FALSE);
+	falcon_shutdown(NULL, TRUE);
+	g_atomic_int_set(&counting, 0);
+	total = g_atomic_int_get(&allocations);
+	g_timer_stop(timer);
+
+	crawled = g_atomic_int_get(&entries);
+	printf("entries: %d\n", crawled);
+	printf("allocations: %d\n", total);
+	printf("allocations per entry: %.2f\n",
+	       crawled ? (gdouble)total / crawled : 0.0);
+	printf("seconds: %.3f\n", g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+
+	return 0;
+}
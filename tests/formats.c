@@ -0,0 +1,675 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Writes and reads back each file format: the streamed cache file in all its
+ * versions, the image in both of its, the shard manifest, the crawl queue and
+ * the journal. Then cuts each file at every length and flips each of its
+ * bytes. A damaged file must be refused, except for the body of an image,
+ * which has no checksum and must only be read within its bounds. The journal
+ * must be replayed up to the damaged batch and cut there.
+ *
+ * Usage: formats [DIRECTORY]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cache.h"
+#include "common.h"
+#include "crc32c.h"
+#include "journal.h"
+#include "object.h"
+#include "queue.h"
+
+#define OBJECTS 40
+#define DIRS 4
+#define JOURNAL_HEADER 8
+#define IMAGE_HEADER 64
+/* The header is only checked up to its CRC, the padding after isn't. */
+#define IMAGE_CHECKED 36
+#define IMAGE_NODE 24
+
+static const gchar *dir = NULL;
+
+/* The damaged files make the library complain, which is expected. */
+static void quiet(const gchar *domain __attribute__((unused)),
+                  GLogLevelFlags level __attribute__((unused)),
+                  const gchar *message __attribute__((unused)),
+                  gpointer userdata __attribute__((unused)))
+{
+}
+
+static gchar *path_of(const gchar *name)
+{
+	return g_build_filename(dir, name, NULL);
+}
+
+/* "/r", its directories and the files spread over them. */
+static gchar *object_name(guint i)
+{
+	if (i == 0)
+		return g_strdup("/r");
+	if (i <= DIRS)
+		return g_strdup_printf("/r/d%u", i);
+	return g_strdup_printf("/r/d%u/f%u", i % DIRS + 1, i);
+}
+
+static falcon_object_t *make_object(guint i)
+{
+	gchar *name = object_name(i);
+	falcon_object_t *object = falcon_object_new(name);
+
+	falcon_object_set_mode(object, i <= DIRS ? S_IFDIR | 0755 : S_IFREG | 0644);
+	falcon_object_set_size(object, i * 3);
+	falcon_object_set_time(object, 1000 + i);
+	falcon_object_set_watch(object, i % 3 == 0);
+	falcon_object_set_inode(object, 8 + i % 2, 100 + i);
+	falcon_object_set_mtime(object, G_GUINT64_CONSTANT(5000000000) + i);
+	falcon_object_set_ctime(object, G_GUINT64_CONSTANT(6000000000) + i);
+	g_free(name);
+
+	return object;
+}
+
+static falcon_cache_t *make_cache(void)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	guint i;
+
+	for (i = 0; i < OBJECTS; i++)
+		falcon_cache_add_steal(cache, make_object(i));
+
+	return cache;
+}
+
+/*
+ * Checks that cache holds the objects from first to last, and none of the
+ * others. Formats older than the inodes have none of them.
+ */
+static gboolean check_cache(falcon_cache_t *cache, guint first, guint last,
+                            gboolean inodes, const gchar *what)
+{
+	falcon_object_t *expected = NULL;
+	falcon_object_t *object = NULL;
+	gchar *name = NULL;
+	gboolean ok = TRUE;
+	guint i;
+
+	for (i = 0; ok && i < OBJECTS; i++) {
+		name = object_name(i);
+		object = falcon_cache_get(cache, name);
+		if (i < first || i > last) {
+			ok = !object;
+		} else if (!object) {
+			ok = FALSE;
+		} else {
+			expected = make_object(i);
+			if (!inodes) {
+				falcon_object_set_inode(expected, 0, 0);
+				falcon_object_set_mtime(expected, 0);
+				falcon_object_set_ctime(expected, 0);
+			}
+			ok = falcon_object_equal(object, expected)
+			     && falcon_object_get_watch(object)
+			        == falcon_object_get_watch(expected)
+			     && falcon_object_get_dev(object)
+			        == falcon_object_get_dev(expected)
+			     && falcon_object_get_ino(object)
+			        == falcon_object_get_ino(expected)
+			     && falcon_object_get_mtime(object)
+			        == falcon_object_get_mtime(expected)
+			     && falcon_object_get_ctime(object)
+			        == falcon_object_get_ctime(expected);
+			falcon_object_unref(expected);
+		}
+		if (!ok)
+			printf("%s: object %s is wrong.\n", what, name);
+		if (object)
+			falcon_object_unref(object);
+		g_free(name);
+	}
+
+	return ok;
+}
+
+static gchar *read_file(const gchar *path, gsize *len)
+{
+	gchar *data = NULL;
+
+	if (!g_file_get_contents(path, &data, len, NULL)) {
+		printf("Failed to read %s.\n", path);
+		return NULL;
+	}
+
+	return data;
+}
+
+static gboolean write_file(const gchar *path, const gchar *data, gsize len)
+{
+	if (!g_file_set_contents(path, data, len, NULL)) {
+		printf("Failed to write %s.\n", path);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static guint64 file_size(const gchar *path)
+{
+	struct stat info;
+
+	if (g_stat(path, &info) == -1)
+		return 0;
+
+	return info.st_size;
+}
+
+/* Loads name into a new cache and pages all of it in. */
+static gboolean load(const gchar *name)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	falcon_summary_t summary;
+	gboolean ret = FALSE;
+
+	ret = falcon_cache_load(cache, name);
+	falcon_cache_get_summary(cache, "/", &summary);
+	falcon_cache_free(cache);
+
+	return ret;
+}
+
+/* Loads name and checks it holds everything. */
+static gboolean round_trip(const gchar *name, gboolean inodes,
+                           const gchar *what)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	gboolean ret = FALSE;
+
+	if (!falcon_cache_load(cache, name))
+		printf("%s: failed to load.\n", what);
+	else
+		ret = check_cache(cache, 0, OBJECTS - 1, inodes, what);
+	falcon_cache_free(cache);
+
+	return ret;
+}
+
+/*
+ * Writes the data of path cut at every length from start, then with each of its
+ * bytes from start flipped, and loads it each time. Each of these must fail
+ * unless body is set, from where the file is only checked as it is read. The
+ * original data is written back at the end.
+ */
+static gboolean damage(const gchar *path, const gchar *name, gsize start,
+                       gsize body, const gchar *what)
+{
+	gchar *data = NULL;
+	gsize len = 0;
+	gsize i;
+	gboolean ok = TRUE;
+
+	if (!(data = read_file(path, &len)))
+		return FALSE;
+
+	for (i = start; ok && i < len; i++) {
+		ok = write_file(path, data, i);
+		if (ok && load(name)) {
+			printf("%s: loaded when cut at %lu of %lu bytes.\n", what,
+			       (gulong)i, (gulong)len);
+			ok = FALSE;
+		}
+	}
+	for (i = start; ok && i < len; i++) {
+		data[i] ^= 0xff;
+		ok = write_file(path, data, len);
+		if (ok && load(name) && (!body || i < body)) {
+			printf("%s: loaded with byte %lu flipped.\n", what, (gulong)i);
+			ok = FALSE;
+		}
+		data[i] ^= 0xff;
+	}
+	if (!write_file(path, data, len))
+		ok = FALSE;
+	g_free(data);
+
+	return ok;
+}
+
+static gboolean test_stream(falcon_format_t format, const gchar *what)
+{
+	falcon_cache_t *cache = make_cache();
+	gchar *name = path_of("stream.cache");
+	gboolean ok = FALSE;
+
+	falcon_cache_set_format(cache, format);
+	if (!falcon_cache_save(cache, name))
+		printf("%s: failed to save.\n", what);
+	else
+		ok = round_trip(name, TRUE, what) && damage(name, name, 0, 0, what);
+
+	falcon_cache_free(cache);
+	g_unlink(name);
+	g_free(name);
+
+	return ok;
+}
+
+/* Writes the objects as a version 1 or 2 stream, in a single block. */
+static gboolean write_old_stream(const gchar *name, guint16 version)
+{
+	GString *data = g_string_new("FLCN");
+	GString *block = g_string_new(NULL);
+	falcon_object_t *object = NULL;
+	const gchar *key = NULL;
+	guint8 fields[8 + 8 + 4 + 1];
+	guint64 value = 0;
+	guint32 word = 0;
+	guint16 half = 0;
+	guint i;
+	gboolean ret = FALSE;
+
+	half = GUINT16_TO_BE(version);
+	g_string_append_len(data, (const gchar *)&half, 2);
+	g_string_append_len(data, "\0\0", 2);
+	value = GUINT64_TO_BE(OBJECTS);
+	g_string_append_len(data, (const gchar *)&value, 8);
+	word = GUINT32_TO_BE(falcon_crc32c(0, data->str, 16));
+	g_string_append_len(data, (const gchar *)&word, 4);
+
+	for (i = 0; i < OBJECTS; i++) {
+		object = make_object(i);
+		key = falcon_object_get_name(object);
+		if (version == 1) {
+			half = GUINT16_TO_BE(strlen(key));
+			g_string_append_len(block, (const gchar *)&half, 2);
+			g_string_append(block, key);
+			value = GUINT64_TO_BE(falcon_object_get_size(object));
+			memcpy(fields, &value, 8);
+			value = GUINT64_TO_BE(falcon_object_get_time(object));
+			memcpy(fields + 8, &value, 8);
+			word = GUINT32_TO_BE(falcon_object_get_mode(object));
+			memcpy(fields + 16, &word, 4);
+			fields[20] = falcon_object_get_watch(object);
+			g_string_append_len(block, (const gchar *)fields, sizeof(fields));
+		} else {
+			falcon_varint_put(block, 0);
+			falcon_varint_put(block, strlen(key));
+			g_string_append(block, key);
+			falcon_varint_put(block, falcon_object_get_size(object));
+			falcon_varint_put(block, falcon_object_get_time(object));
+			falcon_varint_put(block, falcon_object_get_mode(object));
+			g_string_append_c(block, falcon_object_get_watch(object));
+		}
+		falcon_object_unref(object);
+	}
+
+	word = GUINT32_TO_BE(block->len);
+	g_string_append_len(data, (const gchar *)&word, 4);
+	word = GUINT32_TO_BE(falcon_crc32c(0, block->str, block->len));
+	g_string_append_len(data, (const gchar *)&word, 4);
+	g_string_append_len(data, block->str, block->len);
+	/* The empty block at the end. */
+	g_string_append_len(data, "\0\0\0\0", 4);
+	word = GUINT32_TO_BE(falcon_crc32c(0, NULL, 0));
+	g_string_append_len(data, (const gchar *)&word, 4);
+
+	ret = write_file(name, data->str, data->len);
+	g_string_free(block, TRUE);
+	g_string_free(data, TRUE);
+
+	return ret;
+}
+
+static gboolean test_old_stream(guint16 version, const gchar *what)
+{
+	gchar *name = path_of("old.cache");
+	gboolean ok = FALSE;
+
+	ok = write_old_stream(name, version) && round_trip(name, FALSE, what)
+	     && damage(name, name, 0, 0, what);
+
+	g_unlink(name);
+	g_free(name);
+
+	return ok;
+}
+
+/* Turns the version 2 image at name into a version 1 one, without the inodes. */
+static gboolean downgrade_image(const gchar *name)
+{
+	GString *image = NULL;
+	gchar *data = NULL;
+	guint64 count = 0;
+	guint64 stats = 0;
+	guint32 crc = 0;
+	guint16 version = GUINT16_TO_LE(1);
+	gsize len = 0;
+	gboolean ret = FALSE;
+
+	if (!(data = read_file(name, &len)))
+		return FALSE;
+	memcpy(&count, data + 8, 8);
+	count = GUINT64_FROM_LE(count);
+
+	/* The devices, inodes, mtimes and ctimes follow the sizes and the times. */
+	stats = IMAGE_HEADER + count * IMAGE_NODE + (count - 1) * 4;
+	stats = ((stats + 7) & ~(guint64)7) + count * 8 * 2;
+	image = g_string_new_len(data, stats);
+	g_string_append_len(image, data + stats + count * 8 * 4,
+	                    len - stats - count * 8 * 4);
+	memcpy(image->str + 4, &version, 2);
+	crc = GUINT32_TO_LE(falcon_crc32c(0, image->str, 32));
+	memcpy(image->str + 32, &crc, 4);
+
+	ret = write_file(name, image->str, image->len);
+	g_string_free(image, TRUE);
+	g_free(data);
+
+	return ret;
+}
+
+static gboolean test_image(gboolean old, const gchar *what)
+{
+	falcon_cache_t *cache = make_cache();
+	gchar *name = path_of("image.cache");
+	gboolean ok = FALSE;
+
+	falcon_cache_set_format(cache, FORMAT_IMAGE);
+	if (!falcon_cache_save(cache, name))
+		printf("%s: failed to save.\n", what);
+	else
+		ok = (!old || downgrade_image(name))
+		     && round_trip(name, !old, what)
+		     && damage(name, name, 0, IMAGE_CHECKED, what);
+
+	falcon_cache_free(cache);
+	g_unlink(name);
+	g_free(name);
+
+	return ok;
+}
+
+static gboolean test_manifest(void)
+{
+	falcon_cache_t *cache = make_cache();
+	gchar *name = path_of("shards.cache");
+	gboolean ok = FALSE;
+
+	falcon_cache_set_format(cache, FORMAT_STREAM);
+	falcon_cache_set_shards(cache, 1);
+	if (!falcon_cache_save(cache, name))
+		printf("manifest: failed to save.\n");
+	else
+		ok = round_trip(name, TRUE, "manifest")
+		     && damage(name, name, 0, 0, "manifest");
+
+	falcon_cache_free(cache);
+	g_free(name);
+
+	return ok;
+}
+
+static gboolean same_objects(const GPtrArray *a, const GPtrArray *b)
+{
+	guint i;
+
+	if (a->len != b->len)
+		return FALSE;
+	for (i = 0; i < a->len; i++)
+		if (strcmp(falcon_object_get_name(g_ptr_array_index(a, i)),
+		           falcon_object_get_name(g_ptr_array_index(b, i))) != 0
+		    || falcon_object_get_watch(g_ptr_array_index(a, i))
+		       != falcon_object_get_watch(g_ptr_array_index(b, i)))
+			return FALSE;
+
+	return TRUE;
+}
+
+static gboolean test_queue(void)
+{
+	falcon_queue_t *queue = falcon_queue_new();
+	falcon_queue_t *loaded = NULL;
+	falcon_object_t *object = NULL;
+	gchar *name = path_of("queue.cache");
+	gchar *path = path_of("queue.cache.queue");
+	gchar *data = NULL;
+	gsize len = 0;
+	gsize i;
+	guint j;
+	gboolean ok = TRUE;
+
+	for (j = 0; j < OBJECTS; j++) {
+		object = make_object(j);
+		falcon_queue_add(queue, object, j % 4 == 0);
+		falcon_object_unref(object);
+	}
+
+	if (!falcon_queue_save(queue, name)) {
+		printf("queue: failed to save.\n");
+		ok = FALSE;
+	} else if (!(loaded = falcon_queue_load(name))
+	           || !same_objects(queue->pending, loaded->pending)
+	           || !same_objects(queue->failed, loaded->failed)) {
+		printf("queue: not read back as written.\n");
+		ok = FALSE;
+	}
+	falcon_queue_free(loaded);
+	if (ok)
+		ok = (data = read_file(path, &len)) != NULL;
+
+	for (i = 0; ok && i < len; i++) {
+		ok = write_file(path, data, i);
+		if (ok && (loaded = falcon_queue_load(name))) {
+			printf("queue: loaded when cut at %lu bytes.\n", (gulong)i);
+			falcon_queue_free(loaded);
+			ok = FALSE;
+		}
+	}
+	for (i = 0; ok && i < len; i++) {
+		data[i] ^= 0xff;
+		ok = write_file(path, data, len);
+		if (ok && (loaded = falcon_queue_load(name))) {
+			printf("queue: loaded with byte %lu flipped.\n", (gulong)i);
+			falcon_queue_free(loaded);
+			ok = FALSE;
+		}
+		data[i] ^= 0xff;
+	}
+
+	falcon_queue_free(queue);
+	g_unlink(path);
+	g_free(data);
+	g_free(path);
+	g_free(name);
+
+	return ok;
+}
+
+/* The objects each batch of the journal adds, the last one deletes the last. */
+static const guint batches[] = { 0, OBJECTS / 2, OBJECTS };
+
+/*
+ * Replays the journal of name, which must end with the whole batches before
+ * and be cut right after them.
+ */
+static gboolean replay(const gchar *name, const gchar *path, guint before,
+                       const guint64 *ends, const gchar *what)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	guint last = 0;
+	gboolean ok = TRUE;
+
+	if (before == G_N_ELEMENTS(batches))
+		last = OBJECTS - 2;
+	else if (before)
+		last = batches[before] - 1;
+
+	if (!falcon_journal_init(cache, name)) {
+		printf("%s: failed to open the journal.\n", what);
+		ok = FALSE;
+	} else if (file_size(path) != ends[before]) {
+		printf("%s: journal cut at %lu, not %lu.\n", what,
+		       (gulong)file_size(path), (gulong)ends[before]);
+		ok = FALSE;
+	} else if (before && !check_cache(cache, 0, last, TRUE, what)) {
+		ok = FALSE;
+	} else if (!before && !check_cache(cache, 1, 0, TRUE, what)) {
+		ok = FALSE;
+	}
+	falcon_journal_shutdown();
+	falcon_cache_free(cache);
+
+	return ok;
+}
+
+/* The batches whole in the first len bytes of the journal. */
+static guint whole(const guint64 *ends, gsize len)
+{
+	guint before = 0;
+
+	while (before < G_N_ELEMENTS(batches) && ends[before + 1] <= len)
+		before++;
+
+	return before;
+}
+
+static gboolean test_journal(void)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	falcon_object_t *object = NULL;
+	gchar *name = path_of("journal.cache");
+	gchar *path = path_of("journal.cache.journal");
+	gchar *last = object_name(OBJECTS - 1);
+	gchar *data = NULL;
+	gchar what[64];
+	/* Where the file ends after each batch, the header first. */
+	guint64 ends[G_N_ELEMENTS(batches) + 1];
+	gsize len = 0;
+	gsize i;
+	guint b;
+	guint j;
+	gboolean ok = TRUE;
+
+	if (!falcon_journal_init(cache, name)) {
+		printf("journal: failed to open.\n");
+		falcon_cache_free(cache);
+		return FALSE;
+	}
+	ends[0] = file_size(path);
+	for (b = 0; b < G_N_ELEMENTS(batches); b++) {
+		falcon_journal_lock();
+		if (b + 1 < G_N_ELEMENTS(batches)) {
+			for (j = batches[b]; j < batches[b + 1]; j++) {
+				object = make_object(j);
+				falcon_journal_add(object);
+				falcon_object_unref(object);
+			}
+		} else {
+			falcon_journal_delete(last);
+		}
+		falcon_journal_unlock();
+		falcon_journal_sync();
+		ends[b + 1] = file_size(path);
+	}
+	falcon_journal_shutdown();
+	falcon_cache_free(cache);
+
+	ok = ends[0] == JOURNAL_HEADER
+	     && replay(name, path, G_N_ELEMENTS(batches), ends, "journal")
+	     && (data = read_file(path, &len)) != NULL;
+
+	/* Replay stops at the first incomplete batch. */
+	for (i = JOURNAL_HEADER; ok && i < len; i++) {
+		g_snprintf(what, sizeof(what), "journal cut at %lu", (gulong)i);
+		ok = write_file(path, data, i)
+		     && replay(name, path, whole(ends, i), ends, what);
+	}
+	/* Or at the first corrupted one. A bad header starts a new journal. */
+	for (i = 0; ok && i < len; i++) {
+		g_snprintf(what, sizeof(what), "journal byte %lu flipped", (gulong)i);
+		data[i] ^= 0xff;
+		ok = write_file(path, data, len)
+		     && replay(name, path, whole(ends, i), ends, what);
+		data[i] ^= 0xff;
+	}
+
+	g_unlink(path);
+	g_free(data);
+	g_free(last);
+	g_free(path);
+	g_free(name);
+
+	return ok;
+}
+
+/* Removes the directory and what the tests left in it. */
+static void clean(void)
+{
+	GDir *files = g_dir_open(dir, 0, NULL);
+	const gchar *file = NULL;
+	gchar *path = NULL;
+
+	while (files && (file = g_dir_read_name(files))) {
+		path = path_of(file);
+		g_unlink(path);
+		g_free(path);
+	}
+	if (files)
+		g_dir_close(files);
+	g_rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+	gboolean ok = FALSE;
+
+	dir = argc > 1 ? argv[1] : "formats.tmp";
+	g_thread_init(NULL);
+	g_log_set_handler(G_LOG_DOMAIN, G_LOG_LEVEL_MASK, quiet, NULL);
+
+	if (g_mkdir(dir, 0755) == -1) {
+		printf("Failed to create %s.\n", dir);
+		return 1;
+	}
+
+	ok = test_stream(FORMAT_STREAM, "stream v3")
+	     && test_stream(FORMAT_COMPRESSED, "compressed stream v3")
+	     && test_old_stream(2, "stream v2")
+	     && test_old_stream(1, "stream v1")
+	     && test_image(FALSE, "image v2")
+	     && test_image(TRUE, "image v1")
+	     && test_manifest()
+	     && test_queue()
+	     && test_journal();
+
+	clean();
+	printf(ok ? "All formats passed.\n" : "Failed.\n");
+
+	return ok ? 0 : 1;
+}
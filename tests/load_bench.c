@@ -0,0 +1,141 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures loading a synthetic cache from each file format, against adding the
+ * same objects one at a time in file order, and saving it again in shards when
+ * nothing changed.
+ *
+ * Usage: load_bench [OBJECTS] [FILES_PER_DIRECTORY] [FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cache.h"
+#include "shard.h"
+#include "snapshot.h"
+
+static void add(gpointer data, gpointer userdata)
+{
+	falcon_cache_add((falcon_cache_t *)userdata, (falcon_object_t *)data);
+}
+
+static void run(falcon_cache_t *source, falcon_format_t format, guint shards,
+                const gchar *name, const gchar *label)
+{
+	falcon_cache_t *cache = falcon_cache_new();
+	GTimer *timer = NULL;
+
+	falcon_cache_set_format(source, format);
+	falcon_cache_set_shards(source, shards);
+	if (!falcon_cache_save(source, name)) {
+		printf("%s: failed to save %s\n", label, name);
+		falcon_cache_free(cache);
+		return;
+	}
+
+	timer = g_timer_new();
+	if (!falcon_cache_load(cache, name))
+		printf("%s: failed to load %s\n", label, name);
+	/* A mapped file is only paged in when used, count the whole cost. */
+	falcon_cache_root(cache);
+	printf("%s: %lu bytes, %.3f s\n", label, (gulong)falcon_shard_size(name),
+	       g_timer_elapsed(timer, NULL));
+
+	if (shards) {
+		g_timer_start(timer);
+		if (!falcon_cache_save(source, name))
+			printf("%s: failed to save %s again\n", label, name);
+		printf("%s: saved unchanged in %.3f s\n", label,
+		       g_timer_elapsed(timer, NULL));
+	}
+
+	g_timer_destroy(timer);
+	falcon_cache_free(cache);
+}
+
+int main(int argc, char **argv)
+{
+	gulong objects = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	gulong width = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+	const gchar *name = argc > 3 ? argv[3] : "load_bench.cache";
+	falcon_cache_t *source = NULL;
+	falcon_cache_t *cache = NULL;
+	falcon_snapshot_t *snapshot = NULL;
+	falcon_object_t *object = NULL;
+	GPtrArray *sorted = NULL;
+	GTimer *timer = NULL;
+	gchar *path = NULL;
+	gulong i;
+
+	g_thread_init(NULL);
+
+	source = falcon_cache_new();
+	for (i = 0; i < objects; i++) {
+		/* Directories to shard at. */
+		if (i % width == 0) {
+			path = g_strdup_printf("/bench/d%lu", i / width);
+			object = falcon_object_new_steal(path);
+			falcon_object_set_mode(object, S_IFDIR | 0755);
+			falcon_cache_add_steal(source, object);
+		}
+		path = g_strdup_printf("/bench/d%lu/s%lu/f%lu", i / width,
+		                       i % width % 10, i % width);
+		object = falcon_object_new_steal(path);
+		falcon_object_set_mode(object, S_IFREG | 0644);
+		falcon_object_set_size(object, i * 37 % 65536);
+		falcon_object_set_time(object, 1250000000 + i % 86400);
+		falcon_cache_add_steal(source, object);
+	}
+
+	/* What loading used to do: one lookup from the root per object. */
+	snapshot = falcon_cache_snapshot(source, NULL);
+	sorted = falcon_snapshot_sorted(snapshot);
+	cache = falcon_cache_new();
+	timer = g_timer_new();
+	g_ptr_array_foreach(sorted, add, cache);
+	printf("add: %u objects, %.3f s\n", sorted->len,
+	       g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+	falcon_cache_free(cache);
+	g_ptr_array_free(sorted, TRUE);
+	falcon_snapshot_free(snapshot);
+
+	run(source, FORMAT_STREAM, 0, name, "stream");
+	run(source, FORMAT_COMPRESSED, 0, name, "compressed");
+	run(source, FORMAT_IMAGE, 0, name, "image");
+	run(source, FORMAT_IMAGE, 1, name, "image, sharded");
+
+	/* Back to a single file removes the shards. */
+	falcon_cache_set_shards(source, 0);
+	falcon_cache_save(source, name);
+	g_unlink(name);
+	falcon_cache_free(source);
+
+	return 0;
+}
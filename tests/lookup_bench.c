@@ -0,0 +1,162 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures single and batched cache lookups and subtree scans on a synthetic
+ * cache, with and without the frozen index, and misses with and without the
+ * path filter.
+ *
+ * Usage: lookup_bench [OBJECTS] [FILES_PER_DIRECTORY]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "cache.h"
+
+static gulong scanned = 0;
+
+static void scan(gpointer data ATTRIBUTE_UNUSED,
+                 gpointer userdata ATTRIBUTE_UNUSED)
+{
+	scanned++;
+}
+
+static void run(falcon_cache_t *cache, gchar **names, gulong count,
+                const gchar *label)
+{
+	falcon_object_t *object = NULL;
+	guint8 *bitmap = g_malloc((count + 7) / 8);
+	GTimer *timer = g_timer_new();
+	gdouble elapsed = 0;
+	gulong found = 0;
+	gulong i;
+
+	for (i = 0; i < count; i++) {
+		if ((object = falcon_cache_get(cache, names[i]))) {
+			falcon_object_unref(object);
+			found++;
+		}
+	}
+	elapsed = g_timer_elapsed(timer, NULL);
+	printf("%s: %lu lookups, %lu found, %.1f ns/lookup\n", label, count, found,
+	       elapsed * 1e9 / count);
+
+	g_timer_start(timer);
+	found = falcon_cache_lookup(cache, (const gchar * const *)names, count,
+	                            bitmap, NULL);
+	elapsed = g_timer_elapsed(timer, NULL);
+	printf("%s: batch of %lu, %lu found, %.1f ns/lookup\n", label, count,
+	       found, elapsed * 1e9 / count);
+
+	scanned = 0;
+	g_timer_start(timer);
+	falcon_cache_foreach_descendant(cache, "/bench", scan, NULL);
+	elapsed = g_timer_elapsed(timer, NULL);
+	printf("%s: %lu objects scanned, %.1f ns/object\n", label, scanned,
+	       elapsed * 1e9 / scanned);
+
+	g_timer_destroy(timer);
+	g_free(bitmap);
+}
+
+static void run_misses(falcon_cache_t *cache, gchar **names, gulong count,
+                       const gchar *label)
+{
+	falcon_filter_stats_t stats;
+	GTimer *timer = g_timer_new();
+	gdouble elapsed = 0;
+	gulong i;
+
+	for (i = 0; i < count; i++)
+		falcon_cache_get(cache, names[i]);
+	elapsed = g_timer_elapsed(timer, NULL);
+	printf("%s: %lu misses, %.1f ns/lookup\n", label, count,
+	       elapsed * 1e9 / count);
+
+	if (falcon_cache_get_filter_stats(cache, &stats))
+		printf("%s: %lu rejected, %lu false positives, %lu bytes\n", label,
+		       stats.rejected, stats.false_positives, stats.memory);
+
+	g_timer_destroy(timer);
+}
+
+int main(int argc, char **argv)
+{
+	gulong objects = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	gulong width = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+	falcon_cache_t *cache = NULL;
+	falcon_object_t *object = NULL;
+	gchar **names = NULL;
+	gchar **misses = NULL;
+	gchar *tmp = NULL;
+	GRand *rand = NULL;
+	gulong i;
+	gulong j;
+
+	g_thread_init(NULL);
+
+	cache = falcon_cache_new();
+	names = g_new0(gchar *, objects);
+	for (i = 0; i < objects; i++) {
+		names[i] = g_strdup_printf("/bench/d%lu/f%lu", i / width, i % width);
+		object = falcon_object_new(names[i]);
+		falcon_object_set_mode(object, S_IFREG);
+		falcon_cache_add_steal(cache, object);
+	}
+
+	/* Look the names up in random order, like an importer would. */
+	rand = g_rand_new_with_seed(42);
+	for (i = objects - 1; i > 0; i--) {
+		j = g_rand_int_range(rand, 0, i + 1);
+		tmp = names[i];
+		names[i] = names[j];
+		names[j] = tmp;
+	}
+	g_rand_free(rand);
+
+	misses = g_new0(gchar *, objects);
+	for (i = 0; i < objects; i++)
+		misses[i] = g_strconcat(names[i], "~", NULL);
+
+	run(cache, names, objects, "trie");
+	run_misses(cache, misses, objects, "trie");
+	falcon_cache_set_indexes(cache, INDEX_FILTER);
+	run_misses(cache, misses, objects, "filter");
+	falcon_cache_set_indexes(cache, INDEX_NONE);
+	falcon_cache_freeze(cache, TRUE);
+	run(cache, names, objects, "frozen");
+
+	for (i = 0; i < objects; i++) {
+		g_free(names[i]);
+		g_free(misses[i]);
+	}
+	g_free(names);
+	g_free(misses);
+	falcon_cache_free(cache);
+
+	return 0;
+}
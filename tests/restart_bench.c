@@ -0,0 +1,91 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Crawls a directory into a cache file, then measures how long the startup
+ * crawl takes when the system is started again on it, in each start mode.
+ *
+ * Usage: restart_bench DIRECTORY [FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "include/falcon.h"
+
+static volatile gint events = 0;
+
+static gboolean count_handler(falcon_object_t *object __attribute__((unused)),
+                              falcon_event_code_t event __attribute__((unused)),
+                              gpointer userdata __attribute__((unused)))
+{
+	g_atomic_int_inc(&events);
+	return TRUE;
+}
+
+static void run(falcon_start_t start, const gchar *name, const gchar *label)
+{
+	GTimer *timer = g_timer_new();
+
+	falcon_set_start(start);
+	g_atomic_int_set(&events, 0);
+	falcon_init(name);
+	falcon_handler_register(EVENT_ALL, count_handler, NULL);
+	/* Returns once the startup crawl is over. */
+	falcon_shutdown(name, TRUE);
+	printf("%s: %.3f s, %d events\n", label, g_timer_elapsed(timer, NULL),
+	       g_atomic_int_get(&events));
+
+	g_timer_destroy(timer);
+}
+
+int main(int argc, char **argv)
+{
+	const gchar *name = argc > 2 ? argv[2] : "restart_bench.cache";
+	GTimer *timer = NULL;
+
+	if (argc < 2) {
+		printf("Usage: %s DIRECTORY [FILE]\n", argv[0]);
+		return 1;
+	}
+
+	g_thread_init(NULL);
+
+	timer = g_timer_new();
+	falcon_init(NULL);
+	falcon_add(argv[1], FALSE);
+	falcon_shutdown(name, TRUE);
+	printf("crawl: %.3f s\n", g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	run(START_COLD, name, "cold");
+	run(START_WARM, name, "warm");
+	run(START_VERIFY, name, "verify");
+
+	g_unlink(name);
+
+	return 0;
+}
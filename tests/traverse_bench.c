@@ -0,0 +1,91 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures the throughput of falcon_traverse() on a synthetic cache against
+ * the number of threads.
+ *
+ * Usage: traverse_bench [OBJECTS] [MAX_THREADS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "cache.h"
+#include "traverse.h"
+
+static volatile gint visited = 0;
+
+/* Some work per node, so that the traversal is not only pointer chasing. */
+static void visit(trie_node_t *node, guint worker ATTRIBUTE_UNUSED,
+                  gpointer userdata ATTRIBUTE_UNUSED)
+{
+	falcon_object_t *object = trie_data(node);
+
+	if (object && g_str_hash(falcon_object_get_name(object)) == 0)
+		g_atomic_int_inc(&visited);
+}
+
+int main(int argc, char **argv)
+{
+	gulong objects = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	guint threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+	falcon_cache_t *cache = NULL;
+	falcon_object_t *object = NULL;
+	GTimer *timer = NULL;
+	gchar *name = NULL;
+	gdouble elapsed = 0;
+	gulong i;
+	guint t;
+
+	g_thread_init(NULL);
+
+	cache = falcon_cache_new();
+	for (i = 0; i < objects; i++) {
+		name = g_strdup_printf("/bench/d%lu/d%lu/f%lu", i / 10000,
+		                       i / 100 % 100, i % 100);
+		object = falcon_object_new_steal(name);
+		falcon_object_set_mode(object, S_IFREG);
+		falcon_cache_add_steal(cache, object);
+	}
+
+	timer = g_timer_new();
+	for (t = 1; t <= threads; t++) {
+		falcon_cache_lock(cache);
+		g_timer_start(timer);
+		falcon_traverse(falcon_cache_root(cache), t, visit, NULL);
+		elapsed = g_timer_elapsed(timer, NULL);
+		falcon_cache_unlock(cache);
+
+		printf("%u threads: %.3fs, %.1f M nodes/s\n", t, elapsed,
+		       objects / elapsed / 1e6);
+	}
+
+	g_timer_destroy(timer);
+	falcon_cache_free(cache);
+
+	return 0;
+}
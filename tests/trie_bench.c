@@ -0,0 +1,114 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2009 Ning Shi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures full traversals of the trie, the way the cache saves itself or
+ * flips the watch flags, on a wide tree and on a single deep chain.
+ *
+ * Usage: trie_bench [FILES] [DEPTH]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trie.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count(trie_node_t *node __attribute__((__unused__)), void *data)
+{
+	(*(unsigned long *)data)++;
+}
+
+static void bench(const char *name, trie_node_t *root)
+{
+	trie_iter_t iter;
+	unsigned long nodes = 0;
+	double start = 0;
+	double elapsed = 0;
+
+	start = now();
+	trie_foreach(root, count, &nodes);
+	elapsed = now() - start;
+	printf("%s: foreach %lu nodes in %.3fs (%.1f ns/node)\n", name, nodes,
+	       elapsed, elapsed * 1e9 / (nodes ? nodes : 1));
+
+	nodes = 0;
+	start = now();
+	trie_iter_init(&iter, root, TRIE_PRE_ORDER);
+	while (trie_iter_next(&iter))
+		nodes++;
+	elapsed = now() - start;
+	printf("%s: pre-order %lu nodes in %.3fs (%.1f ns/node)\n", name, nodes,
+	       elapsed, elapsed * 1e9 / (nodes ? nodes : 1));
+
+	start = now();
+	trie_free(root, NULL);
+	printf("%s: free in %.3fs\n", name, now() - start);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long files = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned long depth = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	trie_iter_t iter;
+	trie_node_t *root = NULL;
+	trie_node_t *node = NULL;
+	char *chain = NULL;
+	char path[64];
+	unsigned long i;
+
+	/* Ten files per directory, a hundred directories per parent. */
+	root = trie_new("/", 1);
+	for (i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "/bench/d%lu/d%lu/f%lu", i / 1000,
+		         i / 10 % 100, i % 10);
+		trie_add(root, path, path);
+	}
+	bench("wide", root);
+
+	/* A recursive traversal would run out of stack on this one. */
+	root = trie_new("/", 1);
+	chain = calloc(depth + 1, 2);
+	if (!chain)
+		return 1;
+	for (i = 0; i < depth; i++)
+		memcpy(chain + i * 2, "/d", 2);
+	trie_insert(root, chain);
+	free(chain);
+	trie_iter_init(&iter, root, TRIE_PRE_ORDER);
+	while ((node = trie_iter_next(&iter)))
+		trie_set_data(node, node);
+	bench("deep", root);
+
+	return 0;
+}